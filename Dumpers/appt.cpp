@@ -44,26 +44,30 @@
   * produce a single line description of a single event instance
   */
 void print_summary(
+		FILE *out,	// output stream
 		int n,		// appointment number
 		time_t st,	// starting time
 		time_t et,	// ending time
-		char *d 	// description
+		const char *d, 	// description
+		bool local	// times are local (not UTC)
 	) {
+		const char *z = local ? "" : "Z";
+
 		if (n >= 0)	// appointment #, may be empty for repetitions
-			printf( "%5d: ", n );
+			fprintf( out, "%5d: ", n );
 		else
-			printf( "  -- : ");
+			fprintf( out, "  -- : ");
 
 		// starting date ... and perhaps time
 		struct tm tmstart;
 		gmtime_r( &st, &tmstart );
-		printf("%04d/%02d/%02d",
+		fprintf(out, "%04d/%02d/%02d",
 				tmstart.tm_year+1900, tmstart.tm_mon + 1, tmstart.tm_mday );
 
 		if (et != 0) {		// only if it is not all-day
 			// starting time
-			printf(" %02d:%02d:%02dZ",
-					tmstart.tm_hour, tmstart.tm_min, tmstart.tm_sec );
+			fprintf(out, " %02d:%02d:%02d%s",
+					tmstart.tm_hour, tmstart.tm_min, tmstart.tm_sec, z );
 
 			// print end date if it ends on a different day
 			struct tm tmend;
@@ -71,21 +75,21 @@ void print_summary(
 			if (tmend.tm_year != tmstart.tm_year ||
 					tmend.tm_mon != tmstart.tm_mon ||
 					tmend.tm_mday != tmstart.tm_mday) {
-				printf("-%04d/%02d/%02d ",
+				fprintf(out, "-%04d/%02d/%02d ",
 						tmend.tm_year+1900, tmend.tm_mon + 1, tmend.tm_mday );
 			}
 
 			// print end time if it has a non-zero duration
 			if (et != st)
-				printf(" %02d:%02d:%02dZ",
-					tmend.tm_hour, tmend.tm_min, tmend.tm_sec );
+				fprintf(out, " %02d:%02d:%02d%s",
+					tmend.tm_hour, tmend.tm_min, tmend.tm_sec, z );
 		}
 
 		// print summary, or failing that, the description
 		if (d != 0)
-			printf(" %s", d);
+			fprintf(out, " %s", d);
 
-		printf("\n");
+		fprintf(out, "\n");
 
 		}
  /*
@@ -96,80 +100,130 @@ bool Appt::summarize( int apptnum ) {
 
 	char *descr = (summary != 0) ? summary : description;
 	if (allday) {
-		print_summary(apptnum, start_time, 0, descr);
+		print_summary(stdout, apptnum, start_time, 0, descr);
 		for( struct repetition *r = next; r != 0; r = r->next ) {
-			print_summary(-1, r->start_time, 0, descr);
+			print_summary(stdout, -1, r->start_time, 0, descr);
 		}
 	} else {
 		long duration = end_time - start_time;
-		print_summary(apptnum, start_time, end_time, descr);
+		print_summary(stdout, apptnum, start_time, end_time, descr);
 				for( struct repetition *r = next; r != 0; r = r->next ) {
-					print_summary(-1, r->start_time, r->start_time + duration, descr);
+					print_summary(stdout, -1, r->start_time, r->start_time + duration, descr);
 				}
 	}
 
 	return( true );
 }
 
-void Appt::header() {
-	printf("BEGIN:VCALENDAR\n");
-	printf("VERSION: 2.0\n");
+void Appt::header( FILE *out ) {
+	fprintf(out, "BEGIN:VCALENDAR\n");
+	fprintf(out, "VERSION: 2.0\n");
 }
 
-void Appt::trailer() {
-	printf("END:VCALENDAR\n");
+void Appt::trailer( FILE *out ) {
+	fprintf(out, "END:VCALENDAR\n");
 }
 
 /*
   * produce a vcal for a single event instance
   */
 void print_vcal(
+		FILE *out,	// output stream
 		time_t st,	// starting time
 		time_t et,	// ending time
-		char *sum,	// summary
-		char *desc,	// description
+		const char *sum,	// summary
+		const char *desc,	// description
 		bool allday,// all day long
-		bool pvt	// private appointment
+		bool pvt,	// private appointment
+		const char *uid,	// unique ID (if known)
+		bool cancelled,	// this instance has been deleted
+		const char *tzid	// zone of the (local) times (or 0 for UTC)
 	) {
 	struct tm tm;
 
-	printf("BEGIN:VEVENT\n");
+	fprintf(out, "BEGIN:VEVENT\n");
+	if (uid)
+		fprintf(out, "UID:%s\n", uid);
 
 	gmtime_r( &st, &tm );
 	if (allday)
-		printf("DTSTART;VALUE=DATE:%04d%02d%02d\n",
+		fprintf(out, "DTSTART;VALUE=DATE:%04d%02d%02d\n",
 				tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday);
+	else if (tzid)
+		fprintf(out, "DTSTART;TZID=%s:%04d%02d%02dT%02d%02d%02d\n", tzid,
+			tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec );
 	else
-		printf("DTSTART:%04d%02d%02dT%02d%02d%02dZ\n",
+		fprintf(out, "DTSTART:%04d%02d%02dT%02d%02d%02dZ\n",
 			tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
 			tm.tm_hour, tm.tm_min, tm.tm_sec );
 
 	gmtime_r( &et, &tm );
 	if (allday)
-		printf("DTEND;VALUE=DATE:%04d%02d%02d\n",
+		fprintf(out, "DTEND;VALUE=DATE:%04d%02d%02d\n",
 				tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday);
+	else if (tzid)
+		fprintf(out, "DTEND;TZID=%s:%04d%02d%02dT%02d%02d%02d\n", tzid,
+			tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec );
 	else
-		printf("DTEND:%04d%02d%02dT%02d%02d%02dZ\n",
+		fprintf(out, "DTEND:%04d%02d%02dT%02d%02d%02dZ\n",
 			tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
 			tm.tm_hour, tm.tm_min, tm.tm_sec );
 
 	if (sum)
-		printf("SUMMARY:%s\n", sum);
+		fprintf(out, "SUMMARY:%s\n", sum);
 	if (desc)
-		printf("DESCRIPTION:%s\n", desc);
+		fprintf(out, "DESCRIPTION:%s\n", desc);
 	if (pvt) 
-		printf("CLASS:PRIVATE\n");
+		fprintf(out, "CLASS:PRIVATE\n");
+	if (cancelled)
+		fprintf(out, "STATUS:CANCELLED\n");
+
+	fprintf(out, "END:VEVENT\n");
+}
+
+/*
+  * free/busy time: a VFREEBUSY covering [from, to), with
+  * one FREEBUSY line per busy block
+  */
+static void print_utc( FILE *out, time_t t ) {
+	struct tm tm;
+	gmtime_r( &t, &tm );
+	fprintf(out, "%04d%02d%02dT%02d%02d%02dZ",
+		tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
+		tm.tm_hour, tm.tm_min, tm.tm_sec );
+}
+
+void print_freebusy_begin( FILE *out, time_t from, time_t to ) {
+	fprintf(out, "BEGIN:VFREEBUSY\n");
+	fprintf(out, "DTSTART:");
+	print_utc( out, from );
+	fprintf(out, "\nDTEND:");
+	print_utc( out, to );
+	fprintf(out, "\n");
+}
+
+void print_busy( FILE *out, time_t st, time_t et ) {
+	fprintf(out, "FREEBUSY;FBTYPE=BUSY:");
+	print_utc( out, st );
+	fprintf(out, "/");
+	print_utc( out, et );
+	fprintf(out, "\n");
+}
 
-	printf("END:VEVENT\n");
+void print_freebusy_end( FILE *out ) {
+	fprintf(out, "END:VFREEBUSY\n");
 }
 
 bool Appt::dump_vcalendar( ) {
 
 	long duration = end_time - start_time;
-	print_vcal(start_time, end_time, summary, description, allday, pvt);
+	print_vcal(stdout, start_time, end_time, summary, description, allday, pvt,
+			0, false);
 	for( struct repetition *r = next; r != 0; r = r->next ) {
-		print_vcal(r->start_time, r->start_time + duration,
-				summary, description, allday, pvt );
+		print_vcal(stdout, r->start_time, r->start_time + duration,
+				summary, description, allday, pvt, 0, false );
 	}
 
 	return( true );
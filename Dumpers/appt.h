@@ -4,7 +4,10 @@
  * purpose:	generic appointments and their output
  *		in various useful forms
  */
+#ifndef _APPT_H
+#define _APPT_H
 
+#include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
 
@@ -34,9 +37,9 @@ class Appt {
 	void add(time_t new_time);
 
 	// vcalendar output functions
-	static void header();
+	static void header( FILE *out = stdout );
 	bool dump_vcalendar( );
-	static void trailer();
+	static void trailer( FILE *out = stdout );
 
 	// one line summary
 	bool summarize( int );
@@ -47,3 +50,16 @@ class Appt {
 		struct repetition *next;
 	} *next, *last;
 };
+
+// single instance output routines
+void print_summary( FILE *out, int n, time_t st, time_t et, const char *d,
+		bool local = false );
+void print_vcal( FILE *out, time_t st, time_t et,
+		const char *sum, const char *desc, bool allday, bool pvt,
+		const char *uid, bool cancelled, const char *tzid = 0 );
+
+// free/busy output (busy blocks between a begin and an end)
+void print_freebusy_begin( FILE *out, time_t from, time_t to );
+void print_busy( FILE *out, time_t st, time_t et );
+void print_freebusy_end( FILE *out );
+#endif
@@ -8,355 +8,767 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "palmarchive.h"
 #include "appt.h"
+#include "dbdecode.h"
+#include "dbformat.h"
+#include "strpool.h"
+#include "dbcache.h"
+#include "dbdiff.h"
+#include "dbindex.h"
+#include "dbconflict.h"
+#include "dbfreebusy.h"
+#include "dbmerge.h"
+#include "dbsort.h"
+#include "dbstats.h"
+#include "dbtext.h"
+#include "dbshard.h"
+#include "dbencode.h"
+#include "icsparse.h"
 
 extern bool verbose;	// commentary on what we find
 extern bool whiny;		// complaints about what we find
+extern int threads;		// how many threads to decode with
+extern time_t range_from;	// only instances in [from, to)
+extern time_t range_to;		//	(if to > from)
+extern bool conflicts;		// report double bookings
+extern bool freebusy;		// put out free/busy time
+extern bool freebusy_daily;	//	(a VFREEBUSY per day)
+extern size_t memory_limit;	// sort the instances, within this much memory
+extern int shard_by;		// split the output (SHARD_YEAR, ...)
+extern int shard_pieces;	//	(into this many, for SHARD_COUNT)
 
 /*
- * routine:	nonewlines
- * 
- * purpose:	ensure that a string contains no new lines
+ * a piece of work for a worker thread: a range of records to be
+ * decoded and formatted, or (for a record with a great many
+ * instances) the part of one record's instances in [from, to)
  */
-void nonewlines( char *str ) {
-	
-	// nothing to fix
-	if (str == 0 || *str == 0)
-		return;
-
-	// forward pass, turn them all into spaces
-	char *s;
-	for( s = str; *s; s++ ) {
-		if (*s == '\r' || *s == '\n')
-			*s = ' ';
+struct range_job {
+	PalmArchive	*arc;
+	const size_t	*offsets;
+	long		first;
+	long		last;
+	time_t		from;	// (a chunk, if to > from)
+	time_t		to;
+	const char	*format;
+	char		*buf;	// formatted output
+	size_t		len;
+	bool		wanted;	// did the record want its instances
+	bool		spanned;	// (the times it put out)
+	time_t		first_time;
+	time_t		last_time;
+	int		ret;
+};
+
+// records that would take more than this many days to expand are split
+static const long CHUNK_MIN_DAYS = 366;
+static const long DAY = 24 * 60 * 60;
+
+/*
+ * passes on just the instances that start in a chunk (so that
+ * each instance belongs to exactly one chunk)
+ */
+class ChunkFilter : public DatebookVisitor {
+   public:
+	ChunkFilter( DatebookVisitor *v, time_t from, time_t to ) {
+		_v = v;
+		_from = from;
+		_to = to;
+	}
+	void onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+		if (st >= _from && st < _to)
+			_v->onInstance( r, st, et );
 	}
+   private:
+	DatebookVisitor	*_v;
+	time_t		_from;
+	time_t		_to;
+};
+
+static int chunk_job( struct range_job *j, DatebookFormatter *f ) {
+	PalmCursor c = j->arc->cursorAt( j->offsets[j->first] );
+	DatebookReader reader( &c );
+	reader.setFields( f->fields() );
+	DatebookRecord r;
+	if (reader.readRecord( r ) != DatebookReader::RECORD)
+		return( 1 );
+	r.index = j->first + 1;
 
-	// backwards pass, loose them at end of line
-	for( s--; s > str && *s == ' '; s-- ) {
-		*s = 0;
+	// the first chunk is the one that introduces the record
+	if (j->from == r.start_time) {
+		j->wanted = f->onRecord( r );
+		if (!j->wanted)
+			return( 0 );
 	}
+	ChunkFilter filter( f, j->from, j->to );
+	expand_datebook_range( r, j->from, j->to, &filter );
+	return( 0 );
+}
+
+// the jobs, shared among the workers
+struct job_queue {
+	struct range_job *jobs;
+	long		num_jobs;
+	long		next;		// the next one to be taken
+	pthread_mutex_t	lock;
+};
+
+static void *range_worker( void *arg ) {
+	struct job_queue *q = (struct job_queue *) arg;
+	for( ;; ) {
+		pthread_mutex_lock( &q->lock );
+		long i = q->next++;
+		pthread_mutex_unlock( &q->lock );
+		if (i >= q->num_jobs)
+			break;
+
+		// each job has its own cursor, reader, and output buffer
+		struct range_job *j = &q->jobs[i];
+		FILE *out = open_memstream( &j->buf, &j->len );
+		DatebookFormatter *f = new_formatter( j->format, out );
+		for( int c = 0; c < j->arc->num_categories(); c++ )
+			f->onCategory( c, j->arc->category(c) );
+		if (j->to > j->from)
+			j->ret = chunk_job( j, f );
+		else
+			j->ret = decode_datebook_range( j->arc, j->offsets,
+					j->first, j->last, f );
+		j->spanned = f->span( &j->first_time, &j->last_time );
+		delete f;
+		fclose( out );
+	}
+	return( 0 );
 }
 
 /*
- * routine:	datebook_entry
+ * routine:	plan_jobs
  *
- * purpose:	to read one datebook entry from a datebook archive
- *	
- * returns:	my own standard Appt object
+ * purpose:	divide the work of an archive into jobs of about the
+ *		same cost (the number of days to be expanded), with
+ *		a record that would be more than a job on its own split
+ *		into date range chunks.
  *
- * note:	there are numerous fields that I don't care about,
- *		but the DBA archive stream is such that I have to
- *		read them to find what comes after them. 
+ * returns:	number of jobs (in a malloc'd list), in output order
  */
-Appt *datebook_entry( PalmArchive *pa ) {
+static long plan_jobs( PalmArchive *arc, const size_t *offsets, long num_entry,
+		int nthreads, const char *format, struct range_job **jobsp ) {
+
+	// what each record will cost (without decoding any strings)
+	long *cost = (long *) malloc( (num_entry + 1) * sizeof (long) );
+	time_t *start = (time_t *) malloc( (num_entry + 1) * sizeof (time_t) );
+	time_t *end = (time_t *) malloc( (num_entry + 1) * sizeof (time_t) );
+	long total = 0;
+	for( long i = 0; i < num_entry; i++ ) {
+		PalmCursor c = arc->cursorAt( offsets[i] );
+		DatebookReader reader( &c );
+		reader.setFields( 0 );
+		DatebookRecord r;
+		cost[i] = 1;
+		start[i] = end[i] = 0;
+		if (reader.readRecord( r ) == DatebookReader::RECORD &&
+				r.brand >= 1 && r.brand <= 5 &&
+				(time_t) r.enddate > r.start_time) {
+			cost[i] += (r.enddate - r.start_time) / DAY;
+			start[i] = r.start_time;
+			end[i] = r.enddate;
+		}
+		total += cost[i];
+	}
+	long target = total / (4 * nthreads);
+	if (target < CHUNK_MIN_DAYS)
+		target = CHUNK_MIN_DAYS;
+
+	long num_jobs = 0;
+	long max_jobs = 64;
+	struct range_job *jobs = (struct range_job *)
+			calloc( max_jobs, sizeof (struct range_job) );
+	long first = 0;		// the range being gathered
+	long acc = 0;
+	for( long i = 0; i <= num_entry; i++ ) {
+		bool split = (i < num_entry && cost[i] > target);
+		bool close = (i == num_entry || split || acc >= target);
+		if (close && i > first) {
+			if (num_jobs == max_jobs) {
+				jobs = (struct range_job *) realloc( jobs,
+						2 * max_jobs * sizeof (struct range_job) );
+				memset( jobs + max_jobs, 0, max_jobs * sizeof (struct range_job) );
+				max_jobs *= 2;
+			}
+			jobs[num_jobs].first = first;
+			jobs[num_jobs++].last = i;
+			first = i;
+			acc = 0;
+		}
+		if (i == num_entry)
+			break;
+		if (!split) {
+			acc += cost[i];
+			continue;
+		}
 
-	unsigned long rid = 0;	// start out initialized
+		// a chunk of days at a time
+		long chunks = (cost[i] + target - 1) / target;
+		time_t step = ((end[i] - start[i]) / chunks / DAY + 1) * DAY;
+		for( time_t from = start[i]; from < end[i]; from += step ) {
+			if (num_jobs == max_jobs) {
+				jobs = (struct range_job *) realloc( jobs,
+						2 * max_jobs * sizeof (struct range_job) );
+				memset( jobs + max_jobs, 0, max_jobs * sizeof (struct range_job) );
+				max_jobs *= 2;
+			}
+			jobs[num_jobs].first = i;
+			jobs[num_jobs].last = i + 1;
+			jobs[num_jobs].from = from;
+			jobs[num_jobs++].to = (from + step < end[i]) ? from + step : end[i];
+		}
+		first = i + 1;
+	}
+
+	for( long k = 0; k < num_jobs; k++ ) {
+		jobs[k].arc = arc;
+		jobs[k].offsets = offsets;
+		jobs[k].format = format;
+		jobs[k].wanted = true;
+	}
+	if (verbose)
+		fprintf( stderr, "%ld jobs (of about %ld days each)\n", num_jobs, target );
+
+	free( cost );
+	free( start );
+	free( end );
+	*jobsp = jobs;
+	return( num_jobs );
+}
 
 /*
- * This macro performs a check that I do once for each field
- * just making sure that each field has the expected type.  If
- * it doesn't, we have a mal-formatted archive!
+ * process a datebook archive with multiple threads, each taking
+ * jobs (ranges of records, or chunks of long recurrences) in turn,
+ * and then put out their results in order
  */
-#define	checkType(f,v) { \
-	unsigned long ret = pa->readUlong();	\
-	if (ret != v) {				\
-		fprintf(stderr,			\
-			"record %ld, field %s, type %ld != %d\n",	\
-			 rid, f, ret, v );	\
-		return( 0 );			\
-	}					\
-    }
-	
-	checkType( "record ID", 1 );	// 1: record ID
-	rid = pa->readUlong();
-
-	checkType( "status", 1 );		// 2: appointment status
-	unsigned long sts = pa->readUlong();
-	Appt *thisappt = (sts == 0x04) ? 0 : new Appt;
-
-	checkType( "position", 1 );		// 3: position ???
-	unsigned long pos = pa->readUlong();
-
-	checkType( "start time", 3 );	// 4: starting time
-	unsigned long startTime = pa->readUlong();
-	if (thisappt)
-		thisappt->start_time = startTime;	// standard Unix time
-
-	checkType( "end time", 1 );		// 5: ending time
-	unsigned long endTime = pa->readUlong();
-
-	checkType( "description", 5 );	// 6: description
-	(void) pa->readUlong();	// padding
-	char *descr = pa->readCstring();
-	if (descr && thisappt) {
-		nonewlines( descr );
-		thisappt->summary = descr;
-	}
+static int parallel_datebook( PalmArchive *arc, const char *format, int nthreads ) {
 
-	checkType( "duration", 1 );		// 7: duration
-	unsigned long duration = pa->readUlong();
-	// sometimes they use endtime, sometimes duration
-	if (startTime == endTime && duration > 0)
-		endTime = startTime + duration;
-	if (thisappt)
-		thisappt->end_time = endTime;
-
-	checkType( "note", 5 );			// 8: note
-	(void) pa->readUlong();	// padding
-	char *note = pa->readCstring();
-	if (note && thisappt) {
-		nonewlines( note );
-		thisappt->description = note;
+	long num_entry;
+	size_t *offsets = datebook_offsets( arc, &num_entry );
+	if (offsets == 0)
+		return( 1 );
+
+	// the header (and trailer) belong to the archive as a whole
+	DatebookFormatter *f = new_formatter( format, stdout );
+	DatebookHeader h;
+	datebook_header( arc, num_entry, h );
+	f->onHeader( h );
+	for( int i = 0; i < h.num_categories; i++ )
+		f->onCategory( i, arc->category(i) );
+
+	struct job_queue q;
+	q.num_jobs = plan_jobs( arc, offsets, num_entry, nthreads, format, &q.jobs );
+	q.next = 0;
+	pthread_mutex_init( &q.lock, 0 );
+	if (nthreads > q.num_jobs)
+		nthreads = (q.num_jobs > 0) ? q.num_jobs : 1;
+	pthread_t *tids = (pthread_t *) malloc( nthreads * sizeof (pthread_t) );
+	for( int t = 0; t < nthreads; t++ )
+		pthread_create( &tids[t], 0, range_worker, &q );
+	for( int t = 0; t < nthreads; t++ )
+		pthread_join( tids[t], 0 );
+
+	// stitch the output together
+	int ret = 0;
+	long unwanted = -1;	// a record that did not want its instances
+	fflush( stdout );
+	for( long k = 0; k < q.num_jobs; k++ ) {
+		struct range_job *j = &q.jobs[k];
+		if (j->to <= j->from || j->first != unwanted)
+			fwrite( j->buf, 1, j->len, stdout );
+		if (!j->wanted)
+			unwanted = j->first;	// (so skip its other chunks)
+		free( j->buf );
+		if (j->spanned)
+			f->cover( j->first_time, j->last_time );
+		ret |= j->ret;
 	}
 
-	checkType( "untimed", 6 );		// 9: untimed ???
-	bool untimed  = pa->readUlong();
-	if (untimed && thisappt)
-		thisappt->allday = true;
+	f->finish();
+	delete f;
+	pthread_mutex_destroy( &q.lock );
+	free( tids );
+	free( q.jobs );
+	free( offsets );
+	return( ret );
+}
 
-	checkType( "private", 6 );		// 10: private appointment
-	bool pvt = pa->readUlong();
-	if (thisappt)
-		thisappt->pvt = pvt;
+/*
+ * do we need the whole datebook loaded into a table
+ */
+static bool needs_table() {
+	return( range_to > range_from || conflicts || freebusy );
+}
 
-	checkType( "category", 1 );		// 11: category ???
-	unsigned long category = pa->readUlong();
+/*
+ * is this a report (rather than the formatted instances)
+ */
+static bool report_mode() {
+	return( conflicts || freebusy );
+}
+
+/*
+ * the processing that works from an interval index over the
+ * (already loaded) table: conflict reports, free/busy time,
+ * or only the instances in the selected time range.
+ */
+static int table_datebook( DatebookTable *table, DatebookFormatter *f ) {
+	DatebookIndex index( table );
+	if (conflicts)
+		find_conflicts( &index, stdout );
+	else if (freebusy) {
+		Appt::header( stdout );
+		find_freebusy( &index, range_from, range_to, freebusy_daily, stdout );
+		Appt::trailer( stdout );
+	} else {
+		index.query( range_from, range_to, f );
+		f->finish();
+	}
+	delete f;
+	return( 0 );
+}
+
+/*
+ * process a datebook archive
+ */
+int process_datebook( PalmArchive *arc, const char *format ) {
+
+	if (needs_table()) {
+		DatebookTable table;
+		if (freebusy)
+			table.setFields( 0 );	// (it is all about the times)
+		if (decode_datebook( arc, &table ) != 0)
+			return( 1 );
+		DatebookFormatter *f = new_formatter( format, stdout );
+		if (!report_mode()) {
+			DatebookHeader h;
+			datebook_header( arc, table.rows(), h );
+			f->onHeader( h );
+			for( int i = 0; i < h.num_categories; i++ )
+				f->onCategory( i, arc->category(i) );
+		}
+		return( table_datebook( &table, f ) );
+	}
 
-	checkType( "alarm set", 6 );	// 12: alarm set for this appointment
-	bool alarm_set = pa->readUlong();
+	if (memory_limit > 0) {
+		DatebookFormatter *f = new_formatter( format, stdout );
+		DatebookSorter sorter( f, memory_limit );
+		int ret = decode_datebook( arc, &sorter );
+		if (sorter.finish() < 0)
+			ret = 1;
+		f->finish();
+		delete f;
+		return( ret );
+	}
 
-	checkType( "alarm units", 1 );	// 13: how far in advance to give alarm
-	unsigned long alarm_units = pa->readUlong();
+	if (threads > 1 && format_streams( format ))
+		return( parallel_datebook( arc, format, threads ) );
 
-	checkType( "alarm type", 1 );	// 14: alarm units (0->min, 1->hours, 2->days)
-	unsigned long alarm_type = pa->readUlong();
+	DatebookFormatter *f = new_formatter( format, stdout );
+	int ret = decode_datebook( arc, f );
+	f->finish();
+	delete f;
 
-	checkType( "repeat", 8 );		// 15: repeat information
+	return( ret );
+}
 
-	unsigned short num_except = pa->readUshort();	// 15a # exceptions
-	unsigned long *excepts = 0;
-	if (num_except > 0) {
-		excepts = (unsigned long *) malloc(num_except * sizeof (unsigned long));
-		for( int i = 0; i < num_except; i++ ) {
-			excepts[i] = pa->readUlong();			// 15b exception entries
-		}
+/*
+ * process a datebook archive through a sidecar cache (in dir)
+ *
+ * returns:	0/1 success/failure, or -1 if the cache could not
+ *		be used (in which case the caller should do it the
+ *		old fashioned way)
+ */
+int process_cached_datebook( const char *filename, const char *dir, const char *format ) {
+
+	DatebookCache *cache = datebook_cache_load( filename, dir );
+	if (cache == 0)
+		return( -1 );
+
+	if (needs_table()) {
+		DatebookTable table;
+		cache->decode( &table );
+		DatebookFormatter *f = new_formatter( format, stdout );
+		if (!report_mode())
+			cache->decodeHeader( f );
+		delete cache;
+		return( table_datebook( &table, f ) );
 	}
 
-	// repeat event class entry
-	unsigned short flag = pa->readUshort();			// 15c type of repeat event
-	char *classname = 0;
-	if (flag == 0xffff) {			// 15d class entries
-		unsigned short tag = pa->readUshort();
-		if (tag != 1) {
-			fprintf(stderr, "ERROR - Exception class entry, tag (%d) != 1\n", tag);
-			return(0);
-		}
-		unsigned short len = pa->readUshort();
-		classname = (char *) malloc( len + 1 );
-		for( int i = 0; i < len; i++ ) {
-			classname[i] = pa->readUbyte();
-		}
-		classname[len] = 0;
-		// these seem to be completely ignorable ???
+	DatebookFormatter *f = new_formatter( format, stdout );
+	int ret;
+	if (memory_limit > 0) {
+		DatebookSorter sorter( f, memory_limit );
+		ret = cache->decode( &sorter );
+		if (sorter.finish() < 0)
+			ret = 1;
+	} else
+		ret = cache->decode( f );
+	f->finish();
+	delete f;
+	delete cache;
+
+	return( ret );
+}
+
+/*
+ * put out only the differences between two versions of a datebook
+ * (either of which may be an archive or a cache file)
+ */
+int process_datebook_diff( const char *oldfile, const char *newfile,
+		const char *dir, const char *format ) {
+
+	DatebookCache *old = datebook_cache_load( oldfile, dir );
+	if (old == 0) {
+		fprintf( stderr, "Error loading %s\n", oldfile );
+		return( 1 );
+	}
+	DatebookCache *cur = datebook_cache_load( newfile, dir );
+	if (cur == 0) {
+		fprintf( stderr, "Error loading %s\n", newfile );
+		delete old;
+		return( 1 );
 	}
 
-	if (flag != 0) {
-		unsigned long brand = pa->readUlong();
-		unsigned long interval = pa->readUlong();
-		unsigned long enddate = pa->readUlong();
-		unsigned long wstart = pa->readUlong();
+	DatebookFormatter *f = new_formatter( format, stdout );
+	int ret = diff_datebook( old, cur, f );
+	f->finish();
+	delete f;
+	delete cur;
+	delete old;
 
-		// each supported repetition type (brand) has different args
-		if (brand < 1 || brand > 6) {
-			fprintf(stderr, "fatal: unrecognized repetition brand: %ld", brand);
-			exit( -1 );		// at this point, we have lost sync w/stream
-		}
+	return( ret );
+}
 
-		// figure out what fields we expect to find
-		const int has_day_x = 1;
-		const int has_day_m = 2;
-		const int has_day_n = 4;
-		const int has_week_x = 8;
-		const int has_mon_x = 16;
-		unsigned char brandmask[] = {
-				0,						// 0: undefined
-				has_day_x,				// 1: daily
-				has_day_x+has_day_m,	// 2: weekly, by days
-				has_day_x+has_week_x,	// 3: monthly, by day
-				has_day_n,				// 4: monthly, by date
-				has_day_n+has_mon_x,	// 5: yearly, by date
-				has_day_x				// 6: yearly, by day
-		};
-
-		unsigned long day_x = 0;
-		if (brandmask[brand] & has_day_x) {
-			day_x = pa->readUlong();
-		}
-		unsigned char day_mask = 0;
-		if (brandmask[brand] & has_day_m) {
-			day_mask = pa->readUbyte();
-			if (day_mask == 0 || day_mask > 0x7f)
-				fprintf(stdout, "WARNING - day mask = 0x%x", day_mask);
-		}
-		unsigned long week_x = 0;
-		if (brandmask[brand] & has_week_x) {
-			week_x = pa->readUlong();
-		}
-		unsigned long day_num = 0;
-		if (brandmask[brand] & has_day_n) {
-			day_num = pa->readUlong();
-		}
-		unsigned long mon_x = 0;
-		if (brandmask[brand] & has_mon_x) {
-			mon_x = pa->readUlong();
-		}
+/*
+ * counts the instances (for sharding into equal pieces)
+ */
+class InstanceCounter : public DatebookVisitor {
+   public:
+	InstanceCounter()	{ count = 0; }
+	void onInstance( const DatebookRecord &, time_t, time_t ) { count++; }
+	unsigned fields()	{ return( 0 ); }
 
-		// unix time values for common intervals
-		const int DAY = 24 * 60 * 60;
-
-		// generate all the repetitions of this event
-		time_t d = startTime;
-		time_t next = d + DAY;		// default: day at a time
-		while(d < enddate) {
-			// deconstruct this into its date components
-			struct tm tm;
-			gmtime_r( &d, &tm );
-
-			// see if this matches the specified pattern
-			switch( brand ) {
-			case 1: // daily ... parameter: interval
-				break;
-
-			case 2: // weekly by day ... parameters: day mask
-				if ((day_mask & (1<<tm.tm_wday)) == 0)
-					goto skip;
-				// FIX - the above should probably be corrected for wstart
-				//	     but I had no sample data from which to understand
-				//		 its precise sense.
-				break;
-
-			case 3: // monthly by day ... parameters: day, week
-				if (tm.tm_wday != day_x - 1)	// right day?
-					goto skip;
-				if (tm.tm_mday <= (week_x - 1) * 7)	// right week?
-					goto skip;
-				if (tm.tm_mday > week_x * 7)	// right week?
-					goto skip;
-				break;
-
-			case 4: // monthly by date ... parameters: day number
-				if (tm.tm_mday != day_num)
-					goto skip;
-				break;
-
-			case 5: // annual by date ... parameters: month and day
-				if (tm.tm_mon != mon_x)
-					goto skip;
-				if (tm.tm_mday != day_num)
-					goto skip;
-				break;
-
-			case 6: // FIX - annual by day
-					// 		I am totally unclear on exactly what this means
-					//		and I had no sample data from which to understand it
-				fprintf(stderr, "ERROR: annual by day repetition\n");
-				d = enddate;
-				goto skip;
-			}
+	long	count;
+};
 
-			// the date of the original event is not a repetition
-			if (d == startTime)
-				goto skip;
+/*
+ * put out a datebook as several calendars (by year, category, or
+ * just size), next to the archive: foo.dba -> foo-2003.ics, ...
+ * and list the files written
+ */
+int process_datebook_shards( const char *filename, const char *format ) {
+	PalmArchive arc( filename );
+	if (arc.error() != 0) {
+		fprintf( stderr, "Error (%s) initializing %s\n", arc.error(), filename );
+		return( 1 );
+	}
+	if (arc.fileType() != arc.DBA_SIG) {
+		fprintf( stderr, "%s is not a datebook\n", filename );
+		return( 1 );
+	}
 
-			// see if this date is on the exception list
-			for( int i = 0; i < num_except; i++ ) {
-					if (d >= excepts[i] && d < excepts[i] + DAY)
-						goto skip;
-			}
+	// (we may make two passes over the records)
+	long num_entry;
+	size_t *offsets = datebook_offsets( &arc, &num_entry );
+	if (offsets == 0)
+		return( 1 );
+	long total = 0;
+	if (shard_by == SHARD_COUNT) {
+		InstanceCounter counter;
+		decode_datebook_range( &arc, offsets, 0, num_entry, &counter );
+		total = counter.count;
+	}
 
-			// attach this date as a repetition instance
-			thisappt->add(d);
+	char *prefix = strdup( filename );
+	size_t len = strlen( prefix );
+	if (len > 4 && strcasecmp( prefix + len - 4, ".dba" ) == 0)
+		prefix[len - 4] = 0;
+	DatebookSharder sharder( format, prefix, shard_by, shard_pieces, total );
+	DatebookHeader h;
+	datebook_header( &arc, num_entry, h );
+	sharder.onHeader( h );
+	for( int i = 0; i < h.num_categories; i++ )
+		sharder.onCategory( i, arc.category(i) );
+	int ret = decode_datebook_range( &arc, offsets, 0, num_entry, &sharder );
+	int n = sharder.finish();
+	if (n < 0)
+		ret = 1;
+	for( int i = 0; i < n; i++ )
+		printf( "%s\n", sharder.shardName( i ) );
+	free( prefix );
+	free( offsets );
+	return( ret );
+}
 
-			skip:	// try the next candidate
-				d += DAY;
+/*
+ * put out several datebooks (e.g. overlapping backups) as one
+ * calendar, in time order and without the duplicates
+ */
+int process_datebook_merge( char **files, int n, const char *dir, const char *format ) {
+
+	DatebookTable **tables = (DatebookTable **) calloc( n, sizeof (DatebookTable *) );
+	DatebookStream **streams = (DatebookStream **) calloc( n, sizeof (DatebookStream *) );
+	DatebookFormatter *f = new_formatter( format, stdout );
+	StringPool pool;	// (so duplicates compare by pointer)
+	int ret = 0;
+
+	for( int i = 0; i < n; i++ ) {
+		DatebookCache *cache = datebook_cache_load( files[i], dir );
+		if (cache == 0) {
+			fprintf( stderr, "Error loading %s\n", files[i] );
+			ret = 1;
+			break;
 		}
+		tables[i] = new DatebookTable( &pool );
+		cache->decode( tables[i] );
+		if (i == 0)
+			cache->decodeHeader( f );
+		delete cache;
+		streams[i] = new DatebookStream( tables[i] );
 	}
 
-	if (excepts != 0)
-		free(excepts);
-	if (classname != 0)
-		free(classname);
+	if (ret == 0) {
+		merge_datebooks( streams, n, f );
+		f->finish();
+	}
 
-	return( thisappt );
+	delete f;
+	for( int i = 0; i < n; i++ ) {
+		delete streams[i];
+		delete tables[i];
+	}
+	free( streams );
+	free( tables );
+	return( ret );
 }
 
+/*
+ * a batch of archives being scanned for statistics: each
+ * worker takes the next archive, into its own DatebookStats
+ */
+struct stats_batch {
+	char		**files;
+	int		num_files;
+	int		next;		// the next one to be taken
+	pthread_mutex_t	lock;
+};
+
+struct stats_job {
+	struct stats_batch *batch;
+	DatebookStats	*stats;
+	int		ret;
+};
+
+static void *stats_worker( void *arg ) {
+	struct stats_job *j = (struct stats_job *) arg;
+	struct stats_batch *b = j->batch;
+	for( ;; ) {
+		pthread_mutex_lock( &b->lock );
+		int i = b->next++;
+		pthread_mutex_unlock( &b->lock );
+		if (i >= b->num_files)
+			break;
+
+		PalmArchive arc( b->files[i] );
+		if (arc.error() != 0) {
+			fprintf( stderr, "Error (%s) initializing %s\n",
+					arc.error(), b->files[i] );
+			j->ret = 1;
+		} else if (decode_datebook( &arc, j->stats ) != 0)
+			j->ret = 1;
+	}
+	return( 0 );
+}
 
 /*
- * process a datebook archive
+ * put out statistics over a batch of archives (using all
+ * the processors, unless told how many threads to use)
  */
-int process_datebook( PalmArchive *arc, const char *format ) {
+int process_datebook_stats( char **files, int n ) {
+
+	int nthreads = threads;
+	if (nthreads <= 1)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+	if (nthreads > n)
+		nthreads = n;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	struct stats_batch batch;
+	batch.files = files;
+	batch.num_files = n;
+	batch.next = 0;
+	pthread_mutex_init( &batch.lock, 0 );
+
+	struct stats_job *jobs = (struct stats_job *)
+			calloc( nthreads, sizeof (struct stats_job) );
+	pthread_t *tids = (pthread_t *) malloc( nthreads * sizeof (pthread_t) );
+	for( int t = 0; t < nthreads; t++ ) {
+		jobs[t].batch = &batch;
+		jobs[t].stats = new DatebookStats;
+		pthread_create( &tids[t], 0, stats_worker, &jobs[t] );
+	}
 
-	const int FIELDS_PER_ENTRY	= 15;
+	int ret = 0;
+	DatebookStats total;
+	for( int t = 0; t < nthreads; t++ ) {
+		pthread_join( tids[t], 0 );
+		total.add( jobs[t].stats );
+		delete jobs[t].stats;
+		ret |= jobs[t].ret;
+	}
+	total.report( stdout );
 
+	pthread_mutex_destroy( &batch.lock );
+	free( tids );
+	free( jobs );
+	return( ret );
+}
 
-	// make sure that it is, in fact, a datebook archive
-	if (arc->fileType() != arc->DBA_SIG) {
-		fprintf(stderr, "ERROR: file is not a DateBook Archive\n");
-		return 1;
+/*
+ * build a full-text index over the summaries and notes of a
+ * batch of archives
+ */
+int process_text_index( char **files, int n, const char *path ) {
+
+	TextIndexBuilder b;
+	int ret = 0;
+	for( int i = 0; i < n; i++ ) {
+		PalmArchive arc( files[i] );
+		b.setArchive( files[i] );	// (so the numbering matches)
+		if (arc.error() != 0) {
+			fprintf( stderr, "Error (%s) initializing %s\n",
+					arc.error(), files[i] );
+			ret = 1;
+		} else if (decode_datebook( &arc, &b ) != 0)
+			ret = 1;
 	}
 
-	// make sure I understand it as such
-	if (arc->fields_per_row() != FIELDS_PER_ENTRY) {
-		fprintf(stderr, "ERROR: fields per row = %d, expected %d\n",
-				arc->fields_per_row(), FIELDS_PER_ENTRY);
-		return( 1 );
+	if (b.write( path ) != 0) {
+		fprintf( stderr, "Error writing index %s\n", path );
+		ret = 1;
 	}
+	return( ret );
+}
 
-	// the next 4-bytes should be the number of datebook entries
-	// multiplied by 15 (number of fields per entry)
-	long num_entry = arc->readUlong();
-	if (num_entry % FIELDS_PER_ENTRY != 0) {
-		fprintf( stderr, "# datebook entries (%ld) not a multiple of %d\n",
-			num_entry, FIELDS_PER_ENTRY );
+/*
+ * a growable list of (query) words
+ */
+struct word_list {
+	char	**words;
+	int	num;
+	int	max;
+};
+
+static void add_query_word( const char *word, unsigned len, void *arg ) {
+	struct word_list *l = (struct word_list *) arg;
+	if (l->num == l->max) {
+		l->max = l->max ? 2 * l->max : 16;
+		l->words = (char **) realloc( l->words, l->max * sizeof (char *) );
 	}
-	num_entry /= FIELDS_PER_ENTRY;
+	l->words[l->num++] = strndup( word, len );
+}
 
-	if (num_entry < 0 || num_entry > 1000000) {
-		fprintf( stderr, "Unreasonable number of datebook entries: %ld\n",
-			num_entry );
+/*
+ * look up the records whose text contains all of the words
+ */
+int process_text_search( const char *path, char **args, int n ) {
+
+	TextIndex *index = TextIndex::open( path );
+	if (index == 0) {
+		fprintf( stderr, "Error opening index %s\n", path );
 		return( 1 );
 	}
 
-	int processed = 0;
-	int discards = 0;
-
-	if (format != 0 && strcmp(format, "vcalendar") == 0)
-		Appt::header();
-
-	for( int i = 0; i < num_entry; i++ ) {
-		Appt *a = datebook_entry( arc );
-		if (a) {
-			if (format != 0 && strcmp(format, "vcalendar") == 0)
-				a->dump_vcalendar();
-			else
-				a->summarize( i+1 );
-			processed++;
-
-			// we're done with this one
-			delete a;
-		} else {
-			discards++;
-		}
+	// the words are found just as they were when indexing (and
+	// the index has them as the Palm does, in Latin-1)
+	struct word_list l = { 0, 0, 0 };
+	for( int i = 0; i < n; i++ ) {
+		size_t len = strlen( args[i] );
+		char *word = (char *) malloc( len + 1 );
+		len = utf8_to_latin1( args[i], len, word );
+		text_words( word, len, add_query_word, &l );
+		free( word );
 	}
 
-	if (format != 0 && strcmp(format, "vcalendar") == 0)
-		Appt::trailer();
+	uint64_t *keys;
+	long found = index->search( (const char **) l.words, l.num, &keys );
+	for( long i = 0; i < found; i++ )
+		printf( "%s\t%u\n", index->archive( keys[i] >> 32 ),
+				(unsigned) (keys[i] & 0xffffffff) );
+	if (verbose)
+		fprintf( stderr, "%ld records found\n", (found < 0) ? 0 : found );
+
+	free( keys );
+	for( int i = 0; i < l.num; i++ )
+		free( l.words[i] );
+	free( l.words );
+	delete index;
+	return( (found > 0) ? 0 : 1 );
+}
+
+/*
+ * the reverse: encode one or more iCalendar files as a datebook archive
+ */
+int process_ics_encode( char **files, int n, const char *path ) {
+
+	IcsParser **parsers = (IcsParser **) calloc( n, sizeof (IcsParser *) );
+	char *categories[DBA_MAX_CATEGORIES];
+	int num_categories = 0;
+	categories[num_categories++] = strdup( "Unfiled" );
+	int ret = 0;
+
+	// the categories have to go in the header, ahead of the records
+	for( int i = 0; i < n; i++ ) {
+		parsers[i] = new IcsParser( files[i] );
+		if (parsers[i]->error() != 0) {
+			fprintf( stderr, "Error (%s) initializing %s\n",
+					parsers[i]->error(), files[i] );
+			ret = 1;
+		} else
+			parsers[i]->scanCategories( categories, &num_categories,
+					DBA_MAX_CATEGORIES );
+	}
 
-	if (verbose) {
-		fprintf(stderr, "expected %ld, processed %d, discarded %d\n",
-				num_entry, processed, discards);
+	DatebookWriter w;
+	if (ret == 0 && !w.open( path, categories, num_categories ))
+		ret = 1;
+	for( int i = 0; ret == 0 && i < n; i++ ) {
+		DatebookRecord r;
+		parsers[i]->setCategories( categories, num_categories );
+		while( ret == 0 && parsers[i]->next( r ) ) {
+			r.index = r.rid = r.position = w.records() + 1;
+			if (w.records() >= DBA_MAX_RECORDS) {
+				fprintf( stderr, "%s: too many records (at most %ld)\n",
+						path, DBA_MAX_RECORDS );
+				ret = 1;
+			} else if (!w.write( r )) {
+				perror( path );
+				ret = 1;
+			}
+		}
+		if (verbose && parsers[i]->skipped() > 0)
+			fprintf( stderr, "%s: %ld events skipped\n", files[i],
+					parsers[i]->skipped() );
 	}
-	return( 0 );
+	if (ret == 0 && !w.finish())
+		ret = 1;
+	if (ret == 0 && verbose)
+		fprintf( stderr, "%ld records written to %s\n", w.records(), path );
+
+	for( int i = 0; i < n; i++ )
+		delete parsers[i];
+	free( parsers );
+	for( int i = 0; i < num_categories; i++ )
+		free( categories[i] );
+	return( ret );
 }
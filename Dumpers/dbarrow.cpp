@@ -0,0 +1,840 @@
+/*
+ * module:	dbarrow.cpp
+ *
+ * purpose:	write decoded datebook records as an Arrow IPC file
+ *
+ * note:	the file is the magic, the stream (a schema message,
+ *		a dictionary batch for each dictionary, and then the
+ *		record batches), and a footer that says where each
+ *		batch is.  The metadata are flatbuffers, which are built
+ *		back to front (an object is written before anything
+ *		that refers to it), by the little builder below.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "dbarrow.h"
+#include "palmhash.h"
+
+long arrow_batch_rows = ARROW_BATCH_ROWS;
+
+/*
+ * a flatbuffer, built from the end of the buffer towards the front:
+ * an object is known by how far from the end (of the finished
+ * buffer) it starts, which does not change as more is added.
+ */
+class FlatBuilder {
+   public:
+	FlatBuilder()	{ _buf = 0; _max = 0; reset(); }
+	~FlatBuilder()	{ free( _buf ); }
+	void reset()	{ _size = 0; _minalign = 1; _num_slots = 0; }
+
+	// the finished buffer
+	const unsigned char *data()	{ return( _buf + _max - _size ); }
+	size_t size()			{ return( _size ); }
+
+	unsigned string( const char *s );
+	unsigned structs( const int64_t *v, long n, int per );	// (of per int64s)
+	unsigned tables( const unsigned *v, int n );
+
+	// a table: start(), its fields (by slot), and end()
+	void start()	{ _table = _size; _num_slots = 0; }
+	void add8( int slot, unsigned v )	{ prep( 1, 0 ); push( v, 1 ); mark( slot ); }
+	void add16( int slot, unsigned v )	{ prep( 2, 0 ); push( v, 2 ); mark( slot ); }
+	void add32( int slot, unsigned v )	{ prep( 4, 0 ); push( v, 4 ); mark( slot ); }
+	void add64( int slot, int64_t v )	{ prep( 8, 0 ); push( v, 8 ); mark( slot ); }
+	void addOffset( int slot, unsigned off ) { refer( off ); mark( slot ); }
+	unsigned end();
+
+	void finish( unsigned root );
+
+   private:
+	void prep( size_t align, size_t extra );
+	void reserve( size_t n );
+	void push( uint64_t v, int width );
+	void refer( unsigned off );
+	void mark( int slot ) {
+		_slots[_num_slots].slot = slot;
+		_slots[_num_slots++].at = _size;
+	}
+
+	unsigned char	*_buf;
+	size_t		_max;
+	size_t		_size;		// (used, at the end of _buf)
+	size_t		_minalign;
+	size_t		_table;		// where the table being built began
+	struct {
+		int	slot;
+		size_t	at;
+	}		_slots[8];
+	int		_num_slots;
+};
+
+void FlatBuilder::reserve( size_t n ) {
+	if (_size + n <= _max)
+		return;
+	size_t max = 2 * _max;
+	if (max < _size + n)
+		max = _size + n;
+	if (max < 1024)
+		max = 1024;
+	unsigned char *buf = (unsigned char *) malloc( max );
+	memcpy( buf + max - _size, _buf + _max - _size, _size );
+	free( _buf );
+	_buf = buf;
+	_max = max;
+}
+
+// (little endian, as Arrow is)
+void FlatBuilder::push( uint64_t v, int width ) {
+	reserve( width );
+	_size += width;
+	unsigned char *p = _buf + _max - _size;
+	for( int i = 0; i < width; i++ )
+		p[i] = v >> (8 * i);
+}
+
+// pad so that, once extra more bytes are added, we are aligned
+void FlatBuilder::prep( size_t align, size_t extra ) {
+	if (align > _minalign)
+		_minalign = align;
+	size_t pad = (0 - (_size + extra)) & (align - 1);
+	while( pad-- > 0 )
+		push( 0, 1 );
+}
+
+// an offset (from where it is put) to an object already built
+void FlatBuilder::refer( unsigned off ) {
+	prep( 4, 0 );
+	push( _size - off + 4, 4 );
+}
+
+unsigned FlatBuilder::string( const char *s ) {
+	size_t len = strlen( s );
+	prep( 4, len + 1 );
+	push( 0, 1 );
+	reserve( len );
+	_size += len;
+	memcpy( _buf + _max - _size, s, len );
+	push( len, 4 );
+	return( _size );
+}
+
+unsigned FlatBuilder::structs( const int64_t *v, long n, int per ) {
+	prep( 4, n * per * 8 );
+	prep( 8, n * per * 8 );
+	for( long i = n * per - 1; i >= 0; i-- )
+		push( v[i], 8 );
+	push( n, 4 );
+	return( _size );
+}
+
+unsigned FlatBuilder::tables( const unsigned *v, int n ) {
+	prep( 4, n * 4 );
+	for( int i = n - 1; i >= 0; i-- )
+		refer( v[i] );
+	push( n, 4 );
+	return( _size );
+}
+
+/*
+ * routine:	end
+ *
+ * purpose:	finish a table, with its vtable (the offset of each
+ *		field, by slot) in front of it
+ */
+unsigned FlatBuilder::end() {
+	prep( 4, 0 );
+	push( 0, 4 );		// (to the vtable, patched below)
+	size_t table = _size;
+
+	int num = 0;
+	for( int i = 0; i < _num_slots; i++ )
+		if (_slots[i].slot >= num)
+			num = _slots[i].slot + 1;
+	for( int s = num - 1; s >= 0; s-- ) {
+		size_t at = 0;
+		for( int i = 0; i < _num_slots; i++ )
+			if (_slots[i].slot == s)
+				at = table - _slots[i].at;
+		push( at, 2 );
+	}
+	push( table - _table, 2 );
+	push( 2 * (num + 2), 2 );
+
+	uint32_t vt = _size - table;
+	unsigned char *p = _buf + _max - table;
+	for( int i = 0; i < 4; i++ )
+		p[i] = vt >> (8 * i);
+	_num_slots = 0;
+	return( table );
+}
+
+void FlatBuilder::finish( unsigned root ) {
+	prep( _minalign, 4 );
+	refer( root );
+}
+
+/*
+ * the Arrow bits we use
+ */
+static const int ARROW_V5 = 4;		// MetadataVersion
+static const int MSG_SCHEMA = 1;	// MessageHeader
+static const int MSG_DICTIONARY = 2;
+static const int MSG_BATCH = 3;
+static const int TYPE_INT = 2;		// Type
+static const int TYPE_UTF8 = 5;
+static const int TYPE_BOOL = 6;
+static const int TYPE_DATE = 8;
+static const int TYPE_TIMESTAMP = 10;
+
+static const long DAY = 24 * 60 * 60;
+
+static const unsigned char magic[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+
+// what a column holds, and so how it is laid out
+static const int COL_INT32 = 0;		// int32 values
+static const int COL_UINT32 = 1;
+static const int COL_TIME = 2;		// int64 seconds
+static const int COL_DATE = 3;		// int32 days
+static const int COL_BOOL = 4;		// bits
+static const int COL_DICT = 5;		// int32 indices into a dictionary
+static const int COL_UTF8 = 6;		// (64 bit) offsets, and the strings
+
+struct arrow_column {
+	const char	*name;
+	int		kind;
+	int		dict;		// (COL_DICT) which dictionary
+	bool		nullable;
+	long		rows;
+	long		nulls;
+	unsigned char	*values;
+	size_t		len;		// bytes of values used
+	size_t		max;
+	unsigned char	*valid;		// validity bits (if nullable)
+	size_t		valid_max;
+	char		*data;		// (COL_UTF8) the strings
+	size_t		data_len;
+	size_t		data_max;
+};
+
+// a dictionary's strings, and a hash table of them
+struct arrow_dict {
+	struct arrow_column values;
+	int32_t		*table;		// (index + 1, or 0 if empty)
+	size_t		buckets;
+};
+
+// where a message is in the file (for the footer)
+struct arrow_block {
+	int64_t		offset;
+	int64_t		meta;
+	int64_t		body;
+	bool		dictionary;
+};
+
+/*
+ * the columns, in order.  The last few are only in the records
+ * form, where a row is a record (and its repetition rule).
+ */
+enum { C_INDEX, C_RID, C_START, C_END, C_ALLDAY, C_PRIVATE, C_ALARM,
+	C_CATEGORY, C_SUMMARY, C_DESCRIPTION, C_CHANGE,
+	C_REPEAT, C_INTERVAL, C_UNTIL, C_EXCEPTIONS };
+static const int INSTANCE_COLUMNS = C_REPEAT;
+static const int RECORD_COLUMNS = C_EXCEPTIONS + 1;
+
+static const struct {
+	const char	*name;
+	int		kind;
+	int		dict;
+	bool		nullable;
+} columns[] = {
+	{ "index",	COL_INT32,	-1,	false },
+	{ "rid",	COL_UINT32,	-1,	false },
+	{ "start",	COL_TIME,	-1,	false },
+	{ "end",	COL_TIME,	-1,	false },
+	{ "allday",	COL_BOOL,	-1,	false },
+	{ "private",	COL_BOOL,	-1,	false },
+	{ "alarm",	COL_BOOL,	-1,	false },
+	{ "category",	COL_DICT,	0,	false },
+	{ "summary",	COL_DICT,	1,	true },
+	{ "description", COL_UTF8,	-1,	true },
+	{ "change",	COL_DICT,	2,	true },
+	{ "repeat",	COL_DICT,	3,	true },
+	{ "interval",	COL_UINT32,	-1,	true },
+	{ "until",	COL_DATE,	-1,	true },
+	{ "exceptions",	COL_INT32,	-1,	true },
+};
+static const int NUM_DICTS = 4;
+
+static void grow( unsigned char **buf, size_t *max, size_t need ) {
+	if (need <= *max)
+		return;
+	size_t n = *max ? 2 * *max : 4096;
+	while( n < need )
+		n *= 2;
+	*buf = (unsigned char *) realloc( *buf, n );
+	memset( *buf + *max, 0, n - *max );
+	*max = n;
+}
+
+static void put_bit( unsigned char **bits, size_t *max, long i, bool on ) {
+	grow( bits, max, i / 8 + 1 );
+	if (on)
+		(*bits)[i / 8] |= 1 << (i % 8);
+}
+
+// the end of a row, in a column (valid or null)
+static void put_valid( struct arrow_column *c, bool valid ) {
+	if (c->nullable)
+		put_bit( &c->valid, &c->valid_max, c->rows, valid );
+	if (!valid)
+		c->nulls++;
+	c->rows++;
+}
+
+static void put_value( struct arrow_column *c, const void *v, size_t width, bool valid ) {
+	grow( &c->values, &c->max, c->len + width );
+	if (valid)
+		memcpy( c->values + c->len, v, width );
+	c->len += width;
+	put_valid( c, valid );
+}
+
+static void put_int32( struct arrow_column *c, int32_t v, bool valid = true ) {
+	put_value( c, &v, sizeof v, valid );
+}
+
+static void put_bool( struct arrow_column *c, bool v ) {
+	put_bit( &c->values, &c->max, c->rows, v );
+	put_valid( c, true );
+}
+
+// (s is 0 for a null)
+static void put_utf8( struct arrow_column *c, const char *s, size_t len ) {
+	if (s != 0) {
+		if (c->data_len + len > c->data_max) {
+			c->data_max = 2 * c->data_max + len + 4096;
+			c->data = (char *) realloc( c->data, c->data_max );
+		}
+		memcpy( c->data + c->data_len, s, len );
+		c->data_len += len;
+	}
+	int64_t end = c->data_len;
+	grow( &c->values, &c->max, c->len + sizeof end );
+	memcpy( c->values + c->len, &end, sizeof end );
+	c->len += sizeof end;
+	put_valid( c, s != 0 );
+}
+
+/*
+ * routine:	dict_index
+ *
+ * purpose:	find a string in a dictionary (adding it, if it is new)
+ *
+ * returns:	its index
+ */
+static int32_t dict_index( struct arrow_dict *d, const char *s, size_t len ) {
+	if (2 * (d->values.rows + 1) > (long) d->buckets) {
+		size_t buckets = d->buckets ? 2 * d->buckets : 1024;
+		int32_t *table = (int32_t *) calloc( buckets, sizeof (int32_t) );
+		const int64_t *off = (const int64_t *) d->values.values;
+		for( long e = 0; e < d->values.rows; e++ ) {
+			size_t b = palm_hash( d->values.data + off[e], off[e+1] - off[e] );
+			while( table[b & (buckets - 1)] != 0 )
+				b++;
+			table[b & (buckets - 1)] = e + 1;
+		}
+		free( d->table );
+		d->table = table;
+		d->buckets = buckets;
+	}
+
+	size_t mask = d->buckets - 1;
+	for( size_t b = palm_hash( s, len ) & mask; ; b = (b + 1) & mask ) {
+		int32_t e = d->table[b] - 1;
+		if (e < 0) {
+			put_utf8( &d->values, s, len );
+			d->table[b] = d->values.rows;
+			return( d->values.rows - 1 );
+		}
+		const int64_t *off = (const int64_t *) d->values.values;
+		if ((size_t) (off[e+1] - off[e]) == len &&
+				memcmp( d->values.data + off[e], s, len ) == 0)
+			return( e );
+	}
+}
+
+static void init_column( struct arrow_column *c, const char *name, int kind, bool nullable ) {
+	memset( c, 0, sizeof *c );
+	c->name = name;
+	c->kind = kind;
+	c->nullable = nullable;
+	if (kind == COL_UTF8) {
+		int64_t zero = 0;	// (where the first string starts)
+		grow( &c->values, &c->max, sizeof zero );
+		memcpy( c->values, &zero, sizeof zero );
+		c->len = sizeof zero;
+	}
+}
+
+static void free_column( struct arrow_column *c ) {
+	free( c->values );
+	free( c->valid );
+	free( c->data );
+}
+
+ArrowFormatter::ArrowFormatter( FILE *out, bool records ) : DatebookFormatter( out ) {
+	_records = records;
+	_rows = 0;
+	_num_cols = records ? RECORD_COLUMNS : INSTANCE_COLUMNS;
+	_cols = (struct arrow_column *) malloc( _num_cols * sizeof (struct arrow_column) );
+	for( int i = 0; i < _num_cols; i++ ) {
+		init_column( &_cols[i], columns[i].name, columns[i].kind, columns[i].nullable );
+		_cols[i].dict = columns[i].dict;
+	}
+	_num_dicts = records ? NUM_DICTS : NUM_DICTS - 1;
+	_dicts = (struct arrow_dict *) malloc( _num_dicts * sizeof (struct arrow_dict) );
+	for( int i = 0; i < _num_dicts; i++ ) {
+		init_column( &_dicts[i].values, "", COL_UTF8, false );
+		_dicts[i].table = 0;
+		_dicts[i].buckets = 0;
+	}
+	_utf8 = 0;
+	_utf8_size = 0;
+	_pos = 0;
+	_blocks = 0;
+	_num_blocks = 0;
+	_max_blocks = 0;
+}
+
+ArrowFormatter::~ArrowFormatter() {
+	for( int i = 0; i < _num_cols; i++ )
+		free_column( &_cols[i] );
+	free( _cols );
+	for( int i = 0; i < _num_dicts; i++ ) {
+		free_column( &_dicts[i].values );
+		free( _dicts[i].table );
+	}
+	free( _dicts );
+	free( _utf8 );
+	free( _blocks );
+}
+
+// a local time, as UTC (if we know the zone)
+void ArrowFormatter::putTime( struct arrow_column *c, time_t t ) {
+	int64_t v = _tz ? _tz->utc( t ) : t;
+	put_value( c, &v, sizeof v, true );
+}
+
+/*
+ * routine:	putString
+ *
+ * purpose:	add a (Latin-1) string, or a null, to a column: Arrow
+ *		strings are UTF-8, so the top half is converted
+ */
+void ArrowFormatter::putString( struct arrow_column *c, const char *s ) {
+	size_t len = 0;
+	if (s != 0) {
+		const unsigned char *p;
+		for( p = (const unsigned char *) s; *p && *p < 0x80; p++ )
+			;
+		len = (const char *) p - s;
+		if (*p) {
+			len += strlen( (const char *) p );
+			if (2 * len > _utf8_size) {
+				_utf8_size = 2 * len + 256;
+				_utf8 = (char *) realloc( _utf8, _utf8_size );
+			}
+			char *u = _utf8;
+			for( p = (const unsigned char *) s; *p; p++ )
+				if (*p >= 0x80) {
+					*u++ = 0xc0 | (*p >> 6);
+					*u++ = 0x80 | (*p & 0x3f);
+				} else
+					*u++ = *p;
+			s = _utf8;
+			len = u - _utf8;
+		}
+	}
+
+	if (c->kind == COL_UTF8)
+		put_utf8( c, s, len );
+	else if (s == 0)
+		put_int32( c, 0, false );
+	else
+		put_int32( c, dict_index( &_dicts[c->dict], s, len ) );
+}
+
+// the columns that both forms share
+void ArrowFormatter::common( const DatebookRecord &r, time_t st, time_t et ) {
+	put_int32( &_cols[C_INDEX], r.index );
+	put_int32( &_cols[C_RID], r.rid );
+	putTime( &_cols[C_START], st );
+	putTime( &_cols[C_END], et );
+	put_bool( &_cols[C_ALLDAY], r.allday );
+	put_bool( &_cols[C_PRIVATE], r.pvt );
+	put_bool( &_cols[C_ALARM], r.alarm_set );
+	putString( &_cols[C_CATEGORY], categoryName( r.category ) );
+	putString( &_cols[C_SUMMARY], r.summary.str );
+	putString( &_cols[C_DESCRIPTION], r.description.str );
+	putString( &_cols[C_CHANGE], (_change == UNCHANGED) ? 0 :
+			datebook_change_name( _change ) );
+	_rows++;
+}
+
+bool ArrowFormatter::onRecord( const DatebookRecord &r ) {
+	if (!_records)
+		return( true );
+
+	common( r, r.start_time, r.end_time );
+	bool repeats = (r.brand != 0);
+	putString( &_cols[C_REPEAT], repeats ? datebook_brand_name( r.brand ) : 0 );
+	put_int32( &_cols[C_INTERVAL], r.interval, repeats );
+	put_int32( &_cols[C_UNTIL], r.enddate / DAY, repeats );
+	put_int32( &_cols[C_EXCEPTIONS], r.num_except, repeats );
+	return( false );
+}
+
+void ArrowFormatter::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	common( r, st, et );
+	for( int i = INSTANCE_COLUMNS; i < _num_cols; i++ )
+		if (_cols[i].kind == COL_DICT)
+			putString( &_cols[i], 0 );
+		else
+			put_int32( &_cols[i], 0, false );
+}
+
+void ArrowFormatter::write( const void *p, size_t n ) {
+	fwrite( p, 1, n, _out );
+	_pos += n;
+}
+
+void ArrowFormatter::pad( size_t n ) {
+	static const unsigned char zeros[8] = { 0 };
+	write( zeros, n );
+}
+
+static size_t pad8( size_t n ) {
+	return( (8 - n % 8) % 8 );
+}
+
+// a buffer of a batch: bytes of a column (or its offsets, rebased,
+// or its bits, shifted down to start the batch)
+struct arrow_buffer {
+	const unsigned char *p;
+	size_t		len;
+	bool		rebase;
+	int		shift;		// (bits of p[0] before the batch)
+};
+
+// byte i of the n bits that start shift bits into a bitmap
+static unsigned shifted( const unsigned char *p, int shift, size_t i, long n ) {
+	unsigned bits = p[i] >> shift;
+	if (shift > 0 && 8 * (i + 1) < (size_t) (n + shift))
+		bits |= p[i + 1] << (8 - shift);
+	return( bits & 0xff );
+}
+
+/*
+ * routine:	slice
+ *
+ * purpose:	the buffers of rows [first, first + n) of a column
+ *
+ * returns:	how many buffers (and the nulls among the rows)
+ */
+static int slice( const struct arrow_column *c, long first, long n,
+		long *nulls, struct arrow_buffer *b ) {
+	*nulls = 0;
+	size_t bytes = (n + 7) / 8;
+	if (c->nulls > 0) {
+		for( size_t i = 0; i < bytes; i++ ) {
+			unsigned bits = shifted( c->valid + first / 8, first % 8, i, n );
+			if (i == bytes - 1 && n % 8)
+				bits &= (1 << (n % 8)) - 1;
+			*nulls += __builtin_popcount( bits );
+		}
+		*nulls = n - *nulls;
+	}
+	b[0].p = c->valid + first / 8;
+	b[0].len = (*nulls > 0) ? bytes : 0;
+	b[0].rebase = false;
+	b[0].shift = first % 8;
+
+	size_t width = 4;
+	switch( c->kind ) {
+	case COL_BOOL:
+		b[1].p = c->values + first / 8;
+		b[1].len = bytes;
+		b[1].rebase = false;
+		b[1].shift = first % 8;
+		return( 2 );
+	case COL_UTF8: {
+		const int64_t *off = (const int64_t *) c->values;
+		b[1].p = c->values + first * sizeof (int64_t);
+		b[1].len = (n + 1) * sizeof (int32_t);
+		b[1].rebase = true;
+		b[1].shift = 0;
+		b[2].p = (const unsigned char *) c->data + off[first];
+		b[2].len = off[first + n] - off[first];
+		b[2].rebase = false;
+		b[2].shift = 0;
+		return( 3 );
+	}
+	case COL_TIME:
+		width = 8;
+		break;
+	}
+	b[1].p = c->values + first * width;
+	b[1].len = n * width;
+	b[1].rebase = false;
+	b[1].shift = 0;
+	return( 2 );
+}
+
+/*
+ * routine:	schema
+ *
+ * purpose:	build the schema (in the message, and again in the footer)
+ */
+unsigned ArrowFormatter::schema( FlatBuilder &fb ) {
+	unsigned *fields = (unsigned *) malloc( _num_cols * sizeof (unsigned) );
+	for( int i = 0; i < _num_cols; i++ ) {
+		const struct arrow_column *c = &_cols[i];
+		unsigned name = fb.string( c->name );
+		unsigned tz = (c->kind == COL_TIME) ? fb.string( "UTC" ) : 0;
+
+		int type_id;
+		fb.start();
+		switch( c->kind ) {
+		case COL_INT32:
+		case COL_UINT32:
+			type_id = TYPE_INT;
+			fb.add32( 0, 32 );
+			fb.add8( 1, c->kind == COL_INT32 );
+			break;
+		case COL_TIME:
+			type_id = TYPE_TIMESTAMP;
+			fb.add16( 0, 0 );	// (seconds)
+			fb.addOffset( 1, tz );
+			break;
+		case COL_DATE:
+			type_id = TYPE_DATE;
+			fb.add16( 0, 0 );	// (days)
+			break;
+		case COL_BOOL:
+			type_id = TYPE_BOOL;
+			break;
+		default:
+			type_id = TYPE_UTF8;	// (the values, for a dictionary)
+			break;
+		}
+		unsigned type = fb.end();
+
+		unsigned dict = 0;
+		if (c->kind == COL_DICT) {
+			fb.start();
+			fb.add32( 0, 32 );
+			fb.add8( 1, true );
+			unsigned index = fb.end();
+			fb.start();
+			fb.add64( 0, c->dict );
+			fb.addOffset( 1, index );
+			dict = fb.end();
+		}
+		unsigned children = fb.tables( 0, 0 );
+
+		fb.start();
+		fb.addOffset( 0, name );
+		fb.add8( 1, c->nullable );
+		fb.add8( 2, type_id );
+		fb.addOffset( 3, type );
+		if (dict)
+			fb.addOffset( 4, dict );
+		fb.addOffset( 5, children );
+		fields[i] = fb.end();
+	}
+	unsigned list = fb.tables( fields, _num_cols );
+	free( fields );
+
+	fb.start();
+	fb.add16( 0, 0 );	// (little endian)
+	fb.addOffset( 1, list );
+	return( fb.end() );
+}
+
+/*
+ * routine:	batch
+ *
+ * purpose:	build a RecordBatch, of rows [first, first + n) of
+ *		some columns
+ *
+ * returns:	the table (and the length of its body)
+ */
+unsigned ArrowFormatter::batch( FlatBuilder &fb, long first, long n,
+		struct arrow_column *cols, int ncols, size_t *body ) {
+	int64_t *nodes = (int64_t *) malloc( ncols * 2 * sizeof (int64_t) );
+	int64_t *bufs = (int64_t *) malloc( ncols * 3 * 2 * sizeof (int64_t) );
+	int nbufs = 0;
+	*body = 0;
+	for( int i = 0; i < ncols; i++ ) {
+		struct arrow_buffer b[3];
+		long nulls;
+		int k = slice( &cols[i], first, n, &nulls, b );
+		nodes[2*i] = n;
+		nodes[2*i + 1] = nulls;
+		for( int j = 0; j < k; j++ ) {
+			bufs[2*nbufs] = *body;
+			bufs[2*nbufs + 1] = b[j].len;
+			nbufs++;
+			*body += b[j].len + pad8( b[j].len );
+		}
+	}
+	unsigned node_list = fb.structs( nodes, ncols, 2 );
+	unsigned buf_list = fb.structs( bufs, nbufs, 2 );
+	free( nodes );
+	free( bufs );
+
+	fb.start();
+	fb.add64( 0, n );
+	fb.addOffset( 1, node_list );
+	fb.addOffset( 2, buf_list );
+	return( fb.end() );
+}
+
+/*
+ * routine:	message
+ *
+ * purpose:	put out a message's metadata (with its header, which
+ *		has just been built), and note where it is for the footer
+ */
+void ArrowFormatter::message( FlatBuilder &fb, int type, unsigned header, size_t body ) {
+	fb.start();
+	fb.add16( 0, ARROW_V5 );
+	fb.add8( 1, type );
+	fb.addOffset( 2, header );
+	fb.add64( 3, body );
+	fb.finish( fb.end() );
+
+	if (type != MSG_SCHEMA) {
+		if (_num_blocks == _max_blocks) {
+			_max_blocks = _max_blocks ? 2 * _max_blocks : 64;
+			_blocks = (struct arrow_block *) realloc( _blocks,
+					_max_blocks * sizeof (struct arrow_block) );
+		}
+		struct arrow_block *b = &_blocks[_num_blocks++];
+		b->offset = _pos;
+		b->meta = 8 + fb.size() + pad8( fb.size() );
+		b->body = body;
+		b->dictionary = (type == MSG_DICTIONARY);
+	}
+
+	uint32_t prefix[2];
+	prefix[0] = 0xffffffff;		// (continuation)
+	prefix[1] = fb.size() + pad8( fb.size() );
+	write( prefix, sizeof prefix );
+	write( fb.data(), fb.size() );
+	pad( pad8( fb.size() ) );
+	fb.reset();
+}
+
+// put out the body of a batch (as batch() laid it out)
+void ArrowFormatter::body( long first, long n, struct arrow_column *cols, int ncols ) {
+	for( int i = 0; i < ncols; i++ ) {
+		struct arrow_buffer b[3];
+		long nulls;
+		int k = slice( &cols[i], first, n, &nulls, b );
+		for( int j = 0; j < k; j++ ) {
+			if (b[j].shift > 0) {
+				// bits that do not start on a byte
+				unsigned char chunk[1024];
+				for( size_t r = 0; r < b[j].len; r += sizeof chunk ) {
+					size_t m = (b[j].len - r < sizeof chunk) ? b[j].len - r : sizeof chunk;
+					for( size_t x = 0; x < m; x++ )
+						chunk[x] = shifted( b[j].p, b[j].shift, r + x, n );
+					write( chunk, m );
+				}
+			} else if (!b[j].rebase)
+				write( b[j].p, b[j].len );
+			else {
+				// 32 bit offsets, from the start of the batch
+				const int64_t *off = (const int64_t *) b[j].p;
+				int32_t chunk[1024];
+				for( long r = 0; r <= n; r += 1024 ) {
+					long m = (n + 1 - r < 1024) ? n + 1 - r : 1024;
+					for( long x = 0; x < m; x++ )
+						chunk[x] = off[r + x] - off[0];
+					write( chunk, m * sizeof (int32_t) );
+				}
+			}
+			pad( pad8( b[j].len ) );
+		}
+	}
+}
+
+/*
+ * routine:	finish
+ *
+ * purpose:	put out the file: the schema, the dictionaries (which
+ *		are now complete), the batches of rows, and the footer
+ */
+void ArrowFormatter::finish() {
+	FlatBuilder fb;
+	size_t len;
+
+	write( magic, sizeof magic );
+	message( fb, MSG_SCHEMA, schema( fb ), 0 );
+
+	for( int d = 0; d < _num_dicts; d++ ) {
+		struct arrow_column *c = &_dicts[d].values;
+		unsigned data = batch( fb, 0, c->rows, c, 1, &len );
+		fb.start();
+		fb.add64( 0, d );
+		fb.addOffset( 1, data );
+		message( fb, MSG_DICTIONARY, fb.end(), len );
+		body( 0, c->rows, c, 1 );
+	}
+
+	long step = (arrow_batch_rows > 0) ? arrow_batch_rows : ARROW_BATCH_ROWS;
+	for( long first = 0; first < _rows; first += step ) {
+		long n = (_rows - first < step) ? _rows - first : step;
+		unsigned data = batch( fb, first, n, _cols, _num_cols, &len );
+		message( fb, MSG_BATCH, data, len );
+		body( first, n, _cols, _num_cols );
+	}
+
+	uint32_t eos[2] = { 0xffffffff, 0 };
+	write( eos, sizeof eos );
+
+	// the footer: where the dictionaries and batches are
+	int64_t *dicts = (int64_t *) malloc( (_num_blocks + 1) * 3 * sizeof (int64_t) );
+	int64_t *batches = (int64_t *) malloc( (_num_blocks + 1) * 3 * sizeof (int64_t) );
+	long num_dicts = 0;
+	long num_batches = 0;
+	for( int i = 0; i < _num_blocks; i++ ) {
+		int64_t *b = _blocks[i].dictionary ? &dicts[3 * num_dicts++] :
+				&batches[3 * num_batches++];
+		b[0] = _blocks[i].offset;
+		b[1] = _blocks[i].meta;		// (an int, and 4 bytes of padding)
+		b[2] = _blocks[i].body;
+	}
+	unsigned s = schema( fb );
+	unsigned dict_list = fb.structs( dicts, num_dicts, 3 );
+	unsigned batch_list = fb.structs( batches, num_batches, 3 );
+	free( dicts );
+	free( batches );
+	fb.start();
+	fb.add16( 0, ARROW_V5 );
+	fb.addOffset( 1, s );
+	fb.addOffset( 2, dict_list );
+	fb.addOffset( 3, batch_list );
+	fb.finish( fb.end() );
+
+	uint32_t footer = fb.size();
+	write( fb.data(), fb.size() );
+	write( &footer, sizeof footer );
+	write( magic, 6 );
+	fflush( _out );
+}
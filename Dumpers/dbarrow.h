@@ -0,0 +1,73 @@
+/*
+ * module:	dbarrow.h
+ *
+ * purpose:	an Apache Arrow (IPC file) output format, a row per
+ *		instance (or per record), for loading into dataframes
+ *
+ * note:	the rows are gathered into a buffer per column (there
+ *		is never an object per row), and categories, summaries
+ *		and the other repetitive strings are dictionary encoded.
+ *		A dictionary has to be complete before the first batch
+ *		that refers to it, so nothing is written until finish(),
+ *		which then puts the columns out in record batches of
+ *		arrow_batch_rows, straight from the column buffers.
+ *
+ *		The file is written by hand (the flatbuffers of the
+ *		metadata included), so there is no library to depend on.
+ *		Times are timestamp[s, UTC]: local times are converted
+ *		with the formatter's zone (if there is one), and are
+ *		otherwise taken as UTC, just as the other formats do.
+ */
+#ifndef _DBARROW_H
+#define _DBARROW_H
+
+#include <stdio.h>
+#include "dbformat.h"
+
+// rows per record batch (by default), and as set by --batch-rows
+static const long ARROW_BATCH_ROWS = 64 * 1024;
+extern long arrow_batch_rows;
+
+struct arrow_column;
+struct arrow_dict;
+struct arrow_block;
+class FlatBuilder;
+
+class ArrowFormatter : public DatebookFormatter {
+   public:
+	ArrowFormatter( FILE *out, bool records );
+	~ArrowFormatter();
+
+	bool onRecord( const DatebookRecord & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+	void finish();
+
+   private:
+	void common( const DatebookRecord &, time_t, time_t );
+	void putTime( struct arrow_column *, time_t );
+	void putString( struct arrow_column *, const char * );
+
+	unsigned schema( FlatBuilder & );
+	unsigned batch( FlatBuilder &, long first, long n, struct arrow_column *,
+			int ncols, size_t *body );
+	void message( FlatBuilder &, int type, unsigned header, size_t body );
+	void body( long first, long n, struct arrow_column *, int ncols );
+	void write( const void *, size_t );
+	void pad( size_t );
+
+	bool		_records;	// a row per record (not per instance)
+	long		_rows;
+	struct arrow_column *_cols;
+	int		_num_cols;
+	struct arrow_dict *_dicts;
+	int		_num_dicts;
+	char		*_utf8;		// (a string, converted)
+	size_t		_utf8_size;
+
+	size_t		_pos;		// where we are in the file
+	struct arrow_block *_blocks;	// (for the footer)
+	int		_num_blocks;
+	int		_max_blocks;
+};
+
+#endif
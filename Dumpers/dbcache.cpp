@@ -0,0 +1,487 @@
+/*
+ * module:	dbcache.cpp
+ *
+ * purpose:	persistent (sidecar) cache of decoded datebook archives
+ *
+ * note:	a cache hit never touches the archive at all; the
+ *		header, categories and records are all delivered
+ *		straight out of the mapped cache file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dbcache.h"
+#include "palmhash.h"
+
+extern bool verbose;	// commentary on what we find
+
+static const char CACHE_MAGIC[8] = "PALMDBC";
+
+/*
+ * a growable (malloc'd) byte buffer, for assembling a cache file
+ */
+struct cachebuf {
+	char	*data;
+	size_t	len;
+	size_t	size;
+};
+
+static size_t append( struct cachebuf *b, const void *data, size_t len ) {
+	if (b->len + len > b->size) {
+		size_t newsize = b->size ? b->size : 4096;
+		while( newsize < b->len + len )
+			newsize *= 2;
+		b->data = (char *) realloc( b->data, newsize );
+		b->size = newsize;
+	}
+	size_t off = b->len;
+	memcpy( b->data + off, data, len );
+	b->len += len;
+	return( off );
+}
+
+// strings go into the heap with their NUL, and are found by offset
+static uint32_t append_string( struct cachebuf *b, const char *s, size_t len ) {
+	if (s == 0)
+		return( CACHE_NO_STRING );
+	uint32_t off = b->len;
+	append( b, s, len );
+	append( b, "", 1 );
+	return( off );
+}
+
+/*
+ * a visitor that collects everything that will go into a cache file
+ */
+class CacheBuilder : public DatebookVisitor {
+   public:
+	CacheBuilder() {
+		memset( &hdr, 0, sizeof hdr );
+		memset( &cats, 0, sizeof cats );
+		memset( &records, 0, sizeof records );
+		memset( &excepts, 0, sizeof excepts );
+		memset( &strings, 0, sizeof strings );
+	}
+	~CacheBuilder() {
+		free( cats.data );
+		free( records.data );
+		free( excepts.data );
+		free( strings.data );
+	}
+
+	void onHeader( const DatebookHeader &h ) {
+		hdr.filetype = h.filetype;
+		hdr.num_entries = h.num_records;
+		hdr.filename = append_string( &strings, h.filename, strlen( h.filename ) );
+		hdr.header = append_string( &strings, h.header, strlen( h.header ) );
+	}
+
+	void onCategory( int, const char *name ) {
+		uint64_t off = append_string( &strings, name, strlen( name ) );
+		append( &cats, &off, sizeof off );
+		hdr.num_categories++;
+	}
+
+	bool onRecord( const DatebookRecord &r ) {
+		DatebookCompact c;
+		memset( &c, 0, sizeof c );
+		c.start_time = r.start_time;
+		c.end_time = r.end_time;
+		c.index = r.index;
+		c.rid = r.rid;
+		c.status = r.status;
+		c.position = r.position;
+		c.summary = append_string( &strings, r.summary.str, r.summary.len );
+		c.summary_len = r.summary.len;
+		c.description = append_string( &strings, r.description.str, r.description.len );
+		c.description_len = r.description.len;
+		c.category = r.category;
+		c.alarm_units = r.alarm_units;
+		c.alarm_type = r.alarm_type;
+		c.first_except = excepts.len / sizeof (unsigned long);
+		c.num_except = r.num_except;
+		if (r.num_except > 0)
+			append( &excepts, r.excepts, r.num_except * sizeof (unsigned long) );
+		c.flags = (r.allday ? CACHE_ALLDAY : 0) |
+				(r.pvt ? CACHE_PRIVATE : 0) |
+				(r.alarm_set ? CACHE_ALARM : 0);
+		c.brand = r.brand;
+		c.day_mask = r.day_mask;
+		c.interval = r.interval;
+		c.enddate = r.enddate;
+		c.wstart = r.wstart;
+		c.day_x = r.day_x;
+		c.week_x = r.week_x;
+		c.day_num = r.day_num;
+		c.mon_x = r.mon_x;
+		append( &records, &c, sizeof c );
+		hdr.num_records++;
+
+		return( false );	// we don't need the instances
+	}
+
+	DatebookCacheHeader hdr;
+	struct cachebuf cats;		// category name offsets
+	struct cachebuf records;	// DatebookCompacts
+	struct cachebuf excepts;	// exception dates
+	struct cachebuf strings;	// string heap
+};
+
+// pad a file section out to an 8-byte boundary
+static uint64_t align8( uint64_t off ) {
+	return( (off + 7) & ~(uint64_t) 7 );
+}
+
+static bool put( FILE *f, uint64_t off, const void *data, size_t len ) {
+	if (len == 0)
+		return( true );
+	if (fseek( f, off, SEEK_SET ) != 0)
+		return( false );
+	return( fwrite( data, 1, len, f ) == len );
+}
+
+/*
+ * routine:	datebook_cache_path
+ *
+ * purpose:	construct the name of the cache file for a content hash
+ */
+void datebook_cache_path( char *buf, size_t len, const char *dir, uint64_t hash ) {
+	snprintf( buf, len, "%s/%016llx.pdc", dir, (unsigned long long) hash );
+}
+
+/*
+ * routine:	datebook_cache_write
+ *
+ * purpose:	decode an archive (without expanding anything) and
+ *		write it out as a cache file.  The file is written
+ *		under a temporary name and then renamed, so readers
+ *		never see a partial cache.
+ *
+ * returns:	0 on success, 1 on failure
+ */
+int datebook_cache_write( const char *path, PalmArchive *arc, uint64_t hash ) {
+
+	long num_entry;
+	size_t *offsets = datebook_offsets( arc, &num_entry );
+	if (offsets == 0)
+		return( 1 );
+
+	CacheBuilder b;
+	DatebookHeader h;
+	datebook_header( arc, num_entry, h );
+	b.onHeader( h );
+	for( int i = 0; i < h.num_categories; i++ )
+		b.onCategory( i, arc->category(i) );
+	if (decode_datebook_range( arc, offsets, 0, num_entry, &b ) != 0) {
+		free( offsets );
+		return( 1 );
+	}
+
+	// lay out the file
+	DatebookCacheHeader *hdr = &b.hdr;
+	memcpy( hdr->magic, CACHE_MAGIC, sizeof CACHE_MAGIC );
+	hdr->version = CACHE_VERSION;
+	hdr->byteorder = CACHE_BYTEORDER;
+	hdr->long_size = sizeof (unsigned long);
+	hdr->source_hash = hash;
+	hdr->source_size = arc->size();
+	hdr->categories = align8( sizeof *hdr );
+	hdr->offsets = align8( hdr->categories + b.cats.len );
+	hdr->records = align8( hdr->offsets + (num_entry + 1) * sizeof (uint64_t) );
+	hdr->excepts = align8( hdr->records + b.records.len );
+	hdr->strings = align8( hdr->excepts + b.excepts.len );
+	hdr->strings_len = b.strings.len;
+
+	char tmp[4096];
+	snprintf( tmp, sizeof tmp, "%s.%d", path, (int) getpid() );
+	FILE *f = fopen( tmp, "w" );
+	if (f == 0) {
+		free( offsets );
+		return( 1 );
+	}
+
+	bool ok = put( f, 0, hdr, sizeof *hdr );
+	ok = ok && put( f, hdr->categories, b.cats.data, b.cats.len );
+	for( long i = 0; ok && i <= num_entry; i++ ) {
+		uint64_t o = offsets[i];
+		ok = put( f, hdr->offsets + i * sizeof o, &o, sizeof o );
+	}
+	ok = ok && put( f, hdr->records, b.records.data, b.records.len );
+	ok = ok && put( f, hdr->excepts, b.excepts.data, b.excepts.len );
+	ok = ok && put( f, hdr->strings, b.strings.data, b.strings.len );
+	ok = (fclose( f ) == 0) && ok;
+	free( offsets );
+
+	if (!ok || rename( tmp, path ) != 0) {
+		unlink( tmp );
+		return( 1 );
+	}
+
+	if (verbose)
+		fprintf(stderr, "   cached as %s\n", path);
+	return( 0 );
+}
+
+/*
+ * routine:	open
+ *
+ * purpose:	map a cache file, and make sure it is one of ours,
+ *		written on this kind of machine, for this content.
+ *
+ * returns:	a new DatebookCache (or 0 if there is no usable one)
+ */
+DatebookCache *DatebookCache::open( const char *path, uint64_t hash ) {
+	return( map( path, true, hash ) );
+}
+
+DatebookCache *DatebookCache::open( const char *path ) {
+	return( map( path, false, 0 ) );
+}
+
+// does [off, off + n * each) lie within size bytes (without overflowing)
+static bool within( uint64_t off, uint64_t n, uint64_t each, uint64_t size ) {
+	if (off > size || (each != 0 && n > (size - off) / each))
+		return( false );
+	return( true );
+}
+
+// is this a string heap offset (or none)
+static bool heap_string( uint64_t off, const DatebookCacheHeader *h ) {
+	return( off == CACHE_NO_STRING || off < h->strings_len );
+}
+
+/*
+ * routine:	valid
+ *
+ * purpose:	make sure everything the header (and every record)
+ *		refers to lies within the file, before anything is
+ *		read through it: a cache can be truncated or damaged.
+ */
+static bool valid( const DatebookCacheHeader *h, size_t size ) {
+
+	// the sections, in the order they are laid out
+	if (!within( h->categories, h->num_categories, sizeof (uint64_t), size ) ||
+			!within( h->offsets, (uint64_t) h->num_entries + 1,
+				sizeof (uint64_t), size ) ||
+			!within( h->records, h->num_records,
+				sizeof (DatebookCompact), size ) ||
+			!within( h->strings, h->strings_len, 1, size ) ||
+			h->excepts > h->strings || h->excepts < h->records ||
+			(h->categories | h->offsets | h->records | h->excepts) % 8 != 0 ||
+			h->num_records > h->num_entries)
+		return( false );
+
+	// every string ends within the heap
+	const char *base = (const char *) h;
+	if (h->strings_len > 0 && base[h->strings + h->strings_len - 1] != 0)
+		return( false );
+	if (!heap_string( h->filename, h ) || !heap_string( h->header, h ))
+		return( false );
+	const uint64_t *cats = (const uint64_t *) (base + h->categories);
+	for( uint32_t i = 0; i < h->num_categories; i++ )
+		if (!heap_string( cats[i], h ))
+			return( false );
+
+	uint64_t num_excepts = (h->strings - h->excepts) / sizeof (unsigned long);
+	const DatebookCompact *r = (const DatebookCompact *) (base + h->records);
+	for( uint32_t i = 0; i < h->num_records; i++ ) {
+		if (!heap_string( r[i].summary, h ) || !heap_string( r[i].description, h ))
+			return( false );
+		if ((r[i].summary != CACHE_NO_STRING &&
+				r[i].summary_len >= h->strings_len - r[i].summary) ||
+			(r[i].description != CACHE_NO_STRING &&
+				r[i].description_len >= h->strings_len - r[i].description))
+			return( false );
+		if ((uint64_t) r[i].first_except + r[i].num_except > num_excepts)
+			return( false );
+	}
+	return( true );
+}
+
+DatebookCache *DatebookCache::map( const char *path, bool check, uint64_t hash ) {
+	int fd = ::open( path, O_RDONLY );
+	if (fd < 0)
+		return( 0 );
+
+	struct stat st;
+	if (fstat( fd, &st ) != 0 || (size_t) st.st_size < sizeof (DatebookCacheHeader)) {
+		close( fd );
+		return( 0 );
+	}
+	void *p = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if (p == MAP_FAILED)
+		return( 0 );
+
+	const DatebookCacheHeader *h = (const DatebookCacheHeader *) p;
+	size_t size = st.st_size;
+	if (memcmp( h->magic, CACHE_MAGIC, sizeof CACHE_MAGIC ) != 0 ||
+			h->version != CACHE_VERSION ||
+			h->byteorder != CACHE_BYTEORDER ||
+			h->long_size != sizeof (unsigned long) ||
+			(check && h->source_hash != hash) ||
+			!valid( h, size )) {
+		munmap( p, size );
+		return( 0 );
+	}
+
+	DatebookCache *c = new DatebookCache;
+	c->_base = p;
+	c->_size = size;
+	c->_hdr = h;
+	c->_records = (const DatebookCompact *) ((char *) p + h->records);
+	c->_excepts = (const unsigned long *) ((char *) p + h->excepts);
+	c->_strings = (const char *) p + h->strings;
+	return( c );
+}
+
+DatebookCache::~DatebookCache() {
+	munmap( _base, _size );
+}
+
+/*
+ * routine:	record
+ *
+ * purpose:	present a cached record as a DatebookRecord, whose
+ *		strings and exceptions point right into the mapping
+ */
+void DatebookCache::record( long i, DatebookRecord &r ) {
+	const DatebookCompact *c = &_records[i];
+	r.index = c->index;
+	r.rid = c->rid;
+	r.status = c->status;
+	r.position = c->position;
+	r.start_time = c->start_time;
+	r.end_time = c->end_time;
+	r.summary.str = string( c->summary );
+	r.summary.len = c->summary_len;
+	r.description.str = string( c->description );
+	r.description.len = c->description_len;
+	r.allday = (c->flags & CACHE_ALLDAY) != 0;
+	r.pvt = (c->flags & CACHE_PRIVATE) != 0;
+	r.category = c->category;
+	r.alarm_set = (c->flags & CACHE_ALARM) != 0;
+	r.alarm_units = c->alarm_units;
+	r.alarm_type = c->alarm_type;
+	r.num_except = c->num_except;
+	r.excepts = _excepts + c->first_except;
+	r.brand = c->brand;
+	r.interval = c->interval;
+	r.enddate = c->enddate;
+	r.wstart = c->wstart;
+	r.day_x = c->day_x;
+	r.day_mask = c->day_mask;
+	r.week_x = c->week_x;
+	r.day_num = c->day_num;
+	r.mon_x = c->mon_x;
+}
+
+/*
+ * routine:	decode
+ *
+ * purpose:	deliver the cached archive to a visitor, exactly as
+ *		decode_datebook would have from the archive itself
+ *
+ * returns:	0 on success
+ */
+int DatebookCache::decode( DatebookVisitor *v ) {
+
+	decodeHeader( v );
+
+	DatebookRecord r;
+	for( long i = 0; i < numRecords(); i++ ) {
+		record( i, r );
+		if (v->onRecord( r ))
+			expand_datebook( r, v );
+	}
+
+	if (verbose) {
+		fprintf(stderr, "expected %d, processed %d, discarded %d\n",
+				_hdr->num_entries, _hdr->num_records,
+				_hdr->num_entries - _hdr->num_records);
+	}
+	return( 0 );
+}
+
+/*
+ * routine:	decodeHeader
+ *
+ * purpose:	deliver just the header and categories to a visitor
+ */
+void DatebookCache::decodeHeader( DatebookVisitor *v ) {
+
+	const uint64_t *cats = (const uint64_t *) ((char *) _base + _hdr->categories);
+
+	DatebookHeader h;
+	h.filetype = _hdr->filetype;
+	h.filename = string( _hdr->filename );
+	h.header = string( _hdr->header );
+	h.num_categories = _hdr->num_categories;
+	h.num_records = _hdr->num_entries;
+	v->onHeader( h );
+	for( int i = 0; i < h.num_categories; i++ )
+		v->onCategory( i, string( cats[i] ) );
+}
+
+/*
+ * routine:	datebook_cache_load
+ *
+ * purpose:	find (or create) the cache for a file.  If the file is
+ *		itself a cache, we use it as is.  Otherwise we look for
+ *		(or build) the cache for its contents in dir, or if
+ *		there is no dir, build a private one that goes away
+ *		as soon as it is closed.
+ *
+ * returns:	a new DatebookCache (or 0)
+ */
+DatebookCache *datebook_cache_load( const char *filename, const char *dir ) {
+
+	// maybe we were handed a cache file
+	FILE *f = fopen( filename, "r" );
+	if (f == 0)
+		return( 0 );
+	char magic[sizeof CACHE_MAGIC];
+	bool is_cache = fread( magic, 1, sizeof magic, f ) == sizeof magic &&
+			memcmp( magic, CACHE_MAGIC, sizeof magic ) == 0;
+	fclose( f );
+	if (is_cache)
+		return( DatebookCache::open( filename ) );
+
+	uint64_t hash;
+	if (!palm_hash_file( filename, &hash ))
+		return( 0 );
+
+	char path[4096];
+	if (dir != 0) {
+		datebook_cache_path( path, sizeof path, dir, hash );
+		DatebookCache *c = DatebookCache::open( path, hash );
+		if (c != 0) {
+			if (verbose)
+				fprintf(stderr, "Palm Archive: %s (cached in %s)\n", filename, path);
+			return( c );
+		}
+	} else {
+		const char *tmpdir = getenv( "TMPDIR" );
+		snprintf( path, sizeof path, "%s/palm%d-%016llx.pdc",
+				tmpdir ? tmpdir : "/tmp", (int) getpid(),
+				(unsigned long long) hash );
+	}
+
+	// a miss: decode it once, and cache the results
+	PalmArchive *arc = new PalmArchive( filename );
+	bool ok = arc->error() == 0 && arc->fileType() == arc->DBA_SIG &&
+			datebook_cache_write( path, arc, hash ) == 0;
+	delete arc;
+	if (!ok)
+		return( 0 );
+
+	DatebookCache *c = DatebookCache::open( path, hash );
+	if (dir == 0)
+		unlink( path );		// the mapping outlives the name
+	return( c );
+}
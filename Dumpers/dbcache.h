@@ -0,0 +1,128 @@
+/*
+ * module:	dbcache.h
+ *
+ * purpose:	persistent (sidecar) cache of decoded datebook archives
+ *
+ * note:	a cache file holds everything decode_datebook would
+ *		have delivered (header, categories, the offset of each
+ *		record and the decoded records themselves) in a fixed
+ *		binary layout that can simply be mapped into memory.
+ *		It is named (and checked) by the content hash of the
+ *		archive it came from, so an unchanged archive never
+ *		has to be parsed twice.
+ *
+ *		The layout is native (byte order and word size), which
+ *		is fine for a cache, and checked for when it is opened.
+ */
+#ifndef _DBCACHE_H
+#define _DBCACHE_H
+
+#include <stdint.h>
+#include "dbdecode.h"
+
+static const uint32_t CACHE_VERSION = 1;
+static const uint32_t CACHE_BYTEORDER = 0x01020304;
+static const uint32_t CACHE_NO_STRING = 0xffffffff;
+
+// file header (all offsets are from the start of the file)
+struct DatebookCacheHeader {
+	char		magic[8];	// "PALMDBC"
+	uint32_t	version;
+	uint32_t	byteorder;	// CACHE_BYTEORDER, as written
+	uint32_t	long_size;	// sizeof (unsigned long), as written
+	uint32_t	filetype;
+	uint64_t	source_hash;	// content hash of the archive
+	uint64_t	source_size;	// length of the archive
+	uint32_t	num_categories;
+	uint32_t	num_entries;	// records in the archive
+	uint32_t	num_records;	// (non-deleted) records in the cache
+	uint32_t	pad;
+	uint64_t	filename;	// string heap offset
+	uint64_t	header;		// string heap offset
+	uint64_t	categories;	// uint64_t [num_categories] (heap offsets)
+	uint64_t	offsets;	// uint64_t [num_entries+1] (archive offsets)
+	uint64_t	records;	// DatebookCompact [num_records]
+	uint64_t	excepts;	// unsigned long [] (exception dates)
+	uint64_t	strings;	// NUL terminated strings
+	uint64_t	strings_len;
+};
+
+// the fixed size form of a decoded record
+struct DatebookCompact {
+	int64_t		start_time;
+	int64_t		end_time;
+	uint32_t	index;
+	uint32_t	rid;
+	uint32_t	status;
+	uint32_t	position;
+	uint32_t	summary;	// string heap offset (or CACHE_NO_STRING)
+	uint32_t	summary_len;
+	uint32_t	description;	// string heap offset (or CACHE_NO_STRING)
+	uint32_t	description_len;
+	uint32_t	category;
+	uint32_t	alarm_units;
+	uint32_t	alarm_type;
+	uint32_t	first_except;	// index into the exception dates
+	uint16_t	num_except;
+	uint8_t		flags;		// CACHE_ALLDAY, ...
+	uint8_t		brand;
+	uint8_t		day_mask;
+	uint8_t		pad[3];
+	uint32_t	interval;
+	uint32_t	enddate;
+	uint32_t	wstart;
+	uint32_t	day_x;
+	uint32_t	week_x;
+	uint32_t	day_num;
+	uint32_t	mon_x;
+};
+
+static const uint8_t CACHE_ALLDAY = 1;
+static const uint8_t CACHE_PRIVATE = 2;
+static const uint8_t CACHE_ALARM = 4;
+
+class DatebookCache {
+   public:
+	// map a cache file, if it is valid and for this content
+	static DatebookCache *open( const char *path, uint64_t hash );
+	// map a cache file, if it is valid (for whatever content)
+	static DatebookCache *open( const char *path );
+	~DatebookCache();
+
+	// replay the cached archive into a visitor
+	int decode( DatebookVisitor * );
+	// replay just the header and categories
+	void decodeHeader( DatebookVisitor * );
+
+	// turn a cached record back into a DatebookRecord (views)
+	void record( long i, DatebookRecord & );
+
+	long numRecords()	{ return( _hdr->num_records ); }
+	const DatebookCacheHeader *header()	{ return( _hdr ); }
+	const char *string( uint64_t off ) {
+		return( (off == CACHE_NO_STRING) ? 0 : _strings + off );
+	}
+
+   private:
+	DatebookCache() {}
+	static DatebookCache *map( const char *path, bool check, uint64_t hash );
+
+	void		*_base;		// the mapped file
+	size_t		_size;
+	const DatebookCacheHeader *_hdr;
+	const DatebookCompact *_records;
+	const unsigned long *_excepts;
+	const char	*_strings;
+};
+
+// the name of the cache file (in dir) for an archive content hash
+void datebook_cache_path( char *buf, size_t len, const char *dir, uint64_t hash );
+
+// decode an archive and write its cache file (0 on success)
+int datebook_cache_write( const char *path, PalmArchive *arc, uint64_t hash );
+
+// a cache for a file: the file itself (if it is a cache), or
+// the one for its contents in dir (or a private one, if dir is 0)
+DatebookCache *datebook_cache_load( const char *filename, const char *dir );
+
+#endif
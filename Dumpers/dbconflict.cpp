@@ -0,0 +1,195 @@
+/*
+ * module:	dbconflict.cpp
+ *
+ * purpose:	find double-booked (overlapping) appointments
+ *
+ * note:	this is a sweep line over all of the (timed) instances
+ *		in start order: each instance is compared only with the
+ *		instances that are still active when it starts.
+ *
+ *		To keep memory bounded, the calendar is expanded a
+ *		window at a time (using the interval index, so each
+ *		window only expands the records that reach into it).
+ *		Each window handles the instances that start in it;
+ *		the active set carries over from one window to the next.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dbconflict.h"
+
+extern bool verbose;	// commentary on what we find
+
+// one instance, as far as the sweep is concerned
+struct sweep_inst {
+	int64_t		start;
+	int64_t		end;
+	uint32_t	row;
+};
+
+static int by_start( const void *a, const void *b ) {
+	const struct sweep_inst *ia = (const struct sweep_inst *) a;
+	const struct sweep_inst *ib = (const struct sweep_inst *) b;
+	if (ia->start != ib->start)
+		return( (ia->start < ib->start) ? -1 : 1 );
+	return( (ia->row < ib->row) ? -1 : (ia->row > ib->row) );
+}
+
+// a growable array of instances
+struct sweep_list {
+	struct sweep_inst *list;
+	long	num;
+	long	max;
+};
+
+static void add( struct sweep_list *l, int64_t st, int64_t et, uint32_t row ) {
+	if (l->num == l->max) {
+		l->max = l->max ? 2 * l->max : 256;
+		l->list = (struct sweep_inst *) realloc( l->list,
+				l->max * sizeof (struct sweep_inst) );
+	}
+	l->list[l->num].start = st;
+	l->list[l->num].end = et;
+	l->list[l->num++].row = row;
+}
+
+/*
+ * a visitor that collects the timed instances that start in a window
+ */
+class WindowCollector : public DatebookVisitor {
+   public:
+	WindowCollector( struct sweep_list *l ) {
+		_list = l;
+		_row = 0;
+		from = 0;
+		to = 0;
+	}
+
+	bool onRecord( const DatebookRecord &r ) {
+		if (r.allday)		// all-day events do not book time
+			return( false );
+		_span = datebook_span( r );
+		return( true );
+	}
+
+	void onInstance( const DatebookRecord &, time_t st, time_t ) {
+		if (st >= from && st < to)
+			add( _list, st, st + _span, _row );
+	}
+
+	// which table row the coming record came from
+	void setRow( uint32_t row )	{ _row = row; }
+
+	time_t	from;
+	time_t	to;
+
+   private:
+	struct sweep_list *_list;
+	uint32_t	_row;
+	long		_span;
+};
+
+static void print_inst( FILE *out, DatebookTable *t, const struct sweep_inst *i ) {
+	struct tm ts, te;
+	time_t st = i->start;
+	time_t et = i->end;
+	gmtime_r( &st, &ts );
+	gmtime_r( &et, &te );
+	const char *s = t->summary[i->row];
+	if (s == 0)
+		s = t->description[i->row];
+	fprintf( out, "%5d: %04d/%02d/%02d %02d:%02d-",
+			t->index[i->row],
+			ts.tm_year+1900, ts.tm_mon+1, ts.tm_mday,
+			ts.tm_hour, ts.tm_min );
+
+	// (the end date, too, if it ends on a different day)
+	if (te.tm_year != ts.tm_year || te.tm_mon != ts.tm_mon ||
+			te.tm_mday != ts.tm_mday)
+		fprintf( out, "%04d/%02d/%02d ",
+				te.tm_year+1900, te.tm_mon+1, te.tm_mday );
+	fprintf( out, "%02d:%02d %s", te.tm_hour, te.tm_min, s ? s : "" );
+}
+
+/*
+ * routine:	find_conflicts
+ *
+ * purpose:	report every pair of overlapping timed instances
+ *
+ * returns:	number of conflicting pairs
+ */
+long find_conflicts( DatebookIndex *index, FILE *out ) {
+
+	DatebookTable *t = index->table();
+	if (t->rows() == 0)
+		return( 0 );
+
+	// the span of the whole calendar
+	int64_t first = t->start[0];
+	int64_t end = t->last[0];
+	for( long i = 1; i < t->rows(); i++ ) {
+		if (t->start[i] < first)
+			first = t->start[i];
+		if (t->last[i] > end)
+			end = t->last[i];
+	}
+
+	struct sweep_list window = { 0, 0, 0 };
+	struct sweep_list active = { 0, 0, 0 };
+	uint32_t *rows = (uint32_t *) malloc( t->rows() * sizeof (uint32_t) );
+	WindowCollector c( &window );
+	long pairs = 0;
+	long most = 0;
+
+	for( int64_t w = first; w < end; w += CONFLICT_WINDOW ) {
+		// expand (just) the instances that start in this window
+		window.num = 0;
+		c.from = w;
+		c.to = w + CONFLICT_WINDOW;
+		long n = index->overlap( c.from, c.to, rows );
+		DatebookRecord r;
+		for( long i = 0; i < n; i++ ) {
+			t->record( rows[i], r );
+			c.setRow( rows[i] );
+			if (c.onRecord( r ))
+				expand_datebook_range( r, c.from, c.to, &c );
+		}
+		qsort( window.list, window.num, sizeof (struct sweep_inst), by_start );
+		if (window.num > most)
+			most = window.num;
+
+		// and sweep through them
+		for( long i = 0; i < window.num; i++ ) {
+			struct sweep_inst *in = &window.list[i];
+
+			// retire everything that ended before this started
+			long k = 0;
+			for( long j = 0; j < active.num; j++ ) {
+				if (active.list[j].end > in->start)
+					active.list[k++] = active.list[j];
+			}
+			active.num = k;
+
+			// whatever is left overlaps this one
+			for( long j = 0; j < active.num; j++ ) {
+				fprintf( out, "conflict: " );
+				print_inst( out, t, &active.list[j] );
+				fprintf( out, "\n      vs: " );
+				print_inst( out, t, in );
+				fprintf( out, "\n" );
+				pairs++;
+			}
+			add( &active, in->start, in->end, in->row );
+		}
+	}
+
+	if (verbose)
+		fprintf( stderr, "%ld conflicts (at most %ld instances in a window)\n",
+				pairs, most );
+
+	free( rows );
+	free( window.list );
+	free( active.list );
+	return( pairs );
+}
@@ -0,0 +1,18 @@
+/*
+ * module:	dbconflict.h
+ *
+ * purpose:	find double-booked (overlapping) appointments
+ */
+#ifndef _DBCONFLICT_H
+#define _DBCONFLICT_H
+
+#include <stdio.h>
+#include "dbindex.h"
+
+// how much of the calendar is expanded at a time (seconds)
+static const long CONFLICT_WINDOW = 31 * 24 * 60 * 60;
+
+// report each pair of overlapping timed instances (returns # pairs)
+long find_conflicts( DatebookIndex *index, FILE *out );
+
+#endif
@@ -0,0 +1,666 @@
+/*
+ * module:	dbdecode.cpp
+ *
+ * purpose:	streaming decoding of Palm Datebook Archives
+ *
+ * note:	there are numerous fields that I don't care about,
+ *		but the DBA archive stream is such that I have to
+ *		read them to find what comes after them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dbdecode.h"
+
+extern bool verbose;	// commentary on what we find
+extern bool whiny;		// complaints about what we find
+
+static const int FIELDS_PER_ENTRY = 15;
+
+// unix time values for common intervals
+static const int DAY = 24 * 60 * 60;
+
+/*
+ * routine:	nonewlines
+ *
+ * purpose:	ensure that a string contains no new lines
+ */
+void nonewlines( char *str ) {
+
+	// nothing to fix
+	if (str == 0 || *str == 0)
+		return;
+
+	// forward pass, turn them all into spaces
+	char *s;
+	for( s = str; *s; s++ ) {
+		if (*s == '\r' || *s == '\n')
+			*s = ' ';
+	}
+
+	// backwards pass, loose them at end of line
+	for( s--; s > str && *s == ' '; s-- ) {
+		*s = 0;
+	}
+}
+
+DatebookReader::DatebookReader( PalmArchive *arc ) {
+	init( arc->cursor() );
+}
+
+DatebookReader::DatebookReader( PalmCursor *cursor ) {
+	init( cursor );
+}
+
+void DatebookReader::init( PalmCursor *cursor ) {
+	_cur = cursor;
+	_fields = DB_ALL_FIELDS;
+	_summary = 0;
+	_summary_size = 0;
+	_note = 0;
+	_note_size = 0;
+	_excepts = 0;
+	_excepts_size = 0;
+}
+
+DatebookReader::~DatebookReader() {
+	if (_summary)
+		free( _summary );
+	if (_note)
+		free( _note );
+	if (_excepts)
+		free( _excepts );
+}
+
+/*
+ * routine:	grow
+ *
+ * purpose:	make sure a re-usable buffer is at least a given size
+ *
+ * note:	buffers only ever grow, so after the first few records
+ *		a reader stops calling malloc altogether.
+ */
+static void *grow( void *buf, unsigned *size, unsigned needed ) {
+	if (needed <= *size)
+		return( buf );
+
+	unsigned newsize = (*size < 64) ? 64 : *size;
+	while( newsize < needed )
+		newsize *= 2;
+	*size = newsize;
+	return( realloc( buf, newsize ) );
+}
+
+/*
+ * routine:	readString
+ *
+ * purpose:	to read a Cstring (len, string) into a re-usable buffer
+ *		(or, if it is not wanted, just step over it)
+ *
+ * returns:	pointer to the (newline free) string, or zero
+ */
+const char *DatebookReader::readString( char **buf, unsigned *size, unsigned *len,
+		bool wanted ) {
+	*len = 0;
+	unsigned short n = _cur->readUbyte();
+	if (n == 0)
+		return( 0 );
+	else if (n == 0xff)
+		n = _cur->readUshort();
+
+	if (!wanted) {
+		_cur->skip( n );
+		return( 0 );
+	}
+
+	*buf = (char *) grow( *buf, size, n + 1 );
+	if (!_cur->readBytes( *buf, n ))
+		return( 0 );
+	(*buf)[n] = 0;
+	nonewlines( *buf );
+	*len = strlen( *buf );
+	return( *buf );
+}
+
+/*
+ * routine:	readRecord
+ *
+ * purpose:	to read one datebook entry from a datebook archive
+ *
+ * returns:	RECORD, DELETED, BAD or FATAL
+ *
+ * note:	the returned strings and exception list belong to
+ *		the reader, and are overwritten by the next call.
+ */
+int DatebookReader::readRecord( DatebookRecord &r ) {
+
+	PalmCursor *pa = _cur;
+	memset( &r, 0, sizeof r );
+	unsigned long rid = 0;	// start out initialized
+
+/*
+ * This macro performs a check that I do once for each field
+ * just making sure that each field has the expected type.  If
+ * it doesn't, we have a mal-formatted archive!
+ */
+#define	checkType(f,v) { \
+	unsigned long ret = pa->readUlong();	\
+	if (ret != v) {				\
+		fprintf(stderr,			\
+			"record %ld, field %s, type %ld != %d\n",	\
+			 rid, f, ret, v );	\
+		return( BAD );			\
+	}					\
+    }
+
+	checkType( "record ID", 1 );	// 1: record ID
+	rid = pa->readUlong();
+	r.rid = rid;
+
+	checkType( "status", 1 );		// 2: appointment status
+	r.status = pa->readUlong();
+
+	checkType( "position", 1 );		// 3: position ???
+	r.position = pa->readUlong();
+
+	checkType( "start time", 3 );	// 4: starting time
+	unsigned long startTime = pa->readUlong();
+	r.start_time = startTime;		// standard Unix time
+
+	checkType( "end time", 1 );		// 5: ending time
+	unsigned long endTime = pa->readUlong();
+
+	checkType( "description", 5 );	// 6: description
+	(void) pa->readUlong();	// padding
+	r.summary.str = readString( &_summary, &_summary_size, &r.summary.len,
+			(_fields & DB_SUMMARY) != 0 );
+
+	checkType( "duration", 1 );		// 7: duration
+	unsigned long duration = pa->readUlong();
+	// sometimes they use endtime, sometimes duration
+	if (startTime == endTime && duration > 0)
+		endTime = startTime + duration;
+	r.end_time = endTime;
+
+	checkType( "note", 5 );			// 8: note
+	(void) pa->readUlong();	// padding
+	r.description.str = readString( &_note, &_note_size, &r.description.len,
+			(_fields & DB_NOTE) != 0 );
+
+	checkType( "untimed", 6 );		// 9: untimed ???
+	r.allday = pa->readUlong();
+
+	checkType( "private", 6 );		// 10: private appointment
+	r.pvt = pa->readUlong();
+
+	checkType( "category", 1 );		// 11: category ???
+	r.category = pa->readUlong();
+
+	checkType( "alarm set", 6 );	// 12: alarm set for this appointment
+	r.alarm_set = pa->readUlong();
+
+	checkType( "alarm units", 1 );	// 13: how far in advance to give alarm
+	r.alarm_units = pa->readUlong();
+
+	checkType( "alarm type", 1 );	// 14: alarm units (0->min, 1->hours, 2->days)
+	r.alarm_type = pa->readUlong();
+
+	checkType( "repeat", 8 );		// 15: repeat information
+#undef checkType
+
+	r.num_except = pa->readUshort();	// 15a # exceptions
+	if (r.num_except > 0) {
+		_excepts = (unsigned long *) grow( _excepts, &_excepts_size,
+				r.num_except * sizeof (unsigned long) );
+		for( int i = 0; i < r.num_except; i++ ) {
+			_excepts[i] = pa->readUlong();		// 15b exception entries
+		}
+		r.excepts = _excepts;
+	}
+
+	// repeat event class entry
+	unsigned short flag = pa->readUshort();			// 15c type of repeat event
+	if (flag == 0xffff) {			// 15d class entries
+		unsigned short tag = pa->readUshort();
+		if (tag != 1) {
+			fprintf(stderr, "ERROR - Exception class entry, tag (%d) != 1\n", tag);
+			return( BAD );
+		}
+		// these seem to be completely ignorable ???
+		unsigned short len = pa->readUshort();
+		pa->skip( len );
+	}
+
+	if (flag != 0) {
+		r.brand = pa->readUlong();
+		r.interval = pa->readUlong();
+		r.enddate = pa->readUlong();
+		r.wstart = pa->readUlong();
+
+		// each supported repetition type (brand) has different args
+		if (r.brand < 1 || r.brand > 6) {
+			fprintf(stderr, "fatal: unrecognized repetition brand: %ld", r.brand);
+			return( FATAL );	// at this point, we have lost sync w/stream
+		}
+
+		// figure out what fields we expect to find
+		const int has_day_x = 1;
+		const int has_day_m = 2;
+		const int has_day_n = 4;
+		const int has_week_x = 8;
+		const int has_mon_x = 16;
+		static const unsigned char brandmask[] = {
+				0,						// 0: undefined
+				has_day_x,				// 1: daily
+				has_day_x+has_day_m,	// 2: weekly, by days
+				has_day_x+has_week_x,	// 3: monthly, by day
+				has_day_n,				// 4: monthly, by date
+				has_day_n+has_mon_x,	// 5: yearly, by date
+				has_day_x				// 6: yearly, by day
+		};
+
+		if (brandmask[r.brand] & has_day_x) {
+			r.day_x = pa->readUlong();
+		}
+		if (brandmask[r.brand] & has_day_m) {
+			r.day_mask = pa->readUbyte();
+			if (r.day_mask == 0 || r.day_mask > 0x7f)
+				fprintf(stdout, "WARNING - day mask = 0x%x", r.day_mask);
+		}
+		if (brandmask[r.brand] & has_week_x) {
+			r.week_x = pa->readUlong();
+		}
+		if (brandmask[r.brand] & has_day_n) {
+			r.day_num = pa->readUlong();
+		}
+		if (brandmask[r.brand] & has_mon_x) {
+			r.mon_x = pa->readUlong();
+		}
+	}
+
+	return( (r.status == 0x04) ? DELETED : RECORD );
+}
+
+/*
+ * routine:	datebook_span
+ *
+ * purpose:	how long an instance of a record occupies the calendar
+ *
+ * note:	all-day events take (at least) the whole day, and
+ *		instantaneous ones are given a second, so that every
+ *		instance covers a non-empty interval.
+ */
+long datebook_span( const DatebookRecord &r ) {
+	long duration = r.end_time - r.start_time;
+	if (r.allday && duration < DAY)
+		return( DAY );
+	return( (duration < 1) ? 1 : duration );
+}
+
+DatebookInstances::DatebookInstances( const DatebookRecord &r ) : _r( r ) {
+	_duration = r.end_time - r.start_time;
+	_span = datebook_span( r );
+	_original = true;
+	_d = r.start_time + DAY;
+
+	// FIX - annual by day
+	// 		I am totally unclear on exactly what this means
+	//		and I had no sample data from which to understand it
+	//		(so it is reported here, once, and never matches)
+	if (r.brand == 6 && _d < (time_t) r.enddate)
+		fprintf(stderr, "ERROR: annual by day repetition\n");
+}
+
+/*
+ * routine:	seek
+ *
+ * purpose:	start over, with the first candidate day that could
+ *		overlap [from, ...)
+ */
+void DatebookInstances::seek( time_t from ) {
+	_original = (_r.start_time + _span > from);
+	_d = _r.start_time + DAY;
+	if (from - _span + 1 > _d)
+		_d += ((from - _span + 1 - _d + DAY - 1) / DAY) * DAY;
+}
+
+// the number of days in a (struct tm's) month
+static int month_days( const struct tm &tm ) {
+	static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int year = tm.tm_year + 1900;
+	if (tm.tm_mon == 1 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))
+		return( 29 );
+	return( days[tm.tm_mon] );
+}
+
+/*
+ * routine:	next
+ *
+ * purpose:	to find the next occurrence of a record
+ *
+ * returns:	bool (false if there are no more)
+ *
+ * note:	the candidates are the days (at the record's time of
+ *		day) after the original, up to the end date.  A day
+ *		that does not match the pattern says how far ahead the
+ *		next one that could is, so a monthly or yearly event
+ *		does not cost a look at every day in between.
+ */
+bool DatebookInstances::next( time_t *start, time_t *end ) {
+
+	// the original event comes first (its date is not a repetition)
+	if (_original) {
+		_original = false;
+		*start = _r.start_time;
+		*end = _r.end_time;
+		return( true );
+	}
+	if (_r.brand == 0)
+		return( false );
+
+	while( _d < (time_t) _r.enddate ) {
+		time_t d = _d;
+		_d += DAY;
+
+		// deconstruct this into its date components (but the
+		// daily and weekly patterns need no more than the day)
+		struct tm tm;
+		if (_r.brand > 2)
+			gmtime_r( &d, &tm );
+
+		// see if this matches the specified pattern
+		switch( _r.brand ) {
+		case 1: // daily ... parameter: interval
+			break;
+
+		case 2: { // weekly by day ... parameters: day mask
+			long days = (d >= 0) ? d / DAY : (d - DAY + 1) / DAY;
+			int wday = (days % 7 + 11) % 7;		// (1970/01/01 was a Thursday)
+			if ((_r.day_mask & (1<<wday)) == 0)
+				continue;
+			// FIX - the above should probably be corrected for wstart
+			//	     but I had no sample data from which to understand
+			//		 its precise sense.
+			break;
+		}
+
+		case 3: // monthly by day ... parameters: day, week
+			if (_r.day_x < 1 || _r.day_x > 7) {
+				_d = _r.enddate;	// (it can never match)
+				continue;
+			}
+			if (tm.tm_wday != (int) _r.day_x - 1) {	// right day?
+				_d = d + ((_r.day_x - 1 + 7 - tm.tm_wday) % 7) * DAY;
+				continue;
+			}
+			if (tm.tm_mday <= ((int) _r.week_x - 1) * 7 ||	// right week?
+					tm.tm_mday > (int) _r.week_x * 7) {
+				_d = d + 7 * DAY;
+				continue;
+			}
+			break;
+
+		case 4: // monthly by date ... parameters: day number
+		case 5: // annual by date ... parameters: month and day
+			if (_r.day_num < 1 || _r.day_num > 31) {
+				_d = _r.enddate;
+				continue;
+			}
+			if (tm.tm_mday < (int) _r.day_num) {
+				_d = d + (_r.day_num - tm.tm_mday) * DAY;
+				continue;
+			}
+			if (tm.tm_mday > (int) _r.day_num) {	// (next month)
+				_d = d + (month_days( tm ) - tm.tm_mday + _r.day_num) * DAY;
+				continue;
+			}
+			if (_r.brand == 5 && tm.tm_mon != (int) _r.mon_x)
+				continue;
+			break;
+
+		case 6: // annual by day (see the constructor)
+			_d = _r.enddate;
+			continue;
+		}
+
+		// see if this date is on the exception list
+		bool excepted = false;
+		for( int i = 0; i < _r.num_except; i++ ) {
+			if (d >= (time_t) _r.excepts[i] && d < (time_t) _r.excepts[i] + DAY)
+				excepted = true;
+		}
+		if (excepted)
+			continue;
+
+		*start = d;
+		*end = d + _duration;
+		return( true );
+	}
+
+	return( false );
+}
+
+/*
+ * routine:	expand_datebook
+ *
+ * purpose:	to deliver each occurrence of a record to a visitor
+ *
+ * returns:	number of occurrences delivered
+ */
+int expand_datebook( const DatebookRecord &r, DatebookVisitor *v ) {
+
+	DatebookInstances instances( r );
+	time_t st, et;
+	int count = 0;
+	while( instances.next( &st, &et ) ) {
+		v->onInstance( r, st, et );
+		count++;
+	}
+
+	return( count );
+}
+
+/*
+ * routine:	expand_datebook_range
+ *
+ * purpose:	to deliver just the occurrences of a record that
+ *		overlap [from, to) to a visitor
+ *
+ * note:	this generates exactly the instances expand_datebook
+ *		would, but starts with the first candidate day that
+ *		could overlap the range, and stops at the end of it.
+ *
+ * returns:	number of occurrences delivered
+ */
+int expand_datebook_range( const DatebookRecord &r, time_t from, time_t to,
+		DatebookVisitor *v ) {
+
+	DatebookInstances instances( r );
+	instances.seek( from );
+	time_t st, et;
+	int count = 0;
+	while( instances.next( &st, &et ) && st < to ) {
+		v->onInstance( r, st, et );
+		count++;
+	}
+
+	return( count );
+}
+
+/*
+ * routine:	datebook_count
+ *
+ * purpose:	make sure this is a datebook we understand, and
+ *		read the number of entries that follows the header
+ *
+ * returns:	number of entries (or -1)
+ */
+long datebook_count( PalmArchive *arc, PalmCursor *cursor ) {
+
+	// make sure that it is, in fact, a datebook archive
+	if (arc->fileType() != arc->DBA_SIG) {
+		fprintf(stderr, "ERROR: file is not a DateBook Archive\n");
+		return( -1 );
+	}
+
+	// make sure I understand it as such
+	if (arc->fields_per_row() != FIELDS_PER_ENTRY) {
+		fprintf(stderr, "ERROR: fields per row = %d, expected %d\n",
+				arc->fields_per_row(), FIELDS_PER_ENTRY);
+		return( -1 );
+	}
+
+	// the next 4-bytes should be the number of datebook entries
+	// multiplied by 15 (number of fields per entry)
+	if (cursor == 0)
+		cursor = arc->cursor();
+	long num_entry = cursor->readUlong();
+	if (num_entry % FIELDS_PER_ENTRY != 0) {
+		fprintf( stderr, "# datebook entries (%ld) not a multiple of %d\n",
+			num_entry, FIELDS_PER_ENTRY );
+	}
+	num_entry /= FIELDS_PER_ENTRY;
+
+	if (num_entry < 0 || num_entry > 1000000) {
+		fprintf( stderr, "Unreasonable number of datebook entries: %ld\n",
+			num_entry );
+		return( -1 );
+	}
+
+	return( num_entry );
+}
+
+/*
+ * routine:	datebook_header
+ *
+ * purpose:	describe a datebook archive's header
+ */
+void datebook_header( PalmArchive *arc, long num_records, DatebookHeader &h ) {
+	h.filetype = arc->fileType();
+	h.filename = arc->fileName();
+	h.header = arc->headerString();
+	h.num_categories = arc->num_categories();
+	h.num_records = num_records;
+}
+
+/*
+ * routine:	datebook_offsets
+ *
+ * purpose:	to find where each record starts, so that ranges of
+ *		records can later be decoded independently (e.g. by
+ *		different threads, each with its own cursor).
+ *
+ * returns:	malloc'd array of num_records+1 offsets (the last one
+ *		being the end of the records), or zero
+ */
+size_t *datebook_offsets( PalmArchive *arc, long *num_records ) {
+
+	PalmCursor c = arc->cursorAt( arc->bodyOffset() );
+	long num_entry = datebook_count( arc, &c );
+	if (num_entry < 0)
+		return( 0 );
+
+	size_t *offsets = (size_t *) malloc( (num_entry + 1) * sizeof (size_t) );
+	DatebookReader reader( &c );
+	reader.setFields( 0 );		// (we only want to get past them)
+	DatebookRecord r;
+	for( long i = 0; i < num_entry; i++ ) {
+		offsets[i] = c.offset();
+		if (reader.readRecord( r ) == DatebookReader::FATAL) {
+			num_entry = i;
+			break;
+		}
+	}
+	offsets[num_entry] = c.offset();
+
+	*num_records = num_entry;
+	return( offsets );
+}
+
+/*
+ * routine:	decode_datebook
+ *
+ * purpose:	to decode an entire datebook archive, delivering
+ *		the header, categories, records and instances
+ *		to a visitor.
+ *
+ * returns:	0 on success, 1 on failure
+ */
+int decode_datebook( PalmArchive *arc, DatebookVisitor *v ) {
+
+	long num_entry = datebook_count( arc );
+	if (num_entry < 0)
+		return( 1 );
+
+	DatebookHeader h;
+	datebook_header( arc, num_entry, h );
+	v->onHeader( h );
+	for( int i = 0; i < h.num_categories; i++ )
+		v->onCategory( i, arc->category(i) );
+
+	int processed = 0;
+	int discards = 0;
+
+	DatebookReader reader( arc );
+	reader.setFields( v->fields() );
+	DatebookRecord r;
+	for( int i = 0; i < num_entry; i++ ) {
+		int ret = reader.readRecord( r );
+		if (ret == DatebookReader::FATAL)
+			return( 1 );
+
+		if (ret == DatebookReader::RECORD) {
+			r.index = i+1;
+			if (v->onRecord( r ))
+				expand_datebook( r, v );
+			processed++;
+		} else {
+			discards++;
+		}
+	}
+
+	if (verbose) {
+		fprintf(stderr, "expected %ld, processed %d, discarded %d\n",
+				num_entry, processed, discards);
+	}
+	return( 0 );
+}
+
+/*
+ * routine:	decode_datebook_range
+ *
+ * purpose:	to decode a range of records (as located by
+ *		datebook_offsets) into a visitor.  No header or
+ *		category events are delivered.
+ *
+ * note:	this uses its own cursor and reader, and so any
+ *		number of these can be running (in different
+ *		threads, with different visitors) at once.
+ *
+ * returns:	0 on success, 1 on failure
+ */
+int decode_datebook_range( PalmArchive *arc, const size_t *offsets,
+		long first, long last, DatebookVisitor *v ) {
+
+	if (first >= last)
+		return( 0 );
+
+	PalmCursor c = arc->cursorAt( offsets[first] );
+	DatebookReader reader( &c );
+	reader.setFields( v->fields() );
+	DatebookRecord r;
+	for( long i = first; i < last; i++ ) {
+		int ret = reader.readRecord( r );
+		if (ret == DatebookReader::FATAL)
+			return( 1 );
+		if (ret == DatebookReader::RECORD) {
+			r.index = i+1;
+			if (v->onRecord( r ))
+				expand_datebook( r, v );
+		}
+	}
+
+	return( 0 );
+}
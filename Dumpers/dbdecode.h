@@ -0,0 +1,184 @@
+/*
+ * module:	dbdecode.h
+ *
+ * purpose:	streaming (visitor based) decoding of Palm Datebook Archives
+ *
+ * note:	each record is handed to a visitor as a flat
+ *		DatebookRecord whose strings are views into the reader's
+ *		(reused) buffers, and each occurrence is handed over as
+ *		a (start, end) pair.  Nothing is allocated per record,
+ *		so this is what embedders should use.
+ */
+#ifndef _DBDECODE_H
+#define _DBDECODE_H
+
+#include <time.h>
+#include "palmarchive.h"
+
+// a decoded string ... a view into somebody else's buffer
+struct PalmString {
+	const char	*str;	// NUL terminated, or 0 if field was empty
+	unsigned	len;
+};
+
+// one decoded datebook record (field numbers are those in the archive)
+struct DatebookRecord {
+	long		index;		// 1-based position within the archive
+	unsigned long	rid;		// 1: record ID
+	unsigned long	status;		// 2: status (0x04 = deleted)
+	unsigned long	position;	// 3: position
+	time_t		start_time;	// 4: starting time
+	time_t		end_time;	// 5/7: end time (or start + duration)
+	PalmString	summary;	// 6: description
+	PalmString	description;	// 8: note
+	bool		allday;		// 9: untimed
+	bool		pvt;		// 10: private
+	unsigned long	category;	// 11: category index
+	bool		alarm_set;	// 12: alarm set
+	unsigned long	alarm_units;	// 13: alarm advance
+	unsigned long	alarm_type;	// 14: alarm units
+
+	// 15: repeat information (brand 0 means it does not repeat)
+	unsigned short	num_except;
+	const unsigned long *excepts;	// exception dates
+	unsigned long	brand;		// 1-6: daily ... yearly by day
+	unsigned long	interval;
+	unsigned long	enddate;
+	unsigned long	wstart;
+	unsigned long	day_x;
+	unsigned char	day_mask;
+	unsigned long	week_x;
+	unsigned long	day_num;
+	unsigned long	mon_x;
+};
+
+// the optional (string) fields of a record, as a mask: a reader
+// skips over the ones that are not wanted without copying them
+static const unsigned DB_SUMMARY = 1;		// 6: description
+static const unsigned DB_NOTE = 2;		// 8: note
+static const unsigned DB_ALL_FIELDS = DB_SUMMARY | DB_NOTE;
+
+// what we learned from the archive header
+struct DatebookHeader {
+	unsigned long	filetype;
+	const char	*filename;
+	const char	*header;
+	int		num_categories;
+	long		num_records;
+};
+
+/*
+ * events delivered by decode_datebook, in order:
+ *	onHeader once, onCategory once per category,
+ *	and then for each (non-deleted) record an onRecord
+ *	followed by an onInstance for each occurrence
+ *	(starting with the original one).
+ *
+ *	All pointers are only good for the duration of the call.
+ */
+class DatebookVisitor {
+   public:
+	virtual ~DatebookVisitor() {}
+
+	virtual void onHeader( const DatebookHeader & ) {}
+	virtual void onCategory( int, const char * ) {}
+	// return false if you do not want to see the instances
+	virtual bool onRecord( const DatebookRecord & ) { return( true ); }
+	virtual void onInstance( const DatebookRecord &, time_t, time_t ) {}
+	// which optional fields it looks at (the others come back empty)
+	virtual unsigned fields() { return( DB_ALL_FIELDS ); }
+};
+
+/*
+ * a DatebookReader decodes one record at a time into
+ * a DatebookRecord, re-using its own string buffers.
+ *
+ * Readers on separate cursors (see PalmArchive::cursorAt)
+ * can safely be used in parallel on the same archive.
+ */
+class DatebookReader {
+   public:
+	DatebookReader( PalmArchive *arc );	// the archive's own cursor
+	DatebookReader( PalmCursor *cursor );
+	~DatebookReader();
+
+	// read the record at the current position
+	int readRecord( DatebookRecord & );
+
+	// which optional fields to decode (default: DB_ALL_FIELDS)
+	void setFields( unsigned fields )	{ _fields = fields; }
+
+	// readRecord return values
+	static const int RECORD = 0;	// a good record
+	static const int DELETED = 1;	// a good record, but deleted
+	static const int BAD = 2;	// malformed record
+	static const int FATAL = 3;	// we have lost sync w/stream
+
+   private:
+	void init( PalmCursor *cursor );
+	const char *readString( char **buf, unsigned *size, unsigned *len,
+			bool wanted );
+
+	PalmCursor	*_cur;
+	unsigned	_fields;	// DB_SUMMARY, ...
+	char		*_summary;	// buffer for field 6
+	unsigned	_summary_size;
+	char		*_note;		// buffer for field 8
+	unsigned	_note_size;
+	unsigned long	*_excepts;	// buffer for exception dates
+	unsigned	_excepts_size;
+};
+
+// read and sanity check the record count that follows the header
+long datebook_count( PalmArchive *arc, PalmCursor *cursor = 0 );
+
+// fill in a header description for a datebook archive
+void datebook_header( PalmArchive *arc, long num_records, DatebookHeader & );
+
+// find the starting offset of each record (caller frees)
+size_t *datebook_offsets( PalmArchive *arc, long *num_records );
+
+// deliver every occurrence of a record to a visitor
+int expand_datebook( const DatebookRecord &, DatebookVisitor * );
+
+// deliver just the occurrences that overlap [from, to)
+int expand_datebook_range( const DatebookRecord &, time_t from, time_t to,
+		DatebookVisitor * );
+
+// how long each occurrence of a record occupies the calendar
+long datebook_span( const DatebookRecord & );
+
+/*
+ * the occurrences of a record, pulled one at a time (in order):
+ * the work done is in proportion to the occurrences taken, not to
+ * how long the record repeats for.  These are exactly the ones
+ * expand_datebook delivers (which is built on this).  The record
+ * (and its exceptions) must outlive the iterator.
+ */
+class DatebookInstances {
+   public:
+	DatebookInstances( const DatebookRecord & );
+
+	// the next occurrence (false when there are no more)
+	bool next( time_t *start, time_t *end );
+
+	// go (forwards or back) to the first occurrence that overlaps
+	// [from, ...): it is the one that next() will deliver
+	void seek( time_t from );
+
+   private:
+	const DatebookRecord &_r;
+	long	_duration;
+	long	_span;
+	bool	_original;	// (the record itself is yet to be delivered)
+	time_t	_d;		// the next candidate day
+};
+
+// decode an entire datebook archive into a visitor
+int decode_datebook( PalmArchive *arc, DatebookVisitor * );
+
+// decode records [first, last) into a visitor (on a private cursor)
+int decode_datebook_range( PalmArchive *arc, const size_t *offsets,
+		long first, long last, DatebookVisitor * );
+
+#endif
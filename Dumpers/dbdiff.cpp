@@ -0,0 +1,217 @@
+/*
+ * module:	dbdiff.cpp
+ *
+ * purpose:	incremental conversion: compare two versions of a
+ *		datebook (by record ID) and put out only what changed
+ *
+ * note:	each record in each version is reduced to a (record ID,
+ *		hash) pair, and the two sorted lists are merged.  Only
+ *		records that were added, deleted or whose hash changed
+ *		are ever expanded.  Since instance UIDs are derived from
+ *		the record ID and the date, a changed record puts out
+ *		all of its (new) instances, and cancellations for any
+ *		old instances that fell on dates it no longer has.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbdiff.h"
+#include "palmhash.h"
+
+extern bool verbose;	// commentary on what we find
+
+static const int DAY = 24 * 60 * 60;
+
+/*
+ * routine:	datebook_record_hash
+ *
+ * purpose:	hash all of the fields that affect a record's output
+ */
+uint64_t datebook_record_hash( const DatebookRecord &r ) {
+	uint64_t fixed[16];
+	fixed[0] = r.start_time;
+	fixed[1] = r.end_time;
+	fixed[2] = (r.allday ? 1 : 0) | (r.pvt ? 2 : 0) | (r.alarm_set ? 4 : 0);
+	fixed[3] = r.category;
+	fixed[4] = r.alarm_units;
+	fixed[5] = r.alarm_type;
+	fixed[6] = r.brand;
+	fixed[7] = r.interval;
+	fixed[8] = r.enddate;
+	fixed[9] = r.wstart;
+	fixed[10] = r.day_x;
+	fixed[11] = r.day_mask;
+	fixed[12] = r.week_x;
+	fixed[13] = r.day_num;
+	fixed[14] = r.mon_x;
+	fixed[15] = r.num_except;
+
+	uint64_t h = palm_hash( fixed, sizeof fixed );
+	h = palm_hash( r.excepts, r.num_except * sizeof (unsigned long), h );
+	// (a missing string and an empty one are different)
+	h = palm_hash( r.summary.str ? r.summary.str : "", r.summary.len + 1, h );
+	h = palm_hash( r.description.str ? r.description.str : "",
+			r.description.len + 1, h );
+	return( h );
+}
+
+// the identity of one record in one version
+struct diff_key {
+	unsigned long	rid;
+	uint64_t	hash;
+	long		slot;	// its index in the cache
+};
+
+static int by_rid( const void *a, const void *b ) {
+	const struct diff_key *ka = (const struct diff_key *) a;
+	const struct diff_key *kb = (const struct diff_key *) b;
+	if (ka->rid != kb->rid)
+		return( (ka->rid < kb->rid) ? -1 : 1 );
+	return( (ka->slot < kb->slot) ? -1 : (ka->slot > kb->slot) );
+}
+
+static struct diff_key *diff_keys( DatebookCache *c ) {
+	long n = c->numRecords();
+	struct diff_key *keys = (struct diff_key *) malloc( (n + 1) * sizeof *keys );
+	DatebookRecord r;
+	for( long i = 0; i < n; i++ ) {
+		c->record( i, r );
+		keys[i].rid = r.rid;
+		keys[i].hash = datebook_record_hash( r );
+		keys[i].slot = i;
+	}
+	qsort( keys, n, sizeof *keys, by_rid );
+	return( keys );
+}
+
+/*
+ * a visitor that just notes the days on which a record occurs
+ */
+class DayCollector : public DatebookVisitor {
+   public:
+	DayCollector() { days = 0; num = 0; max = 0; }
+	~DayCollector() { free( days ); }
+
+	void onInstance( const DatebookRecord &, time_t st, time_t ) {
+		if (num == max) {
+			max = max ? 2 * max : 64;
+			days = (long *) realloc( days, max * sizeof (long) );
+		}
+		days[num++] = st / DAY;
+	}
+
+	// instances are delivered in date order
+	bool has( long day ) {
+		long lo = 0, hi = num;
+		while( lo < hi ) {
+			long mid = (lo + hi) / 2;
+			if (days[mid] < day)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return( lo < num && days[lo] == day );
+	}
+
+	long	*days;
+	long	num;
+	long	max;
+};
+
+/*
+ * a visitor that passes along only the instances on days
+ * that do not appear in another version of the record
+ * (only ever used for a formatter that wants instances)
+ */
+class DayFilter : public DatebookVisitor {
+   public:
+	DayFilter( DatebookVisitor *v, DayCollector *other ) {
+		_v = v;
+		_other = other;
+	}
+	bool onRecord( const DatebookRecord &r ) { return( _v->onRecord( r ) ); }
+	void onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+		if (!_other->has( st / DAY ))
+			_v->onInstance( r, st, et );
+	}
+
+   private:
+	DatebookVisitor	*_v;
+	DayCollector	*_other;
+};
+
+// deliver one record (and its instances) with a given change type
+// (returns whether the formatter wanted the instances)
+static bool emit( DatebookCache *c, long slot, DatebookFormatter *f, int change,
+		DatebookVisitor *v = 0 ) {
+	DatebookRecord r;
+	c->record( slot, r );
+	f->setChange( change );
+	if (v == 0)
+		v = f;
+	if (!v->onRecord( r ))
+		return( false );
+	expand_datebook( r, v );
+	return( true );
+}
+
+/*
+ * routine:	diff_datebook
+ *
+ * purpose:	deliver (to a formatter) the header of the current
+ *		version, and then only the instances that differ
+ *		from the old version.
+ *
+ * returns:	0 on success
+ */
+int diff_datebook( DatebookCache *old, DatebookCache *cur, DatebookFormatter *f ) {
+
+	long no = old->numRecords();
+	long nc = cur->numRecords();
+	struct diff_key *ko = diff_keys( old );
+	struct diff_key *kc = diff_keys( cur );
+
+	cur->decodeHeader( f );
+
+	long added = 0, changed = 0, deleted = 0;
+	long i = 0, j = 0;
+	while( i < no || j < nc ) {
+		if (j >= nc || (i < no && ko[i].rid < kc[j].rid)) {
+			emit( old, ko[i++].slot, f, DatebookFormatter::DELETED );
+			deleted++;
+		} else if (i >= no || kc[j].rid < ko[i].rid) {
+			emit( cur, kc[j++].slot, f, DatebookFormatter::ADDED );
+			added++;
+		} else {
+			if (ko[i].hash != kc[j].hash) {
+				// all of the new instances (or the new record)
+				bool instances = emit( cur, kc[j].slot, f,
+						DatebookFormatter::CHANGED );
+
+				// and cancellations for old ones that are gone
+				// (a records format has already had the change)
+				if (instances) {
+					DatebookRecord r;
+					DayCollector now;
+					cur->record( kc[j].slot, r );
+					expand_datebook( r, &now );
+					DayFilter gone( f, &now );
+					emit( old, ko[i].slot, f, DatebookFormatter::DELETED, &gone );
+				}
+				changed++;
+			}
+			i++;
+			j++;
+		}
+	}
+	f->setChange( DatebookFormatter::UNCHANGED );
+
+	if (verbose)
+		fprintf(stderr, "added %ld, changed %ld, deleted %ld records\n",
+				added, changed, deleted);
+
+	free( ko );
+	free( kc );
+	return( 0 );
+}
@@ -0,0 +1,21 @@
+/*
+ * module:	dbdiff.h
+ *
+ * purpose:	incremental conversion: compare two versions of a
+ *		datebook (by record ID) and put out only what changed
+ */
+#ifndef _DBDIFF_H
+#define _DBDIFF_H
+
+#include <stdint.h>
+#include "dbdecode.h"
+#include "dbcache.h"
+#include "dbformat.h"
+
+// a hash of everything in a record that would show up in its output
+uint64_t datebook_record_hash( const DatebookRecord & );
+
+// deliver the added, changed and deleted instances (0 on success)
+int diff_datebook( DatebookCache *old, DatebookCache *cur, DatebookFormatter * );
+
+#endif
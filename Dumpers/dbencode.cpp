@@ -0,0 +1,271 @@
+/*
+ * module:	dbencode.cpp
+ *
+ * purpose:	write a Palm Datebook Archive: the header, categories and
+ *		schema that PalmArchive::readHeader() reads, and records
+ *		laid out just as DatebookReader::readRecord() expects them
+ *
+ * note:	each record is built in a buffer of our own and written
+ *		with a single fwrite (through a large stdio buffer), so
+ *		there is no per-field overhead however many there are.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbencode.h"
+
+static const unsigned long DBA_TYPE = 0x44420100;	// PalmArchive::DBA_SIG
+static const int DBA_FIELDS = 15;			// per record
+static const size_t DBA_BUFFER = 1024 * 1024;		// (for stdio)
+
+// the type of each of a record's fields (as readRecord checks them)
+static const unsigned short schema[DBA_FIELDS] = {
+	1, 1, 1, 3, 1, 5, 1, 5, 6, 6, 1, 6, 1, 1, 8
+};
+
+// a repeat is an object of this (MFC serialized) class
+static const char repeat_class[] = "CDayName";
+
+DatebookWriter::DatebookWriter() {
+	_out = 0;
+	_path = 0;
+	_tmp = 0;
+	_count_at = 0;
+	_records = 0;
+	_class_named = false;
+	_buf = 0;
+	_len = 0;
+	_max = 0;
+}
+
+DatebookWriter::~DatebookWriter() {
+	if (_out) {		// (never finished)
+		fclose( _out );
+		remove( _tmp );
+	}
+	free( _path );
+	free( _tmp );
+	free( _buf );
+}
+
+void DatebookWriter::putUbyte( unsigned char c ) {
+	if (_len == _max) {
+		_max = _max ? 2 * _max : 4096;
+		_buf = (unsigned char *) realloc( _buf, _max );
+	}
+	_buf[_len++] = c;
+}
+
+void DatebookWriter::putUshort( unsigned short s ) {
+	putUbyte( s & 0xff );
+	putUbyte( s >> 8 );
+}
+
+void DatebookWriter::putUlong( unsigned long l ) {
+	putUbyte( l & 0xff );
+	putUbyte( (l >> 8) & 0xff );
+	putUbyte( (l >> 16) & 0xff );
+	putUbyte( (l >> 24) & 0xff );
+}
+
+/*
+ * routine:	putString
+ *
+ * purpose:	write a Cstring (len, string), the inverse of readCstring
+ *
+ * note:	lengths of 255 and up are 0xff followed by a short, so
+ *		a string can be no longer than 65535 bytes.
+ */
+void DatebookWriter::putString( const char *s, unsigned len ) {
+	if (s == 0)
+		len = 0;
+	if (len > 0xffff)
+		len = 0xffff;
+	if (len < 0xff)
+		putUbyte( len );
+	else {
+		putUbyte( 0xff );
+		putUshort( len );
+	}
+	if (len == 0)
+		return;
+	if (_len + len > _max) {
+		while( _len + len > _max )
+			_max = _max ? 2 * _max : 4096;
+		_buf = (unsigned char *) realloc( _buf, _max );
+	}
+	memcpy( _buf + _len, s, len );
+	_len += len;
+}
+
+void DatebookWriter::putField( unsigned long type, unsigned long value ) {
+	putUlong( type );
+	putUlong( value );
+}
+
+/*
+ * routine:	open
+ *
+ * purpose:	start an archive, writing everything up to the records
+ *
+ * returns:	bool (success/failure)
+ */
+bool DatebookWriter::open( const char *path, const char * const *categories, int num ) {
+	_path = strdup( path );
+	size_t len = strlen( path ) + 8;
+	_tmp = (char *) malloc( len );
+	snprintf( _tmp, len, "%s.tmp", path );
+	_out = fopen( _tmp, "w" );
+	if (_out == 0) {
+		perror( _tmp );
+		return( false );
+	}
+	setvbuf( _out, 0, _IOFBF, DBA_BUFFER );
+
+	// the archive header
+	_len = 0;
+	putUlong( DBA_TYPE );
+	const char *name = strrchr( path, '/' );
+	name = name ? name + 1 : path;
+	putString( name, strlen( name ) );
+	putString( 0, 0 );			// (no custom header)
+
+	// the categories
+	if (num > DBA_MAX_CATEGORIES)
+		num = DBA_MAX_CATEGORIES;
+	putUlong( num );			// first free category ID
+	putUlong( num );
+	for( int i = 0; i < num; i++ ) {
+		const char *c = categories[i] ? categories[i] : "";
+		size_t clen = strlen( c );
+		putUlong( i );			// index
+		putUlong( i );			// ID
+		putUlong( 0 );			// dirty
+		putString( c, clen );
+		putString( c, clen < 8 ? clen : 8 );	// (short name)
+	}
+
+	// the schema
+	putUlong( 0x36 );			// resource ID
+	putUlong( DBA_FIELDS );			// fields per record
+	putUlong( 0 );				// record ID position
+	putUlong( 1 );				// status position
+	putUlong( 2 );				// placement position
+	putUshort( DBA_FIELDS );
+	for( int i = 0; i < DBA_FIELDS; i++ )
+		putUshort( schema[i] );
+
+	// and the (number of) fields to follow, to be patched by finish
+	_count_at = _len;
+	putUlong( 0 );
+
+	return( fwrite( _buf, 1, _len, _out ) == _len );
+}
+
+/*
+ * routine:	write
+ *
+ * purpose:	add a record to the archive
+ *
+ * returns:	bool (success/failure)
+ */
+bool DatebookWriter::write( const DatebookRecord &r ) {
+	if (_out == 0 || _records >= DBA_MAX_RECORDS)
+		return( false );
+	_len = 0;
+
+	putField( 1, r.rid );					// 1: record ID
+	putField( 1, r.status );				// 2: status
+	putField( 1, r.position );				// 3: position
+	putField( 3, r.start_time );				// 4: starting time
+	putField( 1, r.end_time );				// 5: ending time
+	putField( 5, 0 );					// 6: description
+	putString( r.summary.str, r.summary.len );
+	putField( 1, r.end_time - r.start_time );		// 7: duration
+	putField( 5, 0 );					// 8: note
+	putString( r.description.str, r.description.len );
+	putField( 6, r.allday );				// 9: untimed
+	putField( 6, r.pvt );					// 10: private
+	putField( 1, r.category );				// 11: category
+	putField( 6, r.alarm_set );				// 12: alarm set
+	putField( 1, r.alarm_units );				// 13: alarm advance
+	putField( 1, r.alarm_type );				// 14: alarm units
+
+	putUlong( 8 );						// 15: repeat
+	putUshort( r.num_except );
+	for( int i = 0; i < r.num_except; i++ )
+		putUlong( r.excepts[i] );
+	if (r.brand == 0)
+		putUshort( 0 );
+	else {
+		/*
+		 * the first repeat defines its class (by name), and
+		 * later ones refer back to it (as class #1)
+		 */
+		if (_class_named)
+			putUshort( 0x8001 );
+		else {
+			putUshort( 0xffff );
+			putUshort( 1 );			// (schema)
+			putUshort( sizeof repeat_class - 1 );
+			for( const char *p = repeat_class; *p; p++ )
+				putUbyte( *p );
+			_class_named = true;
+		}
+		putUlong( r.brand );
+		putUlong( r.interval );
+		putUlong( r.enddate );
+		putUlong( r.wstart );
+		switch( r.brand ) {
+		case 1:	// daily
+		case 6:	// yearly by day
+			putUlong( r.day_x );
+			break;
+		case 2:	// weekly, by days
+			putUlong( r.day_x );
+			putUbyte( r.day_mask );
+			break;
+		case 3:	// monthly, by day
+			putUlong( r.day_x );
+			putUlong( r.week_x );
+			break;
+		case 4:	// monthly, by date
+			putUlong( r.day_num );
+			break;
+		case 5:	// yearly, by date
+			putUlong( r.day_num );
+			putUlong( r.mon_x );
+			break;
+		}
+	}
+
+	_records++;
+	return( fwrite( _buf, 1, _len, _out ) == _len );
+}
+
+/*
+ * routine:	finish
+ *
+ * purpose:	patch in the record count, and rename the archive into place
+ *
+ * returns:	bool (success/failure)
+ */
+bool DatebookWriter::finish() {
+	if (_out == 0)
+		return( false );
+	_len = 0;
+	putUlong( _records * DBA_FIELDS );
+	bool ok = fseek( _out, _count_at, SEEK_SET ) == 0 &&
+			fwrite( _buf, 1, _len, _out ) == _len;
+	if (fclose( _out ) != 0)
+		ok = false;
+	_out = 0;
+	if (ok && rename( _tmp, _path ) != 0)
+		ok = false;
+	if (!ok) {
+		perror( _path );
+		remove( _tmp );
+	}
+	return( ok );
+}
@@ -0,0 +1,62 @@
+/*
+ * module:	dbencode.h
+ *
+ * purpose:	write Palm Datebook Archives (the inverse of dbdecode)
+ *
+ * note:	the archive header says how many records follow, which
+ *		we do not know until they have all been written: the
+ *		count is written as zero, and patched by finish().
+ *		The archive is written to a temporary name (next to
+ *		the real one) and renamed into place when it is done.
+ */
+#ifndef _DBENCODE_H
+#define _DBENCODE_H
+
+#include <stdio.h>
+#include "dbdecode.h"
+
+// the most categories a Palm knows about (including Unfiled)
+static const int DBA_MAX_CATEGORIES = 16;
+
+// the most records an archive may have (as many as datebook_count accepts)
+static const long DBA_MAX_RECORDS = 1000000;
+
+// "no end date" for a repetition: the end of the Palm's calendar
+static const unsigned long DBA_NO_END = 1956528000;	// 2032/01/01
+
+class DatebookWriter {
+   public:
+	DatebookWriter();
+	~DatebookWriter();
+
+	// start an archive, with its categories (0 is normally Unfiled)
+	bool open( const char *path, const char * const *categories, int num );
+
+	// add a record (its index, rid and position are used as given);
+	// fails once there are DBA_MAX_RECORDS
+	bool write( const DatebookRecord & );
+
+	// patch in the record count, and put the archive in place
+	bool finish();
+
+	long records()		{ return( _records ); }
+
+   private:
+	void putUlong( unsigned long );
+	void putUshort( unsigned short );
+	void putUbyte( unsigned char );
+	void putString( const char *s, unsigned len );
+	void putField( unsigned long type, unsigned long value );
+
+	FILE		*_out;
+	char		*_path;
+	char		*_tmp;
+	long		_count_at;	// (offset of the record count)
+	long		_records;
+	bool		_class_named;	// (the repeat class has been defined)
+	unsigned char	*_buf;		// the record being built
+	size_t		_len;
+	size_t		_max;
+};
+
+#endif
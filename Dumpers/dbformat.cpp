@@ -0,0 +1,375 @@
+/*
+ * module:	dbformat.cpp
+ *
+ * purpose:	output formats for decoded datebook records
+ *
+ * note:	these print straight from the decoder's views,
+ *		so no Appt is ever created.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbformat.h"
+#include "dbarrow.h"
+#include "appt.h"
+
+DatebookFormatter::~DatebookFormatter() {
+	for( int i = 0; i < _num_categories; i++ )
+		free( _categories[i] );
+	free( _categories );
+}
+
+void DatebookFormatter::onCategory( int i, const char *name ) {
+	if (i < 0)
+		return;
+	if (i >= _num_categories) {
+		_categories = (char **) realloc( _categories, (i + 1) * sizeof (char *) );
+		while( _num_categories <= i )
+			_categories[_num_categories++] = 0;
+	}
+	free( _categories[i] );
+	_categories[i] = name ? strdup( name ) : 0;
+}
+
+const char *DatebookFormatter::categoryName( unsigned long i ) {
+	if (i < (unsigned long) _num_categories && _categories[i] != 0)
+		return( _categories[i] );
+	return( "NONE" );
+}
+
+bool DatebookFormatter::span( time_t *first, time_t *last ) {
+	*first = _first;
+	*last = _last;
+	return( _spanned );
+}
+
+void DatebookFormatter::cover( time_t first, time_t last ) {
+	if (!_spanned || first < _first)
+		_first = first;
+	if (!_spanned || last > _last)
+		_last = last;
+	_spanned = true;
+}
+
+/*
+ * routine:	datebook_uid
+ *
+ * purpose:	construct a UID for an instance of a record
+ *
+ * note:	the record ID survives edits on the Palm, and a record
+ *		has at most one instance per day, so the pair is stable
+ *		from one conversion (of one version of an archive) to
+ *		the next.  When several datebooks are merged, the same
+ *		pair can come from more than one of them, so the source
+ *		is added to tell them apart.
+ */
+void datebook_uid( char *buf, size_t len, unsigned long rid, time_t start,
+		int source ) {
+	struct tm tm;
+	gmtime_r( &start, &tm );
+	int n = snprintf( buf, len, "palm-%lu-%04d%02d%02d",
+			rid, tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday );
+	if (source > 0 && n > 0 && (size_t) n < len)
+		snprintf( buf + n, len - n, "-%d", source );
+}
+
+bool SummaryFormatter::onRecord( const DatebookRecord &r ) {
+	_apptnum = r.index;
+	return( true );
+}
+
+void SummaryFormatter::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	if (_change != UNCHANGED)
+		fprintf( _out, "%c ", "=+~-"[_change] );
+
+	// print summary, or failing that, the description
+	const char *descr = (r.summary.str != 0) ? r.summary.str : r.description.str;
+	print_summary( _out, _apptnum, st, r.allday ? 0 : et, descr, _tz != 0 );
+	_apptnum = -1;	// repetitions are not numbered
+}
+
+void VcalFormatter::onHeader( const DatebookHeader & ) {
+	Appt::header( _out );
+	_started = true;
+}
+
+void VcalFormatter::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	char uid[64];
+	datebook_uid( uid, sizeof uid, r.rid, st, _source );
+	print_vcal( _out, st, et, r.summary.str, r.description.str, r.allday, r.pvt,
+			uid, _change == DELETED, _tz ? _tz->name() : 0 );
+	if (!r.allday)
+		cover( st, et );
+}
+
+void VcalFormatter::finish() {
+	if (!_started)
+		return;
+
+	// (a VTIMEZONE may come after the events that use it)
+	time_t first, last;
+	if (_tz && span( &first, &last ))
+		_tz->vtimezone( _out, first, last );
+	Appt::trailer( _out );
+}
+
+/*
+ * the pieces of the JSON and CSV formats
+ */
+static const char *brand_names[] = { "none", "daily", "weekly",
+	"monthly-by-day", "monthly-by-date", "yearly-by-date", "yearly-by-day" };
+
+// an ISO 8601 time (or, for all-day events, date), with its offset
+// from UTC if we know the zone
+static void iso_time( FILE *out, time_t t, bool date_only, TimeZone *tz = 0 ) {
+	struct tm tm;
+	gmtime_r( &t, &tm );
+	if (date_only) {
+		fprintf( out, "%04d-%02d-%02d",
+				tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday );
+		return;
+	}
+	fprintf( out, "%04d-%02d-%02dT%02d:%02d:%02d",
+			tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec );
+	if (tz == 0) {
+		putc( 'Z', out );
+		return;
+	}
+	long off = t - tz->utc( t );
+	fprintf( out, "%c%02ld:%02ld", (off < 0) ? '-' : '+',
+			labs( off ) / 3600, (labs( off ) / 60) % 60 );
+}
+
+// a (Latin-1) character of Palm text, as UTF-8
+static void put_utf8( FILE *out, unsigned char c ) {
+	if (c >= 0x80) {
+		putc( 0xc0 | (c >> 6), out );
+		putc( 0x80 | (c & 0x3f), out );
+	} else
+		putc( c, out );
+}
+
+/*
+ * a JSON string (or null).  Palm text is Latin-1, and JSON is
+ * UTF-8, so the top half of the character set is converted.
+ */
+static void json_string( FILE *out, const char *s ) {
+	if (s == 0) {
+		fputs( "null", out );
+		return;
+	}
+	putc( '"', out );
+	for( const unsigned char *p = (const unsigned char *) s; *p; p++ ) {
+		if (*p == '"' || *p == '\\') {
+			putc( '\\', out );
+			putc( *p, out );
+		} else if (*p < 0x20)
+			fprintf( out, "\\u%04x", *p );
+		else
+			put_utf8( out, *p );
+	}
+	putc( '"', out );
+}
+
+// a CSV field, quoted (with quotes doubled) only if need be, and
+// in UTF-8 like the JSON
+static void csv_string( FILE *out, const char *s ) {
+	if (s == 0)
+		return;
+	bool quoted = (strpbrk( s, ",\"\r\n" ) != 0);
+	if (quoted)
+		putc( '"', out );
+	for( const unsigned char *p = (const unsigned char *) s; *p; p++ ) {
+		if (*p == '"')
+			putc( '"', out );
+		put_utf8( out, *p );
+	}
+	if (quoted)
+		putc( '"', out );
+}
+
+static const char *change_names[] = { "", "added", "changed", "deleted" };
+
+const char *datebook_brand_name( unsigned long brand ) {
+	return( brand_names[brand <= 6 ? brand : 0] );
+}
+
+const char *datebook_change_name( int change ) {
+	return( change_names[change] );
+}
+
+// the fields of a record (or instance) that both forms share
+void JsonFormatter::common( const DatebookRecord &r, time_t st, time_t et ) {
+	fprintf( _out, "{\"index\":%ld,\"rid\":%lu,\"start\":\"", r.index, r.rid );
+	iso_time( _out, st, r.allday, _tz );
+	fprintf( _out, "\",\"end\":\"" );
+	iso_time( _out, et, r.allday, _tz );
+	fprintf( _out, "\",\"allday\":%s,\"private\":%s,\"alarm\":%s,\"category\":",
+			r.allday ? "true" : "false", r.pvt ? "true" : "false",
+			r.alarm_set ? "true" : "false" );
+	json_string( _out, categoryName( r.category ) );
+	fprintf( _out, ",\"summary\":" );
+	json_string( _out, r.summary.str );
+	fprintf( _out, ",\"description\":" );
+	json_string( _out, r.description.str );
+	if (_change != UNCHANGED)
+		fprintf( _out, ",\"change\":\"%s\"", change_names[_change] );
+}
+
+bool JsonFormatter::onRecord( const DatebookRecord &r ) {
+	if (!_records)
+		return( true );
+
+	common( r, r.start_time, r.end_time );
+	fprintf( _out, ",\"repeat\":" );
+	if (r.brand == 0)
+		fprintf( _out, "null" );
+	else {
+		fprintf( _out, "{\"type\":\"%s\",\"interval\":%lu,\"until\":\"",
+				brand_names[r.brand <= 6 ? r.brand : 0], r.interval );
+		iso_time( _out, r.enddate, true );
+		fprintf( _out, "\"" );
+		switch( r.brand ) {
+		case 2:
+			fprintf( _out, ",\"days\":%u", r.day_mask );
+			break;
+		case 3:
+			fprintf( _out, ",\"day\":%lu,\"week\":%lu", r.day_x, r.week_x );
+			break;
+		case 4:
+			fprintf( _out, ",\"date\":%lu", r.day_num );
+			break;
+		case 5:
+			fprintf( _out, ",\"date\":%lu,\"month\":%lu", r.day_num, r.mon_x + 1 );
+			break;
+		}
+		fprintf( _out, ",\"exceptions\":[" );
+		for( int i = 0; i < r.num_except; i++ ) {
+			fprintf( _out, "%s\"", i ? "," : "" );
+			iso_time( _out, r.excepts[i], true );
+			fprintf( _out, "\"" );
+		}
+		fprintf( _out, "]}" );
+	}
+	fprintf( _out, "}\n" );
+	return( false );	// (the rule says it all)
+}
+
+void JsonFormatter::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	char uid[64];
+	datebook_uid( uid, sizeof uid, r.rid, st, _source );
+	common( r, st, et );
+	fprintf( _out, ",\"uid\":\"%s\"}\n", uid );
+}
+
+void CsvFormatter::onHeader( const DatebookHeader & ) {
+	fprintf( _out, "index,rid,start,end,allday,private,alarm,category,"
+			"summary,description,change" );
+	if (_records)
+		fprintf( _out, ",repeat,interval,until,exceptions" );
+	fprintf( _out, "\n" );
+}
+
+void CsvFormatter::common( const DatebookRecord &r, time_t st, time_t et ) {
+	fprintf( _out, "%ld,%lu,", r.index, r.rid );
+	iso_time( _out, st, r.allday, _tz );
+	putc( ',', _out );
+	iso_time( _out, et, r.allday, _tz );
+	fprintf( _out, ",%d,%d,%d,", r.allday, r.pvt, r.alarm_set );
+	csv_string( _out, categoryName( r.category ) );
+	putc( ',', _out );
+	csv_string( _out, r.summary.str );
+	putc( ',', _out );
+	csv_string( _out, r.description.str );
+	fprintf( _out, ",%s", change_names[_change] );
+}
+
+bool CsvFormatter::onRecord( const DatebookRecord &r ) {
+	if (!_records)
+		return( true );
+
+	common( r, r.start_time, r.end_time );
+	if (r.brand == 0)
+		fprintf( _out, ",,,,\n" );
+	else {
+		fprintf( _out, ",%s,%lu,", brand_names[r.brand <= 6 ? r.brand : 0],
+				r.interval );
+		iso_time( _out, r.enddate, true );
+		fprintf( _out, ",%u\n", r.num_except );
+	}
+	return( false );
+}
+
+void CsvFormatter::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	common( r, st, et );
+	putc( '\n', _out );
+}
+
+/*
+ * the formats, by name (looked up once, when the formatter is made)
+ */
+static DatebookFormatter *new_summary( FILE *out ) { return( new SummaryFormatter( out ) ); }
+static DatebookFormatter *new_vcal( FILE *out ) { return( new VcalFormatter( out ) ); }
+static DatebookFormatter *new_json( FILE *out ) { return( new JsonFormatter( out, false ) ); }
+static DatebookFormatter *new_json_records( FILE *out ) { return( new JsonFormatter( out, true ) ); }
+static DatebookFormatter *new_csv( FILE *out ) { return( new CsvFormatter( out, false ) ); }
+static DatebookFormatter *new_csv_records( FILE *out ) { return( new CsvFormatter( out, true ) ); }
+static DatebookFormatter *new_arrow( FILE *out ) { return( new ArrowFormatter( out, false ) ); }
+static DatebookFormatter *new_arrow_records( FILE *out ) { return( new ArrowFormatter( out, true ) ); }
+
+static const struct {
+	const char	*name;
+	DatebookFormatter *(*make)( FILE * );
+	const char	*extension;	// (for output files)
+	bool		streams;	// (output can be made in pieces)
+	bool		records;	// (a row per record, not instance)
+} formats[] = {
+	{ "summary",		new_summary,		".txt",		true,	false },
+	{ "vcalendar",		new_vcal,		".ics",		true,	false },
+	{ "ndjson",		new_json,		".ndjson",	true,	false },
+	{ "ndjson-records",	new_json_records,	".ndjson",	true,	true },
+	{ "csv",		new_csv,		".csv",		true,	false },
+	{ "csv-records",	new_csv_records,	".csv",		true,	true },
+	{ "arrow",		new_arrow,		".arrow",	false,	false },
+	{ "arrow-records",	new_arrow_records,	".arrow",	false,	true },
+};
+
+static int find_format( const char *format ) {
+	if (format == 0)
+		return( 0 );
+	for( unsigned i = 0; i < sizeof formats / sizeof formats[0]; i++ )
+		if (strcmp( format, formats[i].name ) == 0)
+			return( i );
+	return( -1 );
+}
+
+bool known_format( const char *format ) {
+	return( find_format( format ) >= 0 );
+}
+
+DatebookFormatter *new_formatter( const char *format, FILE *out ) {
+	int i = find_format( format );
+	return( (*formats[(i < 0) ? 0 : i].make)( out ) );
+}
+
+const char *format_name( const char *format ) {
+	int i = find_format( format );
+	return( formats[(i < 0) ? 0 : i].name );
+}
+
+const char *format_extension( const char *format ) {
+	int i = find_format( format );
+	return( formats[(i < 0) ? 0 : i].extension );
+}
+
+bool format_streams( const char *format ) {
+	int i = find_format( format );
+	return( formats[(i < 0) ? 0 : i].streams );
+}
+
+bool format_records( const char *format ) {
+	int i = find_format( format );
+	return( formats[(i < 0) ? 0 : i].records );
+}
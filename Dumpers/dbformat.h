@@ -0,0 +1,156 @@
+/*
+ * module:	dbformat.h
+ *
+ * purpose:	visitors that turn decoded datebook records
+ *		into our various output formats
+ */
+#ifndef _DBFORMAT_H
+#define _DBFORMAT_H
+
+#include <stdio.h>
+#include "dbdecode.h"
+#include "tzone.h"
+
+// common base for all output formats
+class DatebookFormatter : public DatebookVisitor {
+   public:
+	DatebookFormatter( FILE *out ) {
+		_out = out;
+		_change = UNCHANGED;
+		_categories = 0;
+		_num_categories = 0;
+		_tz = local_zone;
+		_source = 0;
+		_spanned = false;
+		_first = 0;
+		_last = 0;
+	}
+	~DatebookFormatter();
+
+	// (remembered, for the formats that name them)
+	void onCategory( int, const char * );
+
+	// called after the last record has been delivered
+	virtual void finish() {}
+
+	// for incremental output: what happened to the coming instances
+	static const int UNCHANGED = 0;
+	static const int ADDED = 1;
+	static const int CHANGED = 2;
+	static const int DELETED = 3;
+	void setChange( int change )	{ _change = change; }
+
+	// for merged output: which datebook (1, ...) the coming instances
+	// came from, when their UIDs must say so (0 if they need not)
+	void setSource( int source )	{ _source = source; }
+
+	// the zone the times are in (if not the global local_zone)
+	void setZone( TimeZone *tz )	{ _tz = tz; }
+
+	// the (local) times put out so far, for the formats that
+	// need to describe them (returns false if there were none)
+	bool span( time_t *first, time_t *last );
+	void cover( time_t first, time_t last );
+
+   protected:
+	const char *categoryName( unsigned long i );
+
+	FILE	*_out;
+	int	_change;
+	char	**_categories;
+	int	_num_categories;
+	TimeZone *_tz;		// the zone the times are in (or 0, for UTC)
+	int	_source;	// (see setSource)
+	bool	_spanned;
+	time_t	_first;
+	time_t	_last;
+};
+
+// one line summary per instance
+class SummaryFormatter : public DatebookFormatter {
+   public:
+	SummaryFormatter( FILE *out = stdout ) : DatebookFormatter( out ) {
+		_apptnum = -1;
+	}
+
+	bool onRecord( const DatebookRecord & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+
+   private:
+	int	_apptnum;	// appointment number (for the first instance)
+};
+
+// a vcalendar VEVENT per instance (and, with a zone, a VTIMEZONE)
+class VcalFormatter : public DatebookFormatter {
+   public:
+	VcalFormatter( FILE *out = stdout ) : DatebookFormatter( out ) {
+		_started = false;
+	}
+
+	void onHeader( const DatebookHeader & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+	void finish();
+
+   private:
+	bool	_started;	// have we put out the header
+};
+
+// a JSON object per line, for each instance (or each record)
+class JsonFormatter : public DatebookFormatter {
+   public:
+	JsonFormatter( FILE *out, bool records ) : DatebookFormatter( out ) {
+		_records = records;
+	}
+
+	bool onRecord( const DatebookRecord & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+
+   private:
+	void common( const DatebookRecord &, time_t, time_t );
+	bool	_records;	// a line per record (not per instance)
+};
+
+// comma separated values, a row per instance (or per record)
+class CsvFormatter : public DatebookFormatter {
+   public:
+	CsvFormatter( FILE *out, bool records ) : DatebookFormatter( out ) {
+		_records = records;
+	}
+
+	void onHeader( const DatebookHeader & );
+	bool onRecord( const DatebookRecord & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+
+   private:
+	void common( const DatebookRecord &, time_t, time_t );
+	bool	_records;	// a row per record (not per instance)
+};
+
+// a stable unique ID for an instance of a record (of a source datebook)
+void datebook_uid( char *buf, size_t len, unsigned long rid, time_t start,
+		int source = 0 );
+
+// the name of a repetition type (brand), and of a change (ADDED ...)
+const char *datebook_brand_name( unsigned long brand );
+const char *datebook_change_name( int change );
+
+// a new formatter for a named format (default: summary)
+DatebookFormatter *new_formatter( const char *format, FILE *out );
+
+// is this the name of a format (0 is the default)
+bool known_format( const char *format );
+
+// the name of a format (the default's, if it is 0)
+const char *format_name( const char *format );
+
+// the usual file name extension for a format (e.g. ".ics")
+const char *format_extension( const char *format );
+
+// can a format's output be put together from pieces (made separately,
+// as threads do), or does it have to be written all at once
+bool format_streams( const char *format );
+
+// does a format put out records (rather than their instances)
+bool format_records( const char *format );
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * module:	dbfreebusy.cpp
+ *
+ * purpose:	free/busy time: the (timed, non-private) instances
+ *		merged into blocks of busy time
+ *
+ * note:	this is a sort and merge, done a window at a time so
+ *		that only one window's worth of instances is ever in
+ *		memory.  Each window sorts the instances that start in
+ *		it; since later windows only hold later starts, a busy
+ *		block is finished (and put out) as soon as an instance
+ *		starts after it ends.  The block still open at the end
+ *		of a window carries over to the next.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dbfreebusy.h"
+#include "appt.h"
+#include "tzone.h"
+
+extern bool verbose;	// commentary on what we find
+
+static const long DAY = 24 * 60 * 60;
+
+// free/busy times are UTC, and ours are (device) local
+static time_t utc( int64_t t ) {
+	return( local_zone ? local_zone->utc( t ) : t );
+}
+
+// one busy interval
+struct busy {
+	int64_t		start;
+	int64_t		end;
+};
+
+static int by_start( const void *a, const void *b ) {
+	const struct busy *ba = (const struct busy *) a;
+	const struct busy *bb = (const struct busy *) b;
+	if (ba->start != bb->start)
+		return( (ba->start < bb->start) ? -1 : 1 );
+	return( (ba->end < bb->end) ? -1 : (ba->end > bb->end) );
+}
+
+/*
+ * a visitor that collects the busy time that starts in a window
+ */
+class BusyCollector : public DatebookVisitor {
+   public:
+	BusyCollector() {
+		list = 0;
+		num = 0;
+		_max = 0;
+		lo = 0;
+		to = 0;
+	}
+	~BusyCollector() { free( list ); }
+
+	bool onRecord( const DatebookRecord &r ) {
+		if (r.allday || r.pvt)	// these do not show as busy
+			return( false );
+		_span = datebook_span( r );
+		return( true );
+	}
+
+	void onInstance( const DatebookRecord &, time_t st, time_t ) {
+		if (st < lo || st >= to)
+			return;
+		if (num == _max) {
+			_max = _max ? 2 * _max : 256;
+			list = (struct busy *) realloc( list, _max * sizeof (struct busy) );
+		}
+		list[num].start = st;
+		list[num++].end = st + _span;
+	}
+
+	int64_t		lo;	// instances starting in [lo, to)
+	int64_t		to;
+	struct busy	*list;
+	long		num;
+
+   private:
+	long		_max;
+	long		_span;
+};
+
+/*
+ * the output side: busy blocks, clipped to the range, and
+ * (if daily) split at midnight into one VFREEBUSY per day
+ */
+class BusyWriter {
+   public:
+	BusyWriter( FILE *out, int64_t from, int64_t to, bool daily ) {
+		_out = out;
+		_from = from;
+		_to = to;
+		_daily = daily;
+		_day = -1;
+		blocks = 0;
+		if (!daily)
+			print_freebusy_begin( out, utc( from ), utc( to ) );
+	}
+
+	void put( int64_t st, int64_t et ) {
+		if (st < _from)
+			st = _from;
+		if (et > _to)
+			et = _to;
+		while( st < et ) {
+			int64_t e = et;
+			if (_daily) {
+				int64_t day = st - (st % DAY);
+				if (day != _day) {
+					if (_day >= 0)
+						print_freebusy_end( _out );
+					print_freebusy_begin( _out, utc( day ), utc( day + DAY ) );
+					_day = day;
+				}
+				if (e > day + DAY)
+					e = day + DAY;
+			}
+			print_busy( _out, utc( st ), utc( e ) );
+			blocks++;
+			st = e;
+		}
+	}
+
+	void finish() {
+		if (!_daily || _day >= 0)
+			print_freebusy_end( _out );
+	}
+
+	long		blocks;
+
+   private:
+	FILE		*_out;
+	int64_t		_from;
+	int64_t		_to;
+	int64_t		_day;	// the day now being put out
+	bool		_daily;
+};
+
+/*
+ * routine:	find_freebusy
+ *
+ * purpose:	put out the busy time in [from, to) as VFREEBUSY
+ *
+ * returns:	number of busy blocks
+ */
+long find_freebusy( DatebookIndex *index, time_t from, time_t to,
+		bool daily, FILE *out ) {
+
+	DatebookTable *t = index->table();
+	if (to <= from) {
+		// the span of the whole calendar
+		if (t->rows() == 0)
+			return( 0 );
+		from = t->start[0];
+		to = t->last[0];
+		for( long i = 1; i < t->rows(); i++ ) {
+			if (t->start[i] < from)
+				from = t->start[i];
+			if (t->last[i] > to)
+				to = t->last[i];
+		}
+		if (daily)
+			from -= from % DAY;
+	}
+
+	uint32_t *rows = (uint32_t *) malloc( (t->rows() + 1) * sizeof (uint32_t) );
+	BusyCollector c;
+	BusyWriter w( out, from, to, daily );
+	bool open = false;	// the block being built
+	int64_t bs = 0, be = 0;
+	long most = 0;
+
+	for( int64_t win = from; win < to; win += FREEBUSY_WINDOW ) {
+		// expand (just) the instances that start in this window
+		// (and, for the first, those already under way)
+		c.num = 0;
+		c.lo = (win == from) ? INT64_MIN : win;
+		c.to = win + FREEBUSY_WINDOW;
+		time_t wto = (c.to < to) ? c.to : to;
+		long n = index->overlap( win, wto, rows );
+		DatebookRecord r;
+		for( long i = 0; i < n; i++ ) {
+			t->record( rows[i], r );
+			if (c.onRecord( r ))
+				expand_datebook_range( r, win, wto, &c );
+		}
+		qsort( c.list, c.num, sizeof (struct busy), by_start );
+		if (c.num > most)
+			most = c.num;
+
+		// and merge them into blocks
+		for( long i = 0; i < c.num; i++ ) {
+			if (open && c.list[i].start <= be) {
+				if (c.list[i].end > be)
+					be = c.list[i].end;
+				continue;
+			}
+			if (open)
+				w.put( bs, be );
+			bs = c.list[i].start;
+			be = c.list[i].end;
+			open = true;
+		}
+	}
+	if (open)
+		w.put( bs, be );
+	w.finish();
+
+	if (verbose)
+		fprintf( stderr, "%ld busy blocks (at most %ld instances in a window)\n",
+				w.blocks, most );
+
+	free( rows );
+	return( w.blocks );
+}
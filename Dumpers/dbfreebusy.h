@@ -0,0 +1,21 @@
+/*
+ * module:	dbfreebusy.h
+ *
+ * purpose:	free/busy time: the (timed, non-private) instances
+ *		merged into blocks of busy time
+ */
+#ifndef _DBFREEBUSY_H
+#define _DBFREEBUSY_H
+
+#include <stdio.h>
+#include "dbindex.h"
+
+// how much of the calendar is expanded at a time (seconds)
+static const long FREEBUSY_WINDOW = 31 * 24 * 60 * 60;
+
+// put out the busy blocks in [from, to) (the whole calendar if
+// to <= from) as a VFREEBUSY, or one per day (returns # blocks)
+long find_freebusy( DatebookIndex *index, time_t from, time_t to,
+		bool daily, FILE *out );
+
+#endif
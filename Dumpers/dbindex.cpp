@@ -0,0 +1,171 @@
+/*
+ * module:	dbindex.cpp
+ *
+ * purpose:	an interval index over the records of a DatebookTable
+ *
+ * note:	the layout of the implied tree (after Heng Li's cgranges):
+ *		position i is a leaf if it is even; a node at level k
+ *		has its lowest k bits set, and its children at i - 2^(k-1)
+ *		and i + 2^(k-1).  Positions off the end of the array are
+ *		imaginary nodes, whose subtrees have to be visited.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbindex.h"
+
+// a sort key for building the index
+struct index_key {
+	int64_t		start;
+	uint32_t	row;
+};
+
+static int by_start( const void *a, const void *b ) {
+	const struct index_key *ka = (const struct index_key *) a;
+	const struct index_key *kb = (const struct index_key *) b;
+	if (ka->start != kb->start)
+		return( (ka->start < kb->start) ? -1 : 1 );
+	return( (ka->row < kb->row) ? -1 : (ka->row > kb->row) );
+}
+
+DatebookIndex::DatebookIndex( DatebookTable *table ) {
+	_table = table;
+	_n = table->rows();
+	long n = (_n > 0) ? _n : 1;
+	_start = (int64_t *) malloc( n * sizeof (int64_t) );
+	_last = (int64_t *) malloc( n * sizeof (int64_t) );
+	_max = (int64_t *) malloc( n * sizeof (int64_t) );
+	_row = (uint32_t *) malloc( n * sizeof (uint32_t) );
+	_hits = (uint32_t *) malloc( n * sizeof (uint32_t) );
+
+	// sort the rows by start time
+	struct index_key *keys = (struct index_key *) malloc( n * sizeof *keys );
+	for( long i = 0; i < _n; i++ ) {
+		keys[i].start = table->start[i];
+		keys[i].row = i;
+	}
+	qsort( keys, _n, sizeof *keys, by_start );
+	for( long i = 0; i < _n; i++ ) {
+		_row[i] = keys[i].row;
+		_start[i] = keys[i].start;
+		_last[i] = table->last[keys[i].row];
+	}
+	free( keys );
+
+	// leaves are their own maxima
+	_levels = 0;
+	if (_n == 0)
+		return;
+	long last_i = 0;
+	int64_t last_max = 0;
+	for( long i = 0; i < _n; i += 2 ) {
+		last_i = i;
+		last_max = _max[i] = _last[i];
+	}
+
+	// each node is the larger of itself and its two subtrees
+	int k;
+	for( k = 1; (1L << k) <= _n; k++ ) {
+		long x = 1L << (k - 1);
+		for( long i = (x << 1) - 1; i < _n; i += x << 2 ) {
+			int64_t e = _last[i];
+			int64_t el = _max[i - x];
+			int64_t er = (i + x < _n) ? _max[i + x] : last_max;
+			if (el > e)
+				e = el;
+			if (er > e)
+				e = er;
+			_max[i] = e;
+		}
+		// the rightmost node at this level (may be imaginary)
+		last_i = ((last_i >> k) & 1) ? last_i - x : last_i + x;
+		if (last_i < _n && _max[last_i] > last_max)
+			last_max = _max[last_i];
+	}
+	_levels = k - 1;
+}
+
+DatebookIndex::~DatebookIndex() {
+	free( _start );
+	free( _last );
+	free( _max );
+	free( _row );
+	free( _hits );
+}
+
+/*
+ * routine:	overlap
+ *
+ * purpose:	find the rows whose interval overlaps [from, to)
+ *
+ * returns:	number of rows found (in start order)
+ */
+long DatebookIndex::overlap( time_t from, time_t to, uint32_t *rows ) {
+	struct frame {
+		long	x;	// position of this node
+		int	k;	// its level
+		bool	left_done;
+	} stack[64];
+	int t = 0;
+	long found = 0;
+
+	if (_n == 0)
+		return( 0 );
+
+	stack[t].x = (1L << _levels) - 1;
+	stack[t].k = _levels;
+	stack[t++].left_done = false;
+	while( t > 0 ) {
+		struct frame z = stack[--t];
+		if (z.k <= 3) {
+			// small subtrees are faster to just scan
+			long i0 = (z.x >> z.k) << z.k;
+			long i1 = i0 + (1L << (z.k + 1)) - 1;
+			if (i1 > _n)
+				i1 = _n;
+			for( long i = i0; i < i1 && _start[i] < to; i++ )
+				if (from < _last[i])
+					rows[found++] = _row[i];
+		} else if (!z.left_done) {
+			// come back to this node after the left subtree
+			long y = z.x - (1L << (z.k - 1));
+			stack[t].x = z.x;
+			stack[t].k = z.k;
+			stack[t++].left_done = true;
+			if (y >= _n || _max[y] > from) {
+				stack[t].x = y;
+				stack[t].k = z.k - 1;
+				stack[t++].left_done = false;
+			}
+		} else if (z.x < _n && _start[z.x] < to) {
+			// this node, and then the right subtree
+			if (from < _last[z.x])
+				rows[found++] = _row[z.x];
+			stack[t].x = z.x + (1L << (z.k - 1));
+			stack[t].k = z.k - 1;
+			stack[t++].left_done = false;
+		}
+	}
+
+	return( found );
+}
+
+/*
+ * routine:	query
+ *
+ * purpose:	deliver each instance that overlaps [from, to) to a
+ *		visitor, record by record (in record start order)
+ *
+ * returns:	number of instances delivered
+ */
+long DatebookIndex::query( time_t from, time_t to, DatebookVisitor *v ) {
+	long n = overlap( from, to, _hits );
+	long count = 0;
+	DatebookRecord r;
+	for( long i = 0; i < n; i++ ) {
+		_table->record( _hits[i], r );
+		if (v->onRecord( r ))
+			count += expand_datebook_range( r, from, to, v );
+	}
+	return( count );
+}
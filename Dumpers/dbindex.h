@@ -0,0 +1,48 @@
+/*
+ * module:	dbindex.h
+ *
+ * purpose:	an interval index over the records of a DatebookTable,
+ *		for answering "what is on the calendar between X and Y"
+ *
+ * note:	each record is indexed by the interval from its start
+ *		to the end of its last possible repetition, so a query
+ *		finds the k candidate records in O(log n + k) and only
+ *		they are expanded, and only within the query range.
+ *
+ *		The index is an implicit (array based) interval tree:
+ *		the records are sorted by start time, and each node of
+ *		the implied binary tree (the odd numbered positions) is
+ *		augmented with the largest end time in its subtree.
+ */
+#ifndef _DBINDEX_H
+#define _DBINDEX_H
+
+#include <stdint.h>
+#include "dbtable.h"
+
+class DatebookIndex {
+   public:
+	DatebookIndex( DatebookTable *table );
+	~DatebookIndex();
+
+	// rows that might have an instance overlapping [from, to)
+	// (rows must have room for table->rows(), returns count)
+	long overlap( time_t from, time_t to, uint32_t *rows );
+
+	// deliver every instance that overlaps [from, to)
+	long query( time_t from, time_t to, DatebookVisitor * );
+
+	DatebookTable *table()	{ return( _table ); }
+
+   private:
+	DatebookTable	*_table;
+	long		_n;
+	int		_levels;	// height of the implied tree
+	int64_t		*_start;	// sorted by start
+	int64_t		*_last;
+	int64_t		*_max;		// largest _last in each subtree
+	uint32_t	*_row;		// table row for each position
+	uint32_t	*_hits;		// query result buffer
+};
+
+#endif
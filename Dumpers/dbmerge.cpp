@@ -0,0 +1,388 @@
+/*
+ * module:	dbmerge.cpp
+ *
+ * purpose:	merge several datebooks into one calendar, in start
+ *		time order, with the duplicates dropped
+ *
+ * note:	each datebook is turned into a stream of instances in
+ *		start order (a window at a time, through its interval
+ *		index), and the streams are merged with a heap keyed
+ *		on their next instance.  So the instances in memory
+ *		are one window per datebook, however long the
+ *		calendars run.
+ *
+ *		Two instances are the same if they have the same start,
+ *		end, summary and description; since duplicates start
+ *		at the same time, we need only remember what we have
+ *		put out at the current start time.  The tables share
+ *		a StringPool, so the strings compare by pointer.
+ *
+ *		Each datebook numbers its categories its own way, so
+ *		they are mapped into one table (the first datebook's,
+ *		plus whatever names the others add).  Instances that
+ *		differ, but would have the same UID (the same record
+ *		ID, on the same day, in different datebooks), have
+ *		their source added to the UID.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbmerge.h"
+
+extern bool verbose;	// commentary on what we find
+
+static const long DAY = 24 * 60 * 60;
+
+// one instance, as far as the merge is concerned
+struct sorted_inst {
+	int64_t		start;
+	int64_t		end;
+	uint32_t	row;
+};
+
+static int by_start( const void *a, const void *b ) {
+	const struct sorted_inst *ia = (const struct sorted_inst *) a;
+	const struct sorted_inst *ib = (const struct sorted_inst *) b;
+	if (ia->start != ib->start)
+		return( (ia->start < ib->start) ? -1 : 1 );
+	return( (ia->row < ib->row) ? -1 : (ia->row > ib->row) );
+}
+
+/*
+ * a visitor that collects the instances that start in a window
+ */
+class StreamCollector : public DatebookVisitor {
+   public:
+	StreamCollector( struct sorted_inst **list, long *num, long *max ) {
+		_list = list;
+		_num = num;
+		_max = max;
+		_row = 0;
+		from = 0;
+		to = 0;
+	}
+
+	void onInstance( const DatebookRecord &, time_t st, time_t et ) {
+		if (st < from || st >= to)
+			return;
+		if (*_num == *_max) {
+			*_max = *_max ? 2 * *_max : 256;
+			*_list = (struct sorted_inst *) realloc( *_list,
+					*_max * sizeof (struct sorted_inst) );
+		}
+		struct sorted_inst *p = &(*_list)[(*_num)++];
+		p->start = st;
+		p->end = et;
+		p->row = _row;
+	}
+
+	// which table row the coming record came from
+	void setRow( uint32_t row )	{ _row = row; }
+
+	time_t	from;
+	time_t	to;
+
+   private:
+	struct sorted_inst **_list;
+	long		*_num;
+	long		*_max;
+	uint32_t	_row;
+};
+
+DatebookStream::DatebookStream( DatebookTable *t ) : _index( t ) {
+	_window = 0;
+	_end = 0;
+	_list = 0;
+	_num = 0;
+	_max = 0;
+	_pos = 0;
+	_rows = (uint32_t *) malloc( (t->rows() + 1) * sizeof (uint32_t) );
+
+	// the span of the whole calendar
+	if (t->rows() > 0) {
+		_window = t->start[0];
+		_end = t->last[0];
+		for( long i = 1; i < t->rows(); i++ ) {
+			if (t->start[i] < _window)
+				_window = t->start[i];
+			if (t->last[i] > _end)
+				_end = t->last[i];
+		}
+	}
+}
+
+DatebookStream::~DatebookStream() {
+	free( _rows );
+	free( _list );
+}
+
+/*
+ * routine:	fill
+ *
+ * purpose:	expand windows until we have some instances (or
+ *		have run off the end of the calendar)
+ */
+bool DatebookStream::fill() {
+	DatebookTable *t = _index.table();
+	StreamCollector c( &_list, &_num, &_max );
+	_num = 0;
+	_pos = 0;
+	while( _num == 0 && _window < _end ) {
+		c.from = _window;
+		c.to = _window + MERGE_WINDOW;
+		long n = _index.overlap( c.from, c.to, _rows );
+		DatebookRecord r;
+		for( long i = 0; i < n; i++ ) {
+			t->record( _rows[i], r );
+			c.setRow( _rows[i] );
+			expand_datebook_range( r, c.from, c.to, &c );
+		}
+		_window += MERGE_WINDOW;
+	}
+	qsort( _list, _num, sizeof (struct sorted_inst), by_start );
+	return( _num > 0 );
+}
+
+bool DatebookStream::next( time_t *st, time_t *et, uint32_t *row ) {
+	if (_pos == _num && !fill())
+		return( false );
+	*st = _list[_pos].start;
+	*et = _list[_pos].end;
+	*row = _list[_pos++].row;
+	return( true );
+}
+
+// the head of each stream, as kept in the heap
+struct merge_head {
+	time_t		start;
+	time_t		end;
+	uint32_t	row;
+	int		stream;
+};
+
+static bool before( const struct merge_head *a, const struct merge_head *b ) {
+	if (a->start != b->start)
+		return( a->start < b->start );
+	return( a->stream < b->stream );
+}
+
+static void sift_down( struct merge_head *heap, int n, int i ) {
+	for( ;; ) {
+		int least = i;
+		int l = 2 * i + 1;
+		int r = l + 1;
+		if (l < n && before( &heap[l], &heap[least] ))
+			least = l;
+		if (r < n && before( &heap[r], &heap[least] ))
+			least = r;
+		if (least == i)
+			return;
+		struct merge_head tmp = heap[i];
+		heap[i] = heap[least];
+		heap[least] = tmp;
+		i = least;
+	}
+}
+
+// what makes two instances (with the same start) the same
+struct merge_seen {
+	time_t		end;
+	const char	*summary;	// (interned)
+	const char	*description;
+};
+
+/*
+ * routine:	merge_categories
+ *
+ * purpose:	give the formatter one category table for all the
+ *		datebooks, and map each datebook's indices into it
+ *
+ * returns:	a malloc'd map per stream (caller frees)
+ */
+static unsigned long **merge_categories( DatebookStream **streams, int n,
+		DatebookFormatter *f ) {
+	unsigned long **map = (unsigned long **) malloc( n * sizeof (unsigned long *) );
+	const char **names = 0;
+	int num_names = 0;
+	for( int i = 0; i < n; i++ ) {
+		DatebookTable *t = streams[i]->table();
+		map[i] = (unsigned long *) malloc( (t->categories() + 1) * sizeof (unsigned long) );
+		for( int c = 0; c < t->categories(); c++ ) {
+			const char *name = t->category( c );
+			int j = (i == 0) ? num_names : 0;	// (the first is as it is)
+			while( j < num_names && (name == 0 || names[j] != name) )
+				j++;
+			if (j == num_names) {
+				names = (const char **) realloc( names,
+						(num_names + 1) * sizeof (const char *) );
+				names[num_names++] = name;
+				f->onCategory( j, name );
+			}
+			map[i][c] = j;
+		}
+	}
+	free( names );
+	return( map );
+}
+
+// which datebook first put out a UID (a record ID, on a day)
+struct merge_uid {
+	uint32_t	rid;
+	int32_t		day;
+	int		stream;		// (-1 if the slot is empty)
+};
+
+struct uid_table {
+	struct merge_uid *slots;
+	size_t		num;
+	size_t		max;		// (a power of two)
+};
+
+static size_t uid_hash( uint32_t rid, int32_t day ) {
+	uint64_t h = ((uint64_t) rid << 32 | (uint32_t) day) * 0x9e3779b97f4a7c15ULL;
+	return( h >> 17 );
+}
+
+/*
+ * routine:	uid_source
+ *
+ * purpose:	remember which stream put out a UID first
+ *
+ * returns:	the stream that did (this one, if it is new)
+ */
+static int uid_source( struct uid_table *u, uint32_t rid, int32_t day, int stream ) {
+	if (2 * (u->num + 1) > u->max) {
+		struct uid_table bigger;
+		bigger.max = u->max ? 2 * u->max : 1024;
+		bigger.num = 0;
+		bigger.slots = (struct merge_uid *) malloc( bigger.max * sizeof (struct merge_uid) );
+		for( size_t i = 0; i < bigger.max; i++ )
+			bigger.slots[i].stream = -1;
+		for( size_t i = 0; i < u->max; i++ )
+			if (u->slots[i].stream >= 0)
+				uid_source( &bigger, u->slots[i].rid, u->slots[i].day,
+						u->slots[i].stream );
+		free( u->slots );
+		*u = bigger;
+	}
+	size_t mask = u->max - 1;
+	for( size_t i = uid_hash( rid, day ) & mask; ; i = (i + 1) & mask ) {
+		struct merge_uid *p = &u->slots[i];
+		if (p->stream < 0) {
+			p->rid = rid;
+			p->day = day;
+			p->stream = stream;
+			u->num++;
+			return( stream );
+		}
+		if (p->rid == rid && p->day == day)
+			return( p->stream );
+	}
+}
+
+/*
+ * routine:	uid_forget
+ *
+ * purpose:	empty the table when the merge moves on to another day
+ *		(a UID is per day, so nothing in it can come up again)
+ */
+static void uid_forget( struct uid_table *u ) {
+	for( size_t i = 0; i < u->max; i++ )
+		u->slots[i].stream = -1;
+	u->num = 0;
+}
+
+/*
+ * routine:	merge_datebooks
+ *
+ * purpose:	deliver the instances of all the streams, in start
+ *		time order, each distinct instance only once
+ *
+ * returns:	number of instances delivered
+ */
+long merge_datebooks( DatebookStream **streams, int n, DatebookFormatter *f ) {
+
+	struct merge_head *heap = (struct merge_head *)
+			malloc( (n + 1) * sizeof (struct merge_head) );
+	int live = 0;
+	for( int i = 0; i < n; i++ ) {
+		struct merge_head *h = &heap[live];
+		if (streams[i]->next( &h->start, &h->end, &h->row )) {
+			h->stream = i;
+			live++;
+		}
+	}
+	for( int i = live / 2 - 1; i >= 0; i-- )
+		sift_down( heap, live, i );
+	unsigned long **categories = merge_categories( streams, n, f );
+	struct uid_table uids = { 0, 0, 0 };
+	time_t uids_on = 0;
+
+	// what we have put out at the current start time
+	struct merge_seen *seen = 0;
+	long num_seen = 0;
+	long max_seen = 0;
+	time_t seen_at = 0;
+
+	long delivered = 0;
+	long dups = 0;
+	DatebookRecord r;
+	while( live > 0 ) {
+		struct merge_head *h = &heap[0];
+		DatebookStream *s = streams[h->stream];
+		DatebookTable *t = s->table();
+		const char *sum = t->summary[h->row];
+		const char *desc = t->description[h->row];
+
+		if (num_seen > 0 && h->start != seen_at)
+			num_seen = 0;
+		seen_at = h->start;
+		bool dup = false;
+		for( long i = 0; i < num_seen && !dup; i++ )
+			dup = (seen[i].end == h->end && seen[i].summary == sum &&
+					seen[i].description == desc);
+		if (dup)
+			dups++;
+		else {
+			if (num_seen == max_seen) {
+				max_seen = max_seen ? 2 * max_seen : 16;
+				seen = (struct merge_seen *) realloc( seen,
+						max_seen * sizeof (struct merge_seen) );
+			}
+			seen[num_seen].end = h->end;
+			seen[num_seen].summary = sum;
+			seen[num_seen++].description = desc;
+			t->record( h->row, r );
+			r.category = (r.category < (unsigned long) t->categories()) ?
+					categories[h->stream][r.category] : ~0UL;
+			time_t day = (h->start >= 0) ? h->start / DAY :
+					(h->start - DAY + 1) / DAY;
+			if (uids.num > 0 && day != uids_on)
+				uid_forget( &uids );
+			uids_on = day;
+			int first = uid_source( &uids, r.rid, day, h->stream );
+			f->setSource( (first == h->stream) ? 0 : h->stream + 1 );
+			f->onInstance( r, h->start, h->end );
+			delivered++;
+		}
+
+		// on to the next from that stream
+		if (!s->next( &h->start, &h->end, &h->row ))
+			heap[0] = heap[--live];
+		sift_down( heap, live, 0 );
+	}
+
+	if (verbose)
+		fprintf( stderr, "merged %d datebooks: %ld instances, %ld duplicates dropped\n",
+				n, delivered, dups );
+
+	f->setSource( 0 );
+	for( int i = 0; i < n; i++ )
+		free( categories[i] );
+	free( categories );
+	free( uids.slots );
+	free( seen );
+	free( heap );
+	return( delivered );
+}
@@ -0,0 +1,46 @@
+/*
+ * module:	dbmerge.h
+ *
+ * purpose:	merge several datebooks into one calendar, in start
+ *		time order, with the duplicates (the same appointment,
+ *		in more than one of the backups) dropped
+ */
+#ifndef _DBMERGE_H
+#define _DBMERGE_H
+
+#include "dbindex.h"
+#include "dbformat.h"
+
+// how much of a calendar is expanded at a time (seconds)
+static const long MERGE_WINDOW = 31 * 24 * 60 * 60;
+
+// one datebook's instances, in start time order
+struct sorted_inst;
+class DatebookStream {
+   public:
+	DatebookStream( DatebookTable *table );
+	~DatebookStream();
+
+	// the next instance (false at the end)
+	bool next( time_t *st, time_t *et, uint32_t *row );
+
+	DatebookTable *table()	{ return( _index.table() ); }
+
+   private:
+	bool fill();
+
+	DatebookIndex	_index;
+	int64_t		_window;	// the next window to expand
+	int64_t		_end;		// end of the calendar
+	uint32_t	*_rows;		// index query results
+	struct sorted_inst *_list;	// the current window, sorted
+	long		_num;
+	long		_max;
+	long		_pos;
+};
+
+// merge the streams, deliver the instances (returns # delivered)
+// (the streams' tables must share a StringPool)
+long merge_datebooks( DatebookStream **streams, int n, DatebookFormatter * );
+
+#endif
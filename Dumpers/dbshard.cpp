@@ -0,0 +1,313 @@
+/*
+ * module:	dbshard.cpp
+ *
+ * purpose:	sharded output, with a writer thread per shard
+ *
+ * note:	a shard's formatter writes to a stdio stream of our own
+ *		(fopencookie), which copies into the buffer being filled.
+ *		When that fills, it goes to the writer thread and the
+ *		formatter carries on with the other one, waiting only
+ *		if the writer has not yet finished with it.
+ */
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include "dbshard.h"
+
+struct shard {
+	char		*key;
+	char		*path;		// (written as path.tmp, then renamed)
+	char		*tmp;
+	FILE		*file;		// the real file
+	FILE		*out;		// the formatter's stream
+	DatebookFormatter *f;
+	long		record_seq;	// the last record it was told about
+	bool		wanted;		// (and whether it wanted the instances)
+
+	// the buffers, and the writer
+	char		*buf[2];
+	size_t		len[2];
+	bool		full[2];	// handed to the writer
+	int		fill;		// the one being filled
+	bool		done;
+	bool		failed;
+	bool		closed;		// (finished, and renamed into place)
+	pthread_t	writer;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+};
+
+// the writer: put out each buffer (in turn) as it fills
+static void *shard_writer( void *arg ) {
+	struct shard *s = (struct shard *) arg;
+	int k = 0;
+	pthread_mutex_lock( &s->lock );
+	for( ;; ) {
+		while( !s->full[k] && !s->done )
+			pthread_cond_wait( &s->cond, &s->lock );
+		if (!s->full[k])
+			break;
+		pthread_mutex_unlock( &s->lock );
+		if (fwrite( s->buf[k], 1, s->len[k], s->file ) != s->len[k])
+			s->failed = true;
+		pthread_mutex_lock( &s->lock );
+		s->len[k] = 0;
+		s->full[k] = false;
+		pthread_cond_broadcast( &s->cond );
+		k ^= 1;
+	}
+	pthread_mutex_unlock( &s->lock );
+	return( 0 );
+}
+
+// hand the buffer being filled to the writer, and take the other
+static void hand_off( struct shard *s ) {
+	pthread_mutex_lock( &s->lock );
+	s->full[s->fill] = true;
+	pthread_cond_broadcast( &s->cond );
+	s->fill ^= 1;
+	while( s->full[s->fill] )
+		pthread_cond_wait( &s->cond, &s->lock );
+	pthread_mutex_unlock( &s->lock );
+}
+
+static ssize_t shard_write( void *cookie, const char *data, size_t len ) {
+	struct shard *s = (struct shard *) cookie;
+	size_t done = 0;
+	while( done < len ) {
+		size_t n = SHARD_BUFFER - s->len[s->fill];
+		if (n > len - done)
+			n = len - done;
+		memcpy( s->buf[s->fill] + s->len[s->fill], data + done, n );
+		s->len[s->fill] += n;
+		done += n;
+		if (s->len[s->fill] == SHARD_BUFFER)
+			hand_off( s );
+	}
+	return( len );
+}
+
+/*
+ * routine:	shard_close
+ *
+ * purpose:	finish a shard: flush its stream, let the writer put
+ *		out what is left, and rename the file into place
+ *
+ * returns:	bool (success/failure)
+ */
+static bool shard_close( struct shard *s ) {
+	s->f->finish();
+	fclose( s->out );
+
+	pthread_mutex_lock( &s->lock );
+	if (s->len[s->fill] > 0)
+		s->full[s->fill] = true;
+	s->done = true;
+	pthread_cond_broadcast( &s->cond );
+	pthread_mutex_unlock( &s->lock );
+	pthread_join( s->writer, 0 );
+
+	bool ok = !s->failed;
+	if (fclose( s->file ) != 0)
+		ok = false;
+	if (ok && rename( s->tmp, s->path ) != 0)
+		ok = false;
+	if (!ok) {
+		perror( s->path );
+		remove( s->tmp );
+	}
+	return( ok );
+}
+
+DatebookSharder::DatebookSharder( const char *format, const char *prefix, int by,
+		int pieces, long total ) {
+	_format = format;
+	_prefix = strdup( prefix );
+	_by = by;
+	_pieces = (pieces > 0) ? pieces : 1;
+	_total = total;
+	_seen = 0;
+	memset( &_header, 0, sizeof _header );
+	_categories = 0;
+	_num_categories = 0;
+	_record_seq = 0;
+	_shards = 0;
+	_num_shards = 0;
+	_last = 0;
+	_failed = false;
+
+	// the strings we need are the ones the format needs
+	DatebookFormatter *f = new_formatter( format, 0 );
+	_fields = f->fields();
+	delete f;
+}
+
+DatebookSharder::~DatebookSharder() {
+	for( int i = 0; i < _num_shards; i++ ) {
+		struct shard *s = _shards[i];
+		free( s->key );
+		free( s->path );
+		free( s->tmp );
+		free( s->buf[0] );
+		free( s->buf[1] );
+		pthread_mutex_destroy( &s->lock );
+		pthread_cond_destroy( &s->cond );
+		free( s );
+	}
+	free( _shards );
+	for( int i = 0; i < _num_categories; i++ )
+		free( _categories[i] );
+	free( _categories );
+	free( _prefix );
+}
+
+void DatebookSharder::onHeader( const DatebookHeader &h ) {
+	_header = h;
+}
+
+void DatebookSharder::onCategory( int i, const char *name ) {
+	if (i < 0)
+		return;
+	if (i >= _num_categories) {
+		_categories = (char **) realloc( _categories, (i + 1) * sizeof (char *) );
+		while( _num_categories <= i )
+			_categories[_num_categories++] = 0;
+	}
+	free( _categories[i] );
+	_categories[i] = name ? strdup( name ) : 0;
+}
+
+bool DatebookSharder::onRecord( const DatebookRecord & ) {
+	_record_seq++;
+	return( true );		// (we need the instances, to place them)
+}
+
+/*
+ * routine:	find
+ *
+ * purpose:	find the shard for a key, starting it if need be
+ *
+ * returns:	the shard (or 0, if it could not be started)
+ */
+struct shard *DatebookSharder::find( const char *key ) {
+	if (_last && strcmp( _last->key, key ) == 0)
+		return( _last );
+	for( int i = 0; i < _num_shards; i++ )
+		if (strcmp( _shards[i]->key, key ) == 0)
+			return( _last = _shards[i] );
+
+	// (the last piece will get no more instances)
+	if (_by == SHARD_COUNT && _last)
+		close( _last );
+
+	struct shard *s = (struct shard *) calloc( 1, sizeof (struct shard) );
+	s->key = strdup( key );
+	size_t len = strlen( _prefix ) + strlen( key ) + strlen( format_extension( _format ) ) + 2;
+	s->path = (char *) malloc( len );
+	snprintf( s->path, len, "%s-%s%s", _prefix, key, format_extension( _format ) );
+	s->tmp = (char *) malloc( len + 4 );
+	snprintf( s->tmp, len + 4, "%s.tmp", s->path );
+	s->file = fopen( s->tmp, "w" );
+	if (s->file == 0) {
+		perror( s->tmp );
+		free( s->key );
+		free( s->path );
+		free( s->tmp );
+		free( s );
+		_failed = true;
+		return( 0 );
+	}
+
+	s->buf[0] = (char *) malloc( SHARD_BUFFER );
+	s->buf[1] = (char *) malloc( SHARD_BUFFER );
+	pthread_mutex_init( &s->lock, 0 );
+	pthread_cond_init( &s->cond, 0 );
+	pthread_create( &s->writer, 0, shard_writer, s );
+	cookie_io_functions_t io = { 0, shard_write, 0, 0 };
+	s->out = fopencookie( s, "w", io );
+	s->f = new_formatter( _format, s->out );
+
+	// each shard is a calendar of its own
+	s->f->onHeader( _header );
+	for( int i = 0; i < _num_categories; i++ )
+		s->f->onCategory( i, _categories[i] );
+
+	_shards = (struct shard **) realloc( _shards, (_num_shards + 1) * sizeof (struct shard *) );
+	_shards[_num_shards++] = s;
+	return( _last = s );
+}
+
+// finish a shard (that will get no more instances)
+void DatebookSharder::close( struct shard *s ) {
+	if (s->closed)
+		return;
+	if (!shard_close( s ))
+		_failed = true;
+	delete s->f;
+	s->f = 0;
+	s->closed = true;
+}
+
+void DatebookSharder::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	if (_failed)
+		return;		// (finish() will clear up)
+
+	char key[64];
+	if (_by == SHARD_YEAR) {
+		struct tm tm;
+		gmtime_r( &st, &tm );
+		snprintf( key, sizeof key, "%04d", tm.tm_year + 1900 );
+	} else if (_by == SHARD_CATEGORY) {
+		const char *name = (r.category < (unsigned long) _num_categories &&
+				_categories[r.category]) ? _categories[r.category] : "NONE";
+		// (something that will do as part of a file name)
+		snprintf( key, sizeof key, "%s", name );
+		for( char *p = key; *p; p++ )
+			if (!isalnum( (unsigned char) *p ) && *p != '-' && *p != '_')
+				*p = '_';
+	} else {
+		long piece = (_total > 0) ? _seen * _pieces / _total : 0;
+		if (piece >= _pieces)
+			piece = _pieces - 1;
+		int width = snprintf( 0, 0, "%d", _pieces );
+		snprintf( key, sizeof key, "%0*ld", width, piece + 1 );
+	}
+	_seen++;
+
+	struct shard *s = find( key );
+	if (s == 0)
+		return;
+	if (s->record_seq != _record_seq) {
+		s->record_seq = _record_seq;
+		s->wanted = s->f->onRecord( r );
+	}
+	if (s->wanted)
+		s->f->onInstance( r, st, et );
+}
+
+/*
+ * routine:	finish
+ *
+ * purpose:	finish every shard, or (if any of them failed, or could
+ *		not be started) remove them all, rather than leave a
+ *		calendar with some of its instances missing
+ */
+int DatebookSharder::finish() {
+	for( int i = 0; i < _num_shards; i++ )
+		close( _shards[i] );
+	if (!_failed)
+		return( _num_shards );
+
+	for( int i = 0; i < _num_shards; i++ )
+		remove( _shards[i]->path );
+	return( -1 );
+}
+
+const char *DatebookSharder::shardName( int i ) {
+	return( (i >= 0 && i < _num_shards) ? _shards[i]->path : 0 );
+}
@@ -0,0 +1,80 @@
+/*
+ * module:	dbshard.h
+ *
+ * purpose:	split a datebook's output into several files (shards),
+ *		by year, by category, or into pieces of about equal size
+ *
+ * note:	each shard has its own formatter, so each file is a
+ *		complete calendar (with its own header and trailer).
+ *		A formatter writes into its shard's own pair of buffers,
+ *		and each shard has a writer thread that puts the full
+ *		ones out to its file, so the formatting (in the decoding
+ *		thread) and the writing of every shard go on at once.
+ *
+ *		The pieces of SHARD_COUNT follow the instances in turn,
+ *		so each is finished as the next one starts (and only
+ *		one is ever open).  If any shard fails, they all go.
+ */
+#ifndef _DBSHARD_H
+#define _DBSHARD_H
+
+#include <stdio.h>
+#include "dbformat.h"
+
+// how the instances are divided
+static const int SHARD_YEAR = 1;
+static const int SHARD_CATEGORY = 2;
+static const int SHARD_COUNT = 3;	// (into a given number of pieces)
+
+// the most pieces we will divide into
+static const int SHARD_MAX_PIECES = 10000;
+
+// each of a shard's buffers
+static const size_t SHARD_BUFFER = 64 * 1024;
+
+struct shard;
+
+class DatebookSharder : public DatebookVisitor {
+   public:
+	// shards are named prefix-key.ext (for SHARD_COUNT, we need
+	// to know the total number of instances in advance)
+	DatebookSharder( const char *format, const char *prefix, int by,
+			int pieces = 0, long total = 0 );
+	~DatebookSharder();
+
+	void onHeader( const DatebookHeader & );
+	void onCategory( int, const char * );
+	bool onRecord( const DatebookRecord & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+	unsigned fields()	{ return( _fields ); }
+
+	// finish every shard (returns # of shards, or -1 on failure)
+	int finish();
+
+	// the file name of a (finished) shard
+	const char *shardName( int i );
+
+   private:
+	struct shard *find( const char *key );
+	void close( struct shard * );
+
+	const char	*_format;
+	char		*_prefix;
+	int		_by;
+	int		_pieces;
+	long		_total;
+	long		_seen;		// instances so far
+	unsigned	_fields;
+
+	DatebookHeader	_header;	// (replayed to each new shard)
+	char		**_categories;
+	int		_num_categories;
+	long		_record_seq;	// (counts the records)
+
+	struct shard	**_shards;
+	int		_num_shards;
+	struct shard	*_last;		// (the one used last)
+	bool		_failed;
+};
+
+#endif
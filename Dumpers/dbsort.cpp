@@ -0,0 +1,376 @@
+/*
+ * module:	dbsort.cpp
+ *
+ * purpose:	put out the instances of a datebook in start time
+ *		order, within a fixed memory budget (an external
+ *		merge sort)
+ *
+ * note:	the runs are written (and read back) sequentially,
+ *		through stdio buffers as large as the budget allows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dbsort.h"
+
+extern bool verbose;	// commentary on what we do
+
+static const uint8_t SORT_ALLDAY = 1;
+static const uint8_t SORT_PRIVATE = 2;
+static const uint8_t SORT_ALARM = 4;
+static const uint8_t SORT_FIRST = 8;	// a record's first instance
+static const uint8_t SORT_SUMMARY = 16;	// has a summary
+static const uint8_t SORT_DESCRIPTION = 32;	// has a description
+
+// a packed instance (followed by the summary and description)
+struct sort_inst {
+	int64_t		start;
+	int64_t		end;
+	uint64_t	seq;
+	uint32_t	index;
+	uint32_t	rid;
+	uint32_t	category;
+	uint32_t	summary_len;
+	uint32_t	description_len;
+	uint8_t		flags;		// SORT_ALLDAY, ...
+	uint8_t		pad[3];
+};
+
+static size_t packed_size( const struct sort_inst *p ) {
+	return( sizeof *p + p->summary_len + p->description_len );
+}
+
+static bool before( const struct sort_inst *a, const struct sort_inst *b ) {
+	if (a->start != b->start)
+		return( a->start < b->start );
+	return( a->seq < b->seq );
+}
+
+/*
+ * turn a packed instance back into a record and deliver it
+ */
+static void deliver( DatebookFormatter *f, const struct sort_inst *p ) {
+	DatebookRecord r;
+	memset( &r, 0, sizeof r );
+	r.index = p->index;
+	r.rid = p->rid;
+	r.category = p->category;
+	r.allday = (p->flags & SORT_ALLDAY) != 0;
+	r.pvt = (p->flags & SORT_PRIVATE) != 0;
+	r.alarm_set = (p->flags & SORT_ALARM) != 0;
+	r.start_time = p->start;
+	r.end_time = p->end;
+	const char *s = (const char *) (p + 1);
+	if (p->flags & SORT_SUMMARY) {
+		r.summary.str = s;
+		r.summary.len = p->summary_len - 1;
+	}
+	if (p->flags & SORT_DESCRIPTION) {
+		r.description.str = s + p->summary_len;
+		r.description.len = p->description_len - 1;
+	}
+
+	// the first instance is where the record is introduced
+	if ((p->flags & SORT_FIRST) == 0 || f->onRecord( r ))
+		f->onInstance( r, p->start, p->end );
+}
+
+DatebookSorter::DatebookSorter( DatebookFormatter *f, size_t limit ) {
+	_f = f;
+	if (limit < SORT_MIN_MEMORY)
+		limit = SORT_MIN_MEMORY;
+	_spill_size = limit / 16;	// (the rest of the budget is the buffer)
+	if (_spill_size > SORT_MAX_SPILL_BUFFER)
+		_spill_size = SORT_MAX_SPILL_BUFFER;
+	_size = (limit - _spill_size) & ~(size_t) 7;	// (the offsets are at the top)
+	_buf = (char *) malloc( _size );
+	_used = 0;
+	_num = 0;
+	_seq = 0;
+	_first = false;
+	_spill = 0;
+	_runs = 0;
+	_num_runs = 0;
+	_max_runs = 0;
+	_failed = (_buf == 0);
+}
+
+DatebookSorter::~DatebookSorter() {
+	if (_spill)
+		fclose( _spill );
+	free( _runs );
+	free( _buf );
+}
+
+void DatebookSorter::onHeader( const DatebookHeader &h ) {
+	_f->onHeader( h );
+}
+
+void DatebookSorter::onCategory( int i, const char *name ) {
+	_f->onCategory( i, name );
+}
+
+/*
+ * a records format puts the record out now (and wants no
+ * instances); the others are introduced to it again, with
+ * its first instance, when that comes out of the sort
+ */
+bool DatebookSorter::onRecord( const DatebookRecord &r ) {
+	_first = true;
+	return( _f->onRecord( r ) );
+}
+
+void DatebookSorter::onInstance( const DatebookRecord &r, time_t st, time_t et ) {
+	if (_failed)
+		return;
+
+	struct sort_inst p;
+	memset( &p, 0, sizeof p );
+	p.start = st;
+	p.end = et;
+	p.seq = _seq++;
+	p.index = r.index;
+	p.rid = r.rid;
+	p.category = r.category;
+	p.flags = (r.allday ? SORT_ALLDAY : 0) |
+		(r.pvt ? SORT_PRIVATE : 0) |
+		(r.alarm_set ? SORT_ALARM : 0) |
+		(_first ? SORT_FIRST : 0);
+	if (r.summary.str) {
+		p.flags |= SORT_SUMMARY;
+		p.summary_len = r.summary.len + 1;
+	}
+	if (r.description.str) {
+		p.flags |= SORT_DESCRIPTION;
+		p.description_len = r.description.len + 1;
+	}
+	_first = false;
+
+	// instances are kept 8 byte aligned, each with an offset at the top
+	size_t len = (packed_size( &p ) + 7) & ~(size_t) 7;
+	if (_used + len + (_num + 1) * sizeof (size_t) > _size) {
+		if (!spill() || len + sizeof (size_t) > _size) {
+			_failed = true;
+			return;
+		}
+	}
+	char *q = _buf + _used;
+	memcpy( q, &p, sizeof p );
+	if (r.summary.str)
+		memcpy( q + sizeof p, r.summary.str, p.summary_len );
+	if (r.description.str)
+		memcpy( q + sizeof p + p.summary_len, r.description.str,
+				p.description_len );
+	_num++;
+	((size_t *) (_buf + _size))[-_num] = _used;
+	_used += len;
+}
+
+/*
+ * the offsets (at the top of the buffer) in start order (the
+ * buffer is passed along, so sorters in other threads can't mix)
+ */
+static int by_start( const void *a, const void *b, void *base ) {
+	const struct sort_inst *ia = (const struct sort_inst *) ((char *) base + *(const size_t *) a);
+	const struct sort_inst *ib = (const struct sort_inst *) ((char *) base + *(const size_t *) b);
+	return( before( ia, ib ) ? -1 : before( ib, ia ) );
+}
+
+void DatebookSorter::sortBuffer() {
+	size_t *offsets = ((size_t *) (_buf + _size)) - _num;
+	qsort_r( offsets, _num, sizeof (size_t), by_start, _buf );
+}
+
+/*
+ * routine:	spill
+ *
+ * purpose:	sort the buffer and write it out as a run
+ */
+bool DatebookSorter::spill() {
+	if (_num == 0)
+		return( true );
+
+	if (_spill == 0) {
+		_spill = tmpfile();
+		if (_spill == 0) {
+			perror( "spill file" );
+			return( false );
+		}
+		setvbuf( _spill, 0, _IOFBF, _spill_size );
+	}
+	if (_num_runs + 1 >= _max_runs) {
+		_max_runs = _max_runs ? 2 * _max_runs : 16;
+		_runs = (off_t *) realloc( _runs, _max_runs * sizeof (off_t) );
+	}
+	_runs[_num_runs] = ftello( _spill );
+
+	sortBuffer();
+	size_t *offsets = ((size_t *) (_buf + _size)) - _num;
+	for( long i = 0; i < _num; i++ ) {
+		const struct sort_inst *p = (const struct sort_inst *) (_buf + offsets[i]);
+		fwrite( p, packed_size( p ), 1, _spill );
+	}
+	if (fflush( _spill ) != 0) {
+		perror( "spill file" );
+		return( false );
+	}
+	_runs[++_num_runs] = ftello( _spill );	// (where the next one starts)
+	_num = 0;
+	_used = 0;
+	return( true );
+}
+
+// the head of one run, as read back for the merge
+struct run_head {
+	struct sort_inst *inst;	// (a copy of its own)
+	size_t		size;
+	int		fd;	// the spill file,
+	off_t		at;	// (the rest of the run)
+	off_t		end;
+	char		*buf;	// read ahead of the head
+	size_t		buf_size;
+	size_t		len;
+	size_t		pos;
+};
+
+// the next n bytes of a run
+static bool take( struct run_head *h, void *to, size_t n ) {
+	char *p = (char *) to;
+	while( n > 0 ) {
+		if (h->pos == h->len) {
+			size_t want = h->buf_size;
+			if ((off_t) want > h->end - h->at)
+				want = h->end - h->at;
+			ssize_t got = (want > 0) ? pread( h->fd, h->buf, want, h->at ) : 0;
+			if (got <= 0)
+				return( false );
+			h->at += got;
+			h->len = got;
+			h->pos = 0;
+		}
+		size_t m = (n < h->len - h->pos) ? n : h->len - h->pos;
+		memcpy( p, h->buf + h->pos, m );
+		h->pos += m;
+		p += m;
+		n -= m;
+	}
+	return( true );
+}
+
+static bool read_inst( struct run_head *h ) {
+	struct sort_inst p;
+	if (!take( h, &p, sizeof p ))
+		return( false );
+	size_t len = packed_size( &p );
+	if (len > h->size) {
+		h->inst = (struct sort_inst *) realloc( h->inst, len );
+		h->size = len;
+	}
+	*h->inst = p;
+	return( take( h, h->inst + 1, len - sizeof p ) );
+}
+
+static void sift_down( struct run_head **heap, int n, int i ) {
+	for( ;; ) {
+		int least = i;
+		int l = 2 * i + 1;
+		int r = l + 1;
+		if (l < n && before( heap[l]->inst, heap[least]->inst ))
+			least = l;
+		if (r < n && before( heap[r]->inst, heap[least]->inst ))
+			least = r;
+		if (least == i)
+			return;
+		struct run_head *tmp = heap[i];
+		heap[i] = heap[least];
+		heap[least] = tmp;
+		i = least;
+	}
+}
+
+/*
+ * routine:	merge
+ *
+ * purpose:	merge the runs back together and deliver them
+ *
+ * note:	the memory budget (no longer needed for the buffer)
+ *		is split among the runs as their read buffers, and
+ *		each run is read (with pread) from its own part of
+ *		the one spill file
+ */
+void DatebookSorter::merge() {
+	free( _buf );
+	_buf = 0;
+	size_t bufsize = _size / _num_runs;
+	if (bufsize < BUFSIZ)
+		bufsize = BUFSIZ;
+
+	struct run_head *heads = (struct run_head *)
+			calloc( _num_runs, sizeof (struct run_head) );
+	struct run_head **heap = (struct run_head **)
+			malloc( _num_runs * sizeof (struct run_head *) );
+	int live = 0;
+	for( int i = 0; i < _num_runs; i++ ) {
+		heads[i].fd = fileno( _spill );
+		heads[i].at = _runs[i];
+		heads[i].end = _runs[i + 1];
+		heads[i].buf = (char *) malloc( bufsize );
+		heads[i].buf_size = bufsize;
+		if (read_inst( &heads[i] ))
+			heap[live++] = &heads[i];
+	}
+	for( int i = live / 2 - 1; i >= 0; i-- )
+		sift_down( heap, live, i );
+
+	while( live > 0 ) {
+		deliver( _f, heap[0]->inst );
+		if (!read_inst( heap[0] ))
+			heap[0] = heap[--live];
+		sift_down( heap, live, 0 );
+	}
+
+	for( int i = 0; i < _num_runs; i++ ) {
+		free( heads[i].inst );
+		free( heads[i].buf );
+	}
+	free( heads );
+	free( heap );
+}
+
+/*
+ * routine:	finish
+ *
+ * purpose:	deliver all of the instances, in start time order
+ *
+ * returns:	the number of instances, or -1 if we ran out of
+ *		space to sort them in
+ */
+long DatebookSorter::finish() {
+	if (_failed) {
+		fprintf( stderr, "unable to sort instances\n" );
+		return( -1 );
+	}
+
+	long total = _seq;
+	if (_num_runs == 0) {
+		// it all fit in memory
+		sortBuffer();
+		size_t *offsets = ((size_t *) (_buf + _size)) - _num;
+		for( long i = 0; i < _num; i++ )
+			deliver( _f, (const struct sort_inst *) (_buf + offsets[i]) );
+	} else {
+		if (!spill()) {
+			fprintf( stderr, "unable to sort instances\n" );
+			return( -1 );
+		}
+		if (verbose)
+			fprintf( stderr, "sorted %ld instances in %d runs\n",
+					total, _num_runs );
+		merge();
+	}
+	_num = 0;
+	_used = 0;
+	return( total );
+}
@@ -0,0 +1,69 @@
+/*
+ * module:	dbsort.h
+ *
+ * purpose:	put out the instances of a datebook in start time
+ *		order, within a fixed memory budget
+ *
+ * note:	a DatebookSorter sits between the decoder and a
+ *		formatter.  It packs each instance (with the fields
+ *		the formatters use) into a buffer of the given size;
+ *		when the buffer fills, it is sorted and written out
+ *		as a run to a temporary file (one file for all the
+ *		runs, however many there are, written through a
+ *		buffer that is also taken out of the budget).  At the end the runs
+ *		are merged back (or, if there were none, the buffer
+ *		is simply sorted) and delivered to the formatter.
+ *
+ *		A formatter that wants records (not instances) is
+ *		handed each record as it comes, and that is all.
+ */
+#ifndef _DBSORT_H
+#define _DBSORT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "dbformat.h"
+
+// the smallest buffer we will work with
+static const size_t SORT_MIN_MEMORY = 256 * 1024;
+
+// the most of the budget the spill file's buffer may have
+static const size_t SORT_MAX_SPILL_BUFFER = 1024 * 1024;
+
+class DatebookSorter : public DatebookVisitor {
+   public:
+	DatebookSorter( DatebookFormatter *f, size_t limit );
+	~DatebookSorter();
+
+	void onHeader( const DatebookHeader & );
+	void onCategory( int, const char * );
+	bool onRecord( const DatebookRecord & );
+	void onInstance( const DatebookRecord &, time_t, time_t );
+	unsigned fields()	{ return( _f->fields() ); }
+
+	// deliver everything, in order (returns # instances)
+	long finish();
+
+   private:
+	void sortBuffer();
+	bool spill();
+	void merge();
+
+	DatebookFormatter *_f;
+	char		*_buf;		// packed instances grow up from the
+	size_t		_size;		// bottom, their offsets down from the top
+	size_t		_used;
+	long		_num;
+	uint64_t	_seq;		// (keeps equal starts in input order)
+	bool		_first;		// next instance is the record's first
+
+	FILE		*_spill;	// the spilled runs,
+	size_t		_spill_size;	// (its stdio buffer)
+	off_t		*_runs;		// (where each one starts)
+	int		_num_runs;
+	int		_max_runs;
+	bool		_failed;
+};
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ * module:	dbstats.cpp
+ *
+ * purpose:	statistics over (any number of) datebook archives
+ *
+ * note:	the counting must agree with expand_datebook: the
+ *		candidates for repetition are the days after the start
+ *		(at the same time of day) that come before the end date,
+ *		and an exception removes the candidate on its day.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dbstats.h"
+
+static const long DAY = 24 * 60 * 60;
+
+// the week day (0 = Sunday) of a day number (1970/01/01 was a Thursday)
+static int weekday( long day ) {
+	return( (day + 4) % 7 );
+}
+
+// the day number of a date
+static long day_of( int year, int mon, int mday ) {
+	struct tm tm;
+	memset( &tm, 0, sizeof tm );
+	tm.tm_year = year - 1900;
+	tm.tm_mon = mon;
+	tm.tm_mday = mday;
+	return( timegm( &tm ) / DAY );
+}
+
+// the date of a day number
+static void date_of( long day, struct tm *tm ) {
+	time_t t = day * DAY;
+	gmtime_r( &t, tm );
+}
+
+static int days_in_month( int year, int mon ) {
+	return( (mon == 11) ? 31 :
+		day_of( year, mon + 1, 1 ) - day_of( year, mon, 1 ) );
+}
+
+/*
+ * routine:	monthly_day
+ *
+ * purpose:	the day of a month on which a monthly (or yearly)
+ *		rule falls
+ *
+ * returns:	the day number, or -1 if it does not fall in this month
+ */
+static long monthly_day( const DatebookRecord &r, int year, int mon ) {
+	int mday;
+	switch( r.brand ) {
+	case 3: {	// monthly by day: the week_x'th day_x of the month
+		if (r.day_x < 1 || r.day_x > 7 || r.week_x < 1)
+			return( -1 );
+		long first = day_of( year, mon, 1 );
+		mday = 1 + ((int) r.day_x - 1 - weekday( first ) + 7) % 7
+			+ 7 * (r.week_x - 1);
+		break;
+	    }
+	case 5:		// yearly by date
+		if (mon != (int) r.mon_x)
+			return( -1 );
+		// fall through
+	case 4:		// monthly by date
+		mday = r.day_num;
+		break;
+	default:
+		return( -1 );
+	}
+	if (mday < 1 || mday > days_in_month( year, mon ))
+		return( -1 );
+	return( day_of( year, mon, mday ) );
+}
+
+/*
+ * routine:	matches
+ *
+ * purpose:	does a repetition rule fall on a (candidate) day
+ */
+static bool matches( const DatebookRecord &r, long day ) {
+	struct tm tm;
+	switch( r.brand ) {
+	case 1:
+		return( true );
+	case 2:
+		return( (r.day_mask & (1 << weekday( day ))) != 0 );
+	case 3:
+	case 4:
+	case 5:
+		date_of( day, &tm );
+		return( monthly_day( r, tm.tm_year + 1900, tm.tm_mon ) == day );
+	}
+	return( false );
+}
+
+// which duration bucket an instance falls in
+static const char *duration_names[STATS_DURATIONS] = {
+	"all day", "none", "<= 15 min", "<= 30 min", "<= 1 hour",
+	"<= 2 hours", "<= 4 hours", "longer"
+};
+
+static int duration_bucket( const DatebookRecord &r ) {
+	static const long limits[] = { 15*60, 30*60, 60*60, 2*60*60, 4*60*60 };
+	if (r.allday)
+		return( 0 );
+	long d = r.end_time - r.start_time;
+	if (d <= 0)
+		return( 1 );
+	for( int i = 0; i < 5; i++ )
+		if (d <= limits[i])
+			return( 2 + i );
+	return( 7 );
+}
+
+DatebookStats::DatebookStats() {
+	archives = 0;
+	records = 0;
+	instances = 0;
+	private_instances = 0;
+	allday_instances = 0;
+	memset( brands, 0, sizeof brands );
+	memset( durations, 0, sizeof durations );
+
+	// (with room for a run to end just past the last day,
+	// or a week past it)
+	_points = (int32_t *) calloc( STATS_DAYS + 8, sizeof (int32_t) );
+	_runs = (int32_t *) calloc( STATS_DAYS + 8, sizeof (int32_t) );
+	_weekly = (int32_t *) calloc( STATS_DAYS + 8, sizeof (int32_t) );
+	_days = 0;
+
+	_categories = 0;
+	_num_categories = 0;
+	_max_categories = 0;
+	_slot = 0;
+	_num_slots = 0;
+}
+
+DatebookStats::~DatebookStats() {
+	free( _points );
+	free( _runs );
+	free( _weekly );
+	free( _days );
+	for( int i = 0; i < _num_categories; i++ )
+		free( _categories[i].name );
+	free( _categories );
+	free( _slot );
+}
+
+/*
+ * routine:	category
+ *
+ * purpose:	find (or add) a category by name
+ */
+int DatebookStats::category( const char *name ) {
+	for( int i = 0; i < _num_categories; i++ )
+		if (strcmp( _categories[i].name, name ) == 0)
+			return( i );
+
+	if (_num_categories == _max_categories) {
+		_max_categories = _max_categories ? 2 * _max_categories : 16;
+		_categories = (struct stats_category *) realloc( _categories,
+				_max_categories * sizeof (struct stats_category) );
+	}
+	struct stats_category *c = &_categories[_num_categories];
+	c->name = strdup( name );
+	c->records = 0;
+	c->instances = 0;
+	return( _num_categories++ );
+}
+
+void DatebookStats::onHeader( const DatebookHeader &h ) {
+	archives++;
+	free( _slot );
+	_num_slots = h.num_categories;
+	_slot = (int *) calloc( _num_slots + 1, sizeof (int) );
+	for( int i = 0; i < _num_slots; i++ )
+		_slot[i] = -1;
+}
+
+void DatebookStats::onCategory( int i, const char *name ) {
+	if (i >= 0 && i < _num_slots)
+		_slot[i] = category( name ? name : "NONE" );
+}
+
+void DatebookStats::point( long day, int n ) {
+	if (day >= 0 && day < STATS_DAYS)
+		_points[day] += n;
+}
+
+/*
+ * routine:	repeats
+ *
+ * purpose:	count the repetitions of a record (and add them to
+ *		the days they fall on)
+ *
+ * returns:	number of repetitions
+ */
+long DatebookStats::repeats( const DatebookRecord &r ) {
+	if (r.brand < 1 || r.brand > 5 || (time_t) r.enddate <= r.start_time)
+		return( 0 );
+
+	// the candidates are days first .. last
+	long first = r.start_time / DAY + 1;
+	long last = first - 1 + ((time_t) r.enddate - r.start_time - 1) / DAY;
+	if (last >= STATS_DAYS)
+		last = STATS_DAYS - 1;
+	if (last < first)
+		return( 0 );
+
+	long n = 0;
+	if (r.brand == 1) {			// daily: the lot
+		_runs[first] += 1;
+		_runs[last + 1] -= 1;
+		n = last - first + 1;
+	} else if (r.brand == 2) {		// weekly: each day in the mask
+		for( int w = 0; w < 7; w++ ) {
+			if ((r.day_mask & (1 << w)) == 0)
+				continue;
+			long d = first + (w - weekday( first ) + 7) % 7;
+			if (d > last)
+				continue;
+			long count = (last - d) / 7 + 1;
+			_weekly[d] += 1;
+			_weekly[d + 7 * count] -= 1;
+			n += count;
+		}
+	} else {				// a step per month
+		struct tm tm;
+		date_of( first, &tm );
+		int year = tm.tm_year + 1900;
+		int mon = tm.tm_mon;
+		for( ;; ) {
+			long d = monthly_day( r, year, mon );
+			if (d > last)
+				break;
+			if (d >= first) {
+				point( d, 1 );
+				n++;
+			}
+			if (d < 0 && day_of( year, mon, 1 ) > last)
+				break;
+			if (++mon == 12) {
+				mon = 0;
+				year++;
+			}
+		}
+	}
+
+	// take back the days on the exception list
+	long *taken = (long *) malloc( (r.num_except + 1) * sizeof (long) );
+	int num_taken = 0;
+	for( int i = 0; i < r.num_except; i++ ) {
+		// the (one) candidate that starts on the excepted day
+		int64_t off = (int64_t) r.excepts[i] - r.start_time;
+		long k = (off <= 0) ? 0 : (off + DAY - 1) / DAY;
+		long d = r.start_time / DAY + k;
+		if (d < first || d > last || !matches( r, d ))
+			continue;
+		bool dup = false;
+		for( int j = 0; j < num_taken && !dup; j++ )
+			dup = (taken[j] == d);
+		if (dup)
+			continue;
+		taken[num_taken++] = d;
+		point( d, -1 );
+		n--;
+	}
+	free( taken );
+
+	return( n );
+}
+
+bool DatebookStats::onRecord( const DatebookRecord &r ) {
+	records++;
+	brands[(r.brand <= 6) ? r.brand : 0]++;
+
+	point( r.start_time / DAY, 1 );		// the original
+	long n = 1 + repeats( r );
+
+	instances += n;
+	if (r.pvt)
+		private_instances += n;
+	if (r.allday)
+		allday_instances += n;
+	durations[duration_bucket( r )] += n;
+
+	int c = (r.category < (unsigned long) _num_slots) ? _slot[r.category] : -1;
+	if (c < 0)
+		c = category( "NONE" );
+	_categories[c].records++;
+	_categories[c].instances += n;
+
+	return( false );	// we have counted them already
+}
+
+/*
+ * routine:	finish
+ *
+ * purpose:	turn the point counts and difference arrays into
+ *		the number of instances on each day
+ */
+void DatebookStats::finish() {
+	if (_days != 0)
+		return;
+	_days = (uint32_t *) malloc( STATS_DAYS * sizeof (uint32_t) );
+	int32_t run = 0;
+	for( long i = 0; i < STATS_DAYS; i++ ) {
+		run += _runs[i];
+		if (i >= 7)
+			_weekly[i] += _weekly[i - 7];
+		_days[i] = _points[i] + run + _weekly[i];
+	}
+}
+
+void DatebookStats::add( DatebookStats *s ) {
+	s->finish();
+	finish();
+	archives += s->archives;
+	records += s->records;
+	instances += s->instances;
+	private_instances += s->private_instances;
+	allday_instances += s->allday_instances;
+	for( int i = 0; i < 7; i++ )
+		brands[i] += s->brands[i];
+	for( int i = 0; i < STATS_DURATIONS; i++ )
+		durations[i] += s->durations[i];
+	for( long i = 0; i < STATS_DAYS; i++ )
+		_days[i] += s->_days[i];
+	for( int i = 0; i < s->_num_categories; i++ ) {
+		int c = category( s->_categories[i].name );
+		_categories[c].records += s->_categories[i].records;
+		_categories[c].instances += s->_categories[i].instances;
+	}
+}
+
+static double percent( long n, long of ) {
+	return( of ? (100.0 * n) / of : 0.0 );
+}
+
+/*
+ * routine:	report
+ *
+ * purpose:	put out the statistics
+ */
+void DatebookStats::report( FILE *out ) {
+	static const char *brand_names[] = { "none", "daily", "weekly",
+		"monthly by day", "monthly by date", "yearly by date", "yearly by day" };
+	static const char *month_names[] = { "Jan", "Feb", "Mar", "Apr", "May",
+		"Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	static const char *day_names[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
+		"Fri", "Sat" };
+	const int BUSIEST = 10;
+
+	finish();
+
+	// gather up the days
+	long years[STATS_DAYS / 365 + 2];
+	long months[12];
+	long wdays[7];
+	long busiest[BUSIEST];
+	int num_busiest = 0;
+	memset( years, 0, sizeof years );
+	memset( months, 0, sizeof months );
+	memset( wdays, 0, sizeof wdays );
+	int first_year = -1;
+	int last_year = -1;
+	for( long d = 0; d < STATS_DAYS; d++ ) {
+		if (_days[d] == 0)
+			continue;
+		struct tm tm;
+		date_of( d, &tm );
+		if (first_year < 0)
+			first_year = tm.tm_year + 1900;
+		last_year = tm.tm_year + 1900;
+		years[tm.tm_year - 70] += _days[d];
+		months[tm.tm_mon] += _days[d];
+		wdays[tm.tm_wday] += _days[d];
+
+		// keep the busiest (earliest first, for ties)
+		int i = num_busiest;
+		if (i == BUSIEST && _days[busiest[i - 1]] >= _days[d])
+			continue;
+		if (i == BUSIEST)
+			i--;
+		else
+			num_busiest++;
+		for( ; i > 0 && _days[busiest[i - 1]] < _days[d]; i-- )
+			busiest[i] = busiest[i - 1];
+		busiest[i] = d;
+	}
+
+	fprintf( out, "archives:  %ld\n", archives );
+	fprintf( out, "records:   %ld\n", records );
+	fprintf( out, "instances: %ld\n", instances );
+	fprintf( out, "private:   %ld (%.1f%%)\n", private_instances,
+			percent( private_instances, instances ) );
+	fprintf( out, "all day:   %ld (%.1f%%)\n", allday_instances,
+			percent( allday_instances, instances ) );
+
+	fprintf( out, "\nrepeat rules (records):\n" );
+	for( int i = 0; i < 7; i++ )
+		if (brands[i])
+			fprintf( out, "  %-16s %8ld %5.1f%%\n", brand_names[i], brands[i],
+					percent( brands[i], records ) );
+
+	fprintf( out, "\ndurations (instances):\n" );
+	for( int i = 0; i < STATS_DURATIONS; i++ )
+		if (durations[i])
+			fprintf( out, "  %-16s %8ld %5.1f%%\n", duration_names[i],
+					durations[i], percent( durations[i], instances ) );
+
+	fprintf( out, "\ncategories (records, instances):\n" );
+	for( int i = 0; i < _num_categories; i++ )
+		if (_categories[i].records)
+			fprintf( out, "  %-16s %8ld %8ld\n", _categories[i].name,
+					_categories[i].records, _categories[i].instances );
+
+	fprintf( out, "\nby year:\n" );
+	for( int y = first_year; y >= 0 && y <= last_year; y++ )
+		fprintf( out, "  %-16d %8ld\n", y, years[y - 1970] );
+
+	fprintf( out, "\nby month:\n" );
+	for( int m = 0; m < 12; m++ )
+		fprintf( out, "  %-16s %8ld\n", month_names[m], months[m] );
+
+	fprintf( out, "\nby week day:\n" );
+	for( int w = 0; w < 7; w++ )
+		fprintf( out, "  %-16s %8ld\n", day_names[w], wdays[w] );
+
+	fprintf( out, "\nbusiest days:\n" );
+	for( int i = 0; i < num_busiest; i++ ) {
+		struct tm tm;
+		date_of( busiest[i], &tm );
+		fprintf( out, "  %04d/%02d/%02d       %8u\n", tm.tm_year + 1900,
+				tm.tm_mon + 1, tm.tm_mday, _days[busiest[i]] );
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ * module:	dbstats.h
+ *
+ * purpose:	statistics over (any number of) datebook archives
+ *
+ * note:	the instances of a repeating record are counted from
+ *		its repetition rule, not by expanding it: a daily or
+ *		weekly rule adds to a whole run of days (or every
+ *		seventh day) at once, through difference arrays, and
+ *		the monthly and yearly ones need only a step per month.
+ *		So the cost goes with the number of records and the
+ *		span of the calendar, not with the number of instances.
+ *
+ *		A DatebookStats is a visitor; each one can be filled
+ *		from any number of archives, and several (e.g. one
+ *		per thread) can be added together for the report.
+ */
+#ifndef _DBSTATS_H
+#define _DBSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dbdecode.h"
+
+// (unsigned 32-bit) archive times run out in 2106
+static const long STATS_DAYS = 49711;
+
+// instance duration buckets
+static const int STATS_DURATIONS = 8;
+
+class DatebookStats : public DatebookVisitor {
+   public:
+	DatebookStats();
+	~DatebookStats();
+
+	void onHeader( const DatebookHeader & );
+	void onCategory( int, const char * );
+	bool onRecord( const DatebookRecord & );
+	unsigned fields()	{ return( 0 ); }	// (no strings needed)
+
+	// add another set of statistics to these
+	void add( DatebookStats * );
+
+	// put out the report
+	void report( FILE *out );
+
+	long		archives;
+	long		records;
+	long		instances;
+	long		private_instances;
+	long		allday_instances;
+	long		brands[7];	// records per repeat brand
+	long		durations[STATS_DURATIONS];	// instances by length
+
+   private:
+	long repeats( const DatebookRecord & );
+	void point( long day, int n );
+	int category( const char *name );
+	void finish();
+
+	int32_t		*_points;	// single instances (per day)
+	int32_t		*_runs;		// difference array: daily runs
+	int32_t		*_weekly;	// difference array: every 7th day
+	uint32_t	*_days;		// (when finished) instances per day
+
+	struct stats_category {
+		char	*name;
+		long	records;
+		long	instances;
+	}		*_categories;	// (by name, across archives)
+	int		_num_categories;
+	int		_max_categories;
+	int		*_slot;		// this archive's index -> _categories
+	int		_num_slots;
+};
+
+#endif
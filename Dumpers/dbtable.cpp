@@ -0,0 +1,188 @@
+/*
+ * module:	dbtable.cpp
+ *
+ * purpose:	a columnar (struct of arrays) in-memory datebook
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbtable.h"
+
+DatebookTable::DatebookTable( StringPool *pool ) {
+	_rows = 0;
+	_max_rows = 0;
+	index = 0;
+	rid = 0;
+	start = 0;
+	end = 0;
+	last = 0;
+	flags = 0;
+	category_x = 0;
+	summary = 0;
+	description = 0;
+	repeat = 0;
+
+	_own_pool = (pool == 0);
+	_pool = _own_pool ? new StringPool : pool;
+	_fields = DB_ALL_FIELDS;
+	_repeats = 0;
+	_num_repeats = 0;
+	_max_repeats = 0;
+	_excepts = 0;
+	_num_excepts = 0;
+	_max_excepts = 0;
+	_categories = 0;
+	_num_categories = 0;
+}
+
+DatebookTable::~DatebookTable() {
+	free( index );
+	free( rid );
+	free( start );
+	free( end );
+	free( last );
+	free( flags );
+	free( category_x );
+	free( summary );
+	free( description );
+	free( repeat );
+	free( _repeats );
+	free( _excepts );
+	free( _categories );
+	if (_own_pool)
+		delete _pool;
+}
+
+/*
+ * routine:	growRows
+ *
+ * purpose:	make room for more rows (in every column)
+ */
+void DatebookTable::growRows() {
+	_max_rows = _max_rows ? 2 * _max_rows : 256;
+	index = (uint32_t *) realloc( index, _max_rows * sizeof *index );
+	rid = (uint32_t *) realloc( rid, _max_rows * sizeof *rid );
+	start = (int64_t *) realloc( start, _max_rows * sizeof *start );
+	end = (int64_t *) realloc( end, _max_rows * sizeof *end );
+	last = (int64_t *) realloc( last, _max_rows * sizeof *last );
+	flags = (uint8_t *) realloc( flags, _max_rows * sizeof *flags );
+	category_x = (uint32_t *) realloc( category_x, _max_rows * sizeof *category_x );
+	summary = (const char **) realloc( summary, _max_rows * sizeof *summary );
+	description = (const char **) realloc( description, _max_rows * sizeof *description );
+	repeat = (uint32_t *) realloc( repeat, _max_rows * sizeof *repeat );
+}
+
+void DatebookTable::onHeader( const DatebookHeader &h ) {
+	// we might be loaded from several archives, but the
+	// category indices in the records are per-archive
+	free( _categories );
+	_categories = (h.num_categories > 0) ?
+		(const char **) calloc( h.num_categories, sizeof (char *) ) : 0;
+	_num_categories = h.num_categories;
+}
+
+void DatebookTable::onCategory( int i, const char *name ) {
+	if (i >= 0 && i < _num_categories)
+		_categories[i] = _pool->intern( name ? name : "NONE" );
+}
+
+bool DatebookTable::onRecord( const DatebookRecord &r ) {
+	if (_rows == _max_rows)
+		growRows();
+
+	long i = _rows++;
+	index[i] = r.index;
+	rid[i] = r.rid;
+	start[i] = r.start_time;
+	end[i] = r.end_time;
+	flags[i] = (r.allday ? ROW_ALLDAY : 0) |
+			(r.pvt ? ROW_PRIVATE : 0) |
+			(r.alarm_set ? ROW_ALARM : 0);
+	category_x[i] = r.category;
+	summary[i] = _pool->intern( r.summary.str, r.summary.len );
+	description[i] = _pool->intern( r.description.str, r.description.len );
+
+	// how long an instance occupies the calendar
+	int64_t duration = datebook_span( r );
+	last[i] = r.start_time + duration;
+
+	if (r.brand == 0) {
+		repeat[i] = ROW_NO_REPEAT;
+		return( false );
+	}
+
+	// pack up the repeat rule
+	if (_num_repeats == _max_repeats) {
+		_max_repeats = _max_repeats ? 2 * _max_repeats : 64;
+		_repeats = (DatebookRepeat *) realloc( _repeats,
+				_max_repeats * sizeof (DatebookRepeat) );
+	}
+	DatebookRepeat *p = &_repeats[_num_repeats];
+	p->enddate = r.enddate;
+	p->interval = r.interval;
+	p->wstart = r.wstart;
+	p->day_x = r.day_x;
+	p->week_x = r.week_x;
+	p->day_num = r.day_num;
+	p->mon_x = r.mon_x;
+	p->brand = r.brand;
+	p->day_mask = r.day_mask;
+	p->num_except = r.num_except;
+	p->first_except = _num_excepts;
+	if (r.num_except > 0) {
+		if (_num_excepts + r.num_except > _max_excepts) {
+			while( _num_excepts + r.num_except > _max_excepts )
+				_max_excepts = _max_excepts ? 2 * _max_excepts : 64;
+			_excepts = (unsigned long *) realloc( _excepts,
+					_max_excepts * sizeof (unsigned long) );
+		}
+		memcpy( &_excepts[_num_excepts], r.excepts,
+				r.num_except * sizeof (unsigned long) );
+		_num_excepts += r.num_except;
+	}
+	repeat[i] = _num_repeats++;
+	flags[i] |= ROW_REPEATS;
+
+	// the last instance starts before the end date
+	if (r.brand != 6 && (int64_t) r.enddate + duration > last[i])
+		last[i] = (int64_t) r.enddate + duration;
+
+	return( false );	// we have no use for the instances
+}
+
+/*
+ * routine:	record
+ *
+ * purpose:	present a row as a DatebookRecord, e.g. for expansion
+ *		or output.  Its strings point into the table.
+ */
+void DatebookTable::record( long row, DatebookRecord &r ) {
+	memset( &r, 0, sizeof r );
+	r.index = index[row];
+	r.rid = rid[row];
+	r.start_time = start[row];
+	r.end_time = end[row];
+	r.summary.str = summary[row];
+	r.summary.len = StringPool::length( summary[row] );
+	r.description.str = description[row];
+	r.description.len = StringPool::length( description[row] );
+	r.allday = (flags[row] & ROW_ALLDAY) != 0;
+	r.pvt = (flags[row] & ROW_PRIVATE) != 0;
+	r.alarm_set = (flags[row] & ROW_ALARM) != 0;
+	r.category = category_x[row];
+
+	if (repeat[row] != ROW_NO_REPEAT) {
+		const DatebookRepeat *p = &_repeats[repeat[row]];
+		r.brand = p->brand;
+		r.interval = p->interval;
+		r.enddate = p->enddate;
+		r.wstart = p->wstart;
+		r.day_x = p->day_x;
+		r.day_mask = p->day_mask;
+		r.week_x = p->week_x;
+		r.day_num = p->day_num;
+		r.mon_x = p->mon_x;
+		r.num_except = p->num_except;
+		r.excepts = _excepts + p->first_except;
+	}
+}
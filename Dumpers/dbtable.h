@@ -0,0 +1,107 @@
+/*
+ * module:	dbtable.h
+ *
+ * purpose:	a columnar (struct of arrays) in-memory datebook
+ *
+ * note:	rather than one heap allocated Appt per record, a
+ *		DatebookTable keeps each field in its own contiguous
+ *		column (strings interned in a StringPool, repeat rules
+ *		in a packed descriptor column), and a row is presented
+ *		again as a DatebookRecord only when it is wanted.
+ *
+ *		A table is a visitor, so it can be filled from an
+ *		archive (decode_datebook) or a cache (decode).
+ *
+ *		Tables that share a StringPool can compare their
+ *		strings (within and across tables) by pointer.
+ */
+#ifndef _DBTABLE_H
+#define _DBTABLE_H
+
+#include <stdint.h>
+#include "dbdecode.h"
+#include "strpool.h"
+
+// per row flags
+static const uint8_t ROW_ALLDAY = 1;
+static const uint8_t ROW_PRIVATE = 2;
+static const uint8_t ROW_ALARM = 4;
+static const uint8_t ROW_REPEATS = 8;
+
+static const uint32_t ROW_NO_REPEAT = 0xffffffff;
+
+// a packed repetition rule
+struct DatebookRepeat {
+	uint32_t	enddate;
+	uint32_t	interval;
+	uint32_t	wstart;
+	uint32_t	day_x;
+	uint32_t	week_x;
+	uint32_t	day_num;
+	uint32_t	mon_x;
+	uint32_t	first_except;	// index into the exception dates
+	uint16_t	num_except;
+	uint8_t		brand;
+	uint8_t		day_mask;
+};
+
+class DatebookTable : public DatebookVisitor {
+   public:
+	// (with a private pool, unless given one to share)
+	DatebookTable( StringPool *pool = 0 );
+	~DatebookTable();
+
+	// filling the table
+	void onHeader( const DatebookHeader & );
+	void onCategory( int, const char * );
+	bool onRecord( const DatebookRecord & );
+	unsigned fields()	{ return( _fields ); }
+
+	// which strings to keep (e.g. none, for time-only work)
+	void setFields( unsigned fields )	{ _fields = fields; }
+
+	long rows()		{ return( _rows ); }
+	int categories()	{ return( _num_categories ); }
+	const char *category( unsigned long i ) {
+		return( (i < (unsigned long) _num_categories) ? _categories[i] : "NONE" );
+	}
+	StringPool *pool()	{ return( _pool ); }
+
+	// present a row as a DatebookRecord (strings are views)
+	void record( long row, DatebookRecord & );
+
+	// the columns
+	uint32_t	*index;		// position within the archive
+	uint32_t	*rid;		// record ID
+	int64_t		*start;		// start time
+	int64_t		*end;		// end time (of first instance)
+	int64_t		*last;		// end of the last possible instance
+	uint8_t		*flags;		// ROW_ALLDAY, ...
+	uint32_t	*category_x;	// category index
+	const char	**summary;	// interned strings (or 0)
+	const char	**description;
+	uint32_t	*repeat;	// repeat descriptor (or ROW_NO_REPEAT)
+
+   private:
+	void growRows();
+
+	long		_rows;
+	long		_max_rows;
+
+	StringPool	*_pool;		// the strings
+	bool		_own_pool;
+	unsigned	_fields;	// DB_SUMMARY, ...
+
+	DatebookRepeat	*_repeats;	// repeat descriptors
+	long		_num_repeats;
+	long		_max_repeats;
+
+	unsigned long	*_excepts;	// exception dates
+	long		_num_excepts;
+	long		_max_excepts;
+
+	const char	**_categories;	// (interned)
+	int		_num_categories;
+};
+
+#endif
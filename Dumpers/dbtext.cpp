@@ -0,0 +1,467 @@
+/*
+ * module:	dbtext.cpp
+ *
+ * purpose:	a full-text (inverted) index over the summaries and
+ *		notes of any number of datebook archives
+ *
+ * note:	while building, every (word, record) pair is simply
+ *		appended to a list; the words are interned, so the
+ *		list is sorted (by word, then record) and written out
+ *		in one go at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dbtext.h"
+
+extern bool verbose;	// commentary on what we do
+
+static const char TEXT_MAGIC[8] = "PALMTXT";
+
+// one word of one record
+struct text_posting {
+	const char	*word;	// (interned)
+	uint64_t	key;
+};
+
+/*
+ * routine:	text_words
+ *
+ * purpose:	break text into words (runs of letters and digits,
+ *		with anything non-ASCII taken to be a letter), folded
+ *		to lower case.  Single characters are not words.
+ */
+int text_words( const char *s, unsigned len,
+		void (*f)( const char *word, unsigned len, void *arg ), void *arg ) {
+	char word[TEXT_MAX_WORD];
+	int found = 0;
+	unsigned n = 0;
+	for( unsigned i = 0; i <= len; i++ ) {
+		unsigned char c = (i < len) ? s[i] : 0;
+		if (c >= 0x80 || isalnum( c )) {
+			if (n < sizeof word)
+				word[n++] = tolower( c );
+			continue;
+		}
+		if (n > 1) {
+			(*f)( word, n, arg );
+			found++;
+		}
+		n = 0;
+	}
+	return( found );
+}
+
+/*
+ * routine:	utf8_to_latin1
+ *
+ * purpose:	convert UTF-8 text to the Palm's Latin-1
+ *
+ * returns:	the length of the result (out must have room for len)
+ *
+ * note:	characters Latin-1 does not have become '?', and bytes
+ *		that are not UTF-8 at all are passed on as they are.
+ */
+size_t utf8_to_latin1( const char *v, size_t len, char *out ) {
+	char *o = out;
+	for( size_t i = 0; i < len; ) {
+		unsigned char c = v[i];
+		if (c >= 0xc2 && c <= 0xdf && i + 1 < len && (v[i+1] & 0xc0) == 0x80) {
+			unsigned u = ((c & 0x1f) << 6) | (v[i+1] & 0x3f);
+			*o++ = (u < 0x100) ? u : '?';
+			i += 2;
+		} else if (c >= 0xe0 && c <= 0xf4) {
+			size_t n = (c >= 0xf0) ? 4 : 3;
+			size_t k = 1;
+			while( k < n && i + k < len && (v[i+k] & 0xc0) == 0x80 )
+				k++;
+			if (k == n) {
+				*o++ = '?';
+				i += n;
+			} else
+				*o++ = v[i++];
+		} else
+			*o++ = v[i++];
+	}
+	return( o - out );
+}
+
+TextIndexBuilder::TextIndexBuilder() {
+	_postings = 0;
+	_num_postings = 0;
+	_max_postings = 0;
+	_archives = 0;
+	_num_archives = 0;
+	_max_archives = 0;
+	_key = 0;
+}
+
+TextIndexBuilder::~TextIndexBuilder() {
+	free( _postings );
+	free( _archives );
+}
+
+void TextIndexBuilder::setArchive( const char *name ) {
+	if (_num_archives == _max_archives) {
+		_max_archives = _max_archives ? 2 * _max_archives : 16;
+		_archives = (const char **) realloc( _archives,
+				_max_archives * sizeof (char *) );
+	}
+	_archives[_num_archives++] = _words.intern( name );
+}
+
+static void add_word( const char *word, unsigned len, void *arg ) {
+	TextIndexBuilder *b = (TextIndexBuilder *) arg;
+	b->addWord( word, len );
+}
+
+void TextIndexBuilder::addWord( const char *word, unsigned len ) {
+	if (_num_postings == _max_postings) {
+		_max_postings = _max_postings ? 2 * _max_postings : 1024;
+		_postings = (struct text_posting *) realloc( _postings,
+				_max_postings * sizeof (struct text_posting) );
+	}
+	_postings[_num_postings].word = _words.intern( word, len );
+	_postings[_num_postings++].key = _key;
+}
+
+bool TextIndexBuilder::onRecord( const DatebookRecord &r ) {
+	_key = text_key( _num_archives - 1, r.rid );
+	if (r.summary.str)
+		text_words( r.summary.str, r.summary.len, add_word, this );
+	if (r.description.str)
+		text_words( r.description.str, r.description.len, add_word, this );
+	return( false );	// the words are all we want
+}
+
+static int by_word( const void *a, const void *b ) {
+	const struct text_posting *pa = (const struct text_posting *) a;
+	const struct text_posting *pb = (const struct text_posting *) b;
+	if (pa->word != pb->word) {	// (interned, so equal if the same)
+		int c = strcmp( pa->word, pb->word );
+		if (c != 0)
+			return( c );
+	}
+	return( (pa->key < pb->key) ? -1 : (pa->key > pb->key) );
+}
+
+/*
+ * a growable (malloc'd) byte buffer, for assembling the file
+ */
+struct textbuf {
+	char	*data;
+	size_t	len;
+	size_t	size;
+};
+
+static size_t append( struct textbuf *b, const void *data, size_t len ) {
+	if (b->len + len > b->size) {
+		size_t newsize = b->size ? b->size : 4096;
+		while( newsize < b->len + len )
+			newsize *= 2;
+		b->data = (char *) realloc( b->data, newsize );
+		b->size = newsize;
+	}
+	size_t off = b->len;
+	memcpy( b->data + off, data, len );
+	b->len += len;
+	return( off );
+}
+
+static void append_varint( struct textbuf *b, uint64_t v ) {
+	unsigned char buf[10];
+	int n = 0;
+	while( v >= 0x80 ) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	append( b, buf, n );
+}
+
+static uint64_t align8( uint64_t off ) {
+	return( (off + 7) & ~(uint64_t) 7 );
+}
+
+static bool put( FILE *f, uint64_t off, const void *data, size_t len ) {
+	if (len == 0)
+		return( true );
+	if (fseek( f, off, SEEK_SET ) != 0)
+		return( false );
+	return( fwrite( data, 1, len, f ) == len );
+}
+
+/*
+ * routine:	write
+ *
+ * purpose:	sort what we have collected and write out the index
+ *		(under a temporary name, and then renamed)
+ *
+ * returns:	0 on success, 1 on failure
+ */
+int TextIndexBuilder::write( const char *path ) {
+
+	qsort( _postings, _num_postings, sizeof (struct text_posting), by_word );
+
+	struct textbuf words = { 0, 0, 0 };
+	struct textbuf postings = { 0, 0, 0 };
+	struct textbuf strings = { 0, 0, 0 };
+	struct textbuf archives = { 0, 0, 0 };
+	for( uint32_t i = 0; i < _num_archives; i++ ) {
+		uint64_t off = append( &strings, _archives[i],
+				StringPool::length( _archives[i] ) + 1 );
+		append( &archives, &off, sizeof off );
+	}
+
+	uint32_t num_words = 0;
+	for( long i = 0; i < _num_postings; ) {
+		// one word, and its (distinct) records
+		const char *w = _postings[i].word;
+		TextWord tw;
+		tw.word = append( &strings, w, StringPool::length( w ) + 1 );
+		tw.postings = postings.len;
+		tw.count = 0;
+		tw.pad = 0;
+		uint64_t prev = 0;
+		for( ; i < _num_postings && _postings[i].word == w; i++ ) {
+			if (tw.count > 0 && _postings[i].key == prev)
+				continue;
+			append_varint( &postings, _postings[i].key - prev );
+			prev = _postings[i].key;
+			tw.count++;
+		}
+		append( &words, &tw, sizeof tw );
+		num_words++;
+	}
+
+	TextIndexHeader hdr;
+	memset( &hdr, 0, sizeof hdr );
+	memcpy( hdr.magic, TEXT_MAGIC, sizeof TEXT_MAGIC );
+	hdr.version = TEXT_VERSION;
+	hdr.byteorder = TEXT_BYTEORDER;
+	hdr.num_archives = _num_archives;
+	hdr.num_words = num_words;
+	hdr.archives = align8( sizeof hdr );
+	hdr.words = align8( hdr.archives + archives.len );
+	hdr.postings = align8( hdr.words + words.len );
+	hdr.postings_len = postings.len;
+	hdr.strings = align8( hdr.postings + postings.len );
+	hdr.strings_len = strings.len;
+
+	char tmp[4096];
+	snprintf( tmp, sizeof tmp, "%s.%d", path, (int) getpid() );
+	FILE *f = fopen( tmp, "w" );
+	bool ok = (f != 0);
+	ok = ok && put( f, 0, &hdr, sizeof hdr );
+	ok = ok && put( f, hdr.archives, archives.data, archives.len );
+	ok = ok && put( f, hdr.words, words.data, words.len );
+	ok = ok && put( f, hdr.postings, postings.data, postings.len );
+	ok = ok && put( f, hdr.strings, strings.data, strings.len );
+	if (f != 0)
+		ok = (fclose( f ) == 0) && ok;
+	free( archives.data );
+	free( words.data );
+	free( postings.data );
+	free( strings.data );
+
+	if (!ok || rename( tmp, path ) != 0) {
+		unlink( tmp );
+		return( 1 );
+	}
+
+	if (verbose)
+		fprintf( stderr, "indexed %u archives: %u words, %ld postings\n",
+				_num_archives, num_words, _num_postings );
+	return( 0 );
+}
+
+// are there n things of this size at off (without overflowing)
+static bool within( uint64_t off, uint64_t n, uint64_t each, uint64_t size ) {
+	if (off > size || (each != 0 && n > (size - off) / each))
+		return( false );
+	return( true );
+}
+
+/*
+ * routine:	valid
+ *
+ * purpose:	make sure that every section, every word (and its
+ *		postings) and every archive name lies within the file,
+ *		and that the last string is terminated, before find()
+ *		and the rest go reading through them
+ */
+static bool valid( const TextIndexHeader *h, size_t size ) {
+	if (!within( h->archives, h->num_archives, sizeof (uint64_t), size ) ||
+			!within( h->words, h->num_words, sizeof (TextWord), size ) ||
+			!within( h->postings, h->postings_len, 1, size ) ||
+			!within( h->strings, h->strings_len, 1, size ) ||
+			h->archives % sizeof (uint64_t) != 0 ||
+			h->words % sizeof (uint64_t) != 0)
+		return( false );
+
+	const char *base = (const char *) h;
+	if (h->strings_len == 0 || base[h->strings + h->strings_len - 1] != 0)
+		return( false );
+
+	const uint64_t *archives = (const uint64_t *) (base + h->archives);
+	for( uint32_t i = 0; i < h->num_archives; i++ )
+		if (archives[i] >= h->strings_len)
+			return( false );
+
+	// (every posting takes at least a byte)
+	const TextWord *words = (const TextWord *) (base + h->words);
+	for( uint32_t i = 0; i < h->num_words; i++ )
+		if (words[i].word >= h->strings_len ||
+				words[i].postings > h->postings_len ||
+				words[i].count > h->postings_len - words[i].postings)
+			return( false );
+	return( true );
+}
+
+/*
+ * routine:	open
+ *
+ * purpose:	map an index file, and make sure it is one of ours
+ *		(written on this kind of machine)
+ *
+ * returns:	a new TextIndex (or 0 if it is not usable)
+ */
+TextIndex *TextIndex::open( const char *path ) {
+	int fd = ::open( path, O_RDONLY );
+	if (fd < 0)
+		return( 0 );
+
+	struct stat st;
+	if (fstat( fd, &st ) != 0 || (size_t) st.st_size < sizeof (TextIndexHeader)) {
+		close( fd );
+		return( 0 );
+	}
+	void *p = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if (p == MAP_FAILED)
+		return( 0 );
+
+	const TextIndexHeader *h = (const TextIndexHeader *) p;
+	size_t size = st.st_size;
+	if (memcmp( h->magic, TEXT_MAGIC, sizeof TEXT_MAGIC ) != 0 ||
+			h->version != TEXT_VERSION ||
+			h->byteorder != TEXT_BYTEORDER ||
+			!valid( h, size )) {
+		munmap( p, size );
+		return( 0 );
+	}
+
+	TextIndex *t = new TextIndex;
+	t->_base = (const char *) p;
+	t->_size = size;
+	t->_hdr = h;
+	t->_words = (const TextWord *) (t->_base + h->words);
+	t->_postings = (const unsigned char *) t->_base + h->postings;
+	t->_strings = t->_base + h->strings;
+	return( t );
+}
+
+TextIndex::~TextIndex() {
+	munmap( (void *) _base, _size );
+}
+
+// binary search of the (sorted) words
+const TextWord *TextIndex::find( const char *word ) {
+	long lo = 0;
+	long hi = _hdr->num_words;
+	while( lo < hi ) {
+		long mid = (lo + hi) / 2;
+		int c = strcmp( _strings + _words[mid].word, word );
+		if (c == 0)
+			return( &_words[mid] );
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return( 0 );
+}
+
+// decode a word's postings
+long TextIndex::postings( const TextWord *w, uint64_t *keys ) {
+	const unsigned char *p = _postings + w->postings;
+	const unsigned char *end = _postings + _hdr->postings_len;
+	uint64_t key = 0;
+	for( uint32_t i = 0; i < w->count; i++ ) {
+		uint64_t delta = 0;
+		int shift = 0;
+		while( p < end && (*p & 0x80) ) {
+			delta |= (uint64_t) (*p++ & 0x7f) << shift;
+			shift += 7;
+		}
+		if (p == end)
+			return( i );	// (a damaged index)
+		delta |= (uint64_t) *p++ << shift;
+		key += delta;
+		keys[i] = key;
+	}
+	return( w->count );
+}
+
+/*
+ * routine:	search
+ *
+ * purpose:	find the records that contain all of the words
+ *
+ * note:	the words are looked up first, and the lists are
+ *		intersected starting with the shortest.
+ *
+ * returns:	number of records found (and a malloc'd list of
+ *		their keys), or -1 if some word is not indexed
+ */
+long TextIndex::search( const char **words, int n, uint64_t **keys ) {
+	*keys = 0;
+	if (n <= 0)
+		return( -1 );
+
+	const TextWord **w = (const TextWord **) malloc( n * sizeof (TextWord *) );
+	for( int i = 0; i < n; i++ ) {
+		w[i] = find( words[i] );
+		if (w[i] == 0) {
+			free( w );
+			return( -1 );
+		}
+	}
+	int shortest = 0;
+	for( int i = 1; i < n; i++ )
+		if (w[i]->count < w[shortest]->count)
+			shortest = i;
+
+	uint64_t *result = (uint64_t *) malloc( (w[shortest]->count + 1) * sizeof (uint64_t) );
+	long found = postings( w[shortest], result );
+
+	uint64_t *other = 0;
+	for( int i = 0; i < n && found > 0; i++ ) {
+		if (i == shortest)
+			continue;
+		other = (uint64_t *) realloc( other, (w[i]->count + 1) * sizeof (uint64_t) );
+		long m = postings( w[i], other );
+
+		// both lists are sorted, so merge them
+		long k = 0;
+		long j = 0;
+		for( long r = 0; r < found; r++ ) {
+			while( j < m && other[j] < result[r] )
+				j++;
+			if (j < m && other[j] == result[r])
+				result[k++] = result[r];
+		}
+		found = k;
+	}
+
+	free( other );
+	free( w );
+	*keys = result;
+	return( found );
+}
@@ -0,0 +1,126 @@
+/*
+ * module:	dbtext.h
+ *
+ * purpose:	a full-text (inverted) index over the summaries and
+ *		notes of any number of datebook archives
+ *
+ * note:	the words of each record are folded to lower case and
+ *		indexed by (archive, record ID).  The index file holds
+ *		the sorted list of words, and for each word the sorted
+ *		list of the records it appears in, stored as varint
+ *		encoded differences.  Like a cache file, it is in a
+ *		native layout that is simply mapped into memory, so a
+ *		search never has to go back to the archives.
+ */
+#ifndef _DBTEXT_H
+#define _DBTEXT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dbdecode.h"
+#include "strpool.h"
+
+static const uint32_t TEXT_VERSION = 1;
+static const uint32_t TEXT_BYTEORDER = 0x01020304;
+
+// the longest word we index (longer ones are cut short)
+static const int TEXT_MAX_WORD = 64;
+
+// file header (all offsets are from the start of the file)
+struct TextIndexHeader {
+	char		magic[8];	// "PALMTXT"
+	uint32_t	version;
+	uint32_t	byteorder;	// TEXT_BYTEORDER, as written
+	uint32_t	num_archives;
+	uint32_t	num_words;
+	uint64_t	archives;	// uint64_t [num_archives] (heap offsets)
+	uint64_t	words;		// TextWord [num_words], sorted
+	uint64_t	postings;	// varint deltas
+	uint64_t	postings_len;
+	uint64_t	strings;	// NUL terminated strings
+	uint64_t	strings_len;
+};
+
+// one word, and where to find its records
+struct TextWord {
+	uint64_t	word;		// string heap offset
+	uint64_t	postings;	// offset within the postings
+	uint32_t	count;		// number of records
+	uint32_t	pad;
+};
+
+// a record, as the index knows it
+static inline uint64_t text_key( uint32_t archive, uint32_t rid ) {
+	return( ((uint64_t) archive << 32) | rid );
+}
+
+struct text_posting;
+
+/*
+ * collects the words of the records it visits (from as many
+ * archives as you like), and writes the index
+ */
+class TextIndexBuilder : public DatebookVisitor {
+   public:
+	TextIndexBuilder();
+	~TextIndexBuilder();
+
+	// the archive the coming records come from
+	void setArchive( const char *name );
+
+	bool onRecord( const DatebookRecord & );
+
+	// (for the current record)
+	void addWord( const char *word, unsigned len );
+
+	// write out the index (0 on success)
+	int write( const char *path );
+
+   private:
+	StringPool	_words;
+	struct text_posting *_postings;
+	long		_num_postings;
+	long		_max_postings;
+	const char	**_archives;	// (interned)
+	uint32_t	_num_archives;
+	uint32_t	_max_archives;
+	uint64_t	_key;		// of the current record
+};
+
+class TextIndex {
+   public:
+	// map an index file (0 if it is not a usable one)
+	static TextIndex *open( const char *path );
+	~TextIndex();
+
+	// the records containing all of the words (caller frees,
+	// returns the count, or -1 if some word is not indexed)
+	long search( const char **words, int n, uint64_t **keys );
+
+	const char *archive( uint32_t i ) {
+		return( (i < _hdr->num_archives) ?
+			_strings + ((const uint64_t *) (_base + _hdr->archives))[i] : 0 );
+	}
+
+   private:
+	TextIndex() {}
+	const TextWord *find( const char *word );
+	long postings( const TextWord *w, uint64_t *keys );
+
+	const char	*_base;		// the mapped file
+	size_t		_size;
+	const TextIndexHeader *_hdr;
+	const TextWord	*_words;
+	const unsigned char *_postings;
+	const char	*_strings;
+};
+
+// break text into (lower case) words; returns the number found
+int text_words( const char *s, unsigned len,
+		void (*f)( const char *word, unsigned len, void *arg ), void *arg );
+
+// convert UTF-8 text (e.g. a query) to the Palm's Latin-1 (out must
+// have room for len bytes): returns the length of the result
+size_t utf8_to_latin1( const char *s, size_t len, char *out );
+
+#endif
@@ -0,0 +1,804 @@
+/*
+ * module:	icsparse.cpp
+ *
+ * purpose:	a streaming iCalendar parser, producing DatebookRecords
+ *
+ * note:	lines are found with memchr in the mapped file, and a
+ *		line is only copied if it was folded (continued on lines
+ *		that start with white space).  Every so often, the part
+ *		of the mapping we have finished with is given back, so
+ *		the pages of a huge file do not pile up.
+ *
+ *		Repetitions are mapped onto the Palm's kinds (daily,
+ *		weekly by days, monthly by day or date, yearly by date).
+ *		An RRULE they cannot express leaves the event as a single
+ *		occurrence (with a complaint, when verbose).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "icsparse.h"
+#include "dbtext.h"
+#include "dbencode.h"
+#include "tzone.h"
+
+extern bool verbose;	// commentary on what we find
+
+static const long DAY = 24 * 60 * 60;
+static const size_t ICS_RELEASE = 16 * 1024 * 1024;	// give back this much at a time
+static const size_t ICS_CATEGORY_LEN = 15;		// (the Palm's limit)
+
+// a (logical) content line: NAME;PARAMS:VALUE
+struct ics_line {
+	const char	*name;
+	size_t		name_len;
+	const char	*params;	// (after the first ';')
+	size_t		params_len;
+	const char	*value;
+	size_t		value_len;
+	bool		copied;		// (unfolded, into _line)
+};
+
+static bool is( const char *s, size_t len, const char *word ) {
+	size_t n = strlen( word );
+	return( len == n && strncasecmp( s, word, n ) == 0 );
+}
+#define	NAME_IS(l,w)	is( (l)->name, (l)->name_len, w )
+#define	VALUE_IS(l,w)	is( (l)->value, (l)->value_len, w )
+
+static char *grow( char *buf, size_t *size, size_t need ) {
+	if (need > *size) {
+		size_t n = *size ? *size : 256;
+		while( n < need )
+			n *= 2;
+		buf = (char *) realloc( buf, n );
+		*size = n;
+	}
+	return( buf );
+}
+
+/*
+ * routine:	unescape
+ *
+ * purpose:	turn an iCalendar TEXT value into Palm text: undo the
+ *		escapes, and convert UTF-8 to Latin-1
+ *
+ * returns:	the length of the result (out must have room for len+1)
+ */
+static size_t unescape( const char *v, size_t len, char *out ) {
+	char *o = out;
+	for( size_t i = 0; i < len; ) {
+		if (v[i] == '\\' && i + 1 < len) {
+			unsigned char c = v[i+1];
+			*o++ = (c == 'n' || c == 'N') ? '\n' : c;
+			i += 2;
+			continue;
+		}
+		// (no UTF-8 sequence has a backslash in it)
+		size_t e = i + 1;
+		while( e < len && !(v[e] == '\\' && e + 1 < len) )
+			e++;
+		o += utf8_to_latin1( v + i, e - i, o );
+		i = e;
+	}
+	*o = 0;
+	return( o - out );
+}
+
+// find a parameter (e.g. TZID) of a property
+static bool param( const struct ics_line *l, const char *name,
+		const char **v, size_t *len ) {
+	const char *p = l->params;
+	const char *end = p + l->params_len;
+	size_t n = strlen( name );
+	while( p < end ) {
+		const char *e = p;
+		bool quoted = false;
+		while( e < end && (quoted || *e != ';') ) {
+			if (*e == '"')
+				quoted = !quoted;
+			e++;
+		}
+		if ((size_t) (e - p) > n && p[n] == '=' && strncasecmp( p, name, n ) == 0) {
+			*v = p + n + 1;
+			*len = e - *v;
+			if (*len >= 2 && **v == '"') {
+				(*v)++;
+				*len -= 2;
+			}
+			return( true );
+		}
+		p = e + 1;
+	}
+	return( false );
+}
+
+static bool digits( const char *s, size_t n ) {
+	for( size_t i = 0; i < n; i++ )
+		if (!isdigit( (unsigned char) s[i] ))
+			return( false );
+	return( true );
+}
+
+static int number( const char *s, size_t n ) {
+	int v = 0;
+	for( size_t i = 0; i < n; i++ )
+		v = 10 * v + (s[i] - '0');
+	return( v );
+}
+
+/*
+ * routine:	parse_time
+ *
+ * purpose:	parse a DATE (yyyymmdd) or DATE-TIME (yyyymmddThhmmss[Z])
+ *		into device local time
+ */
+static bool parse_time( const char *v, size_t len, time_t *t, bool *date ) {
+	if (len < 8 || !digits( v, 8 ))
+		return( false );
+	struct tm tm;
+	memset( &tm, 0, sizeof tm );
+	tm.tm_year = number( v, 4 ) - 1900;
+	tm.tm_mon = number( v + 4, 2 ) - 1;
+	tm.tm_mday = number( v + 6, 2 );
+	bool utc = false;
+	if (len == 8)
+		*date = true;
+	else if (len >= 15 && (v[8] == 'T' || v[8] == 't') && digits( v + 9, 6 )) {
+		tm.tm_hour = number( v + 9, 2 );
+		tm.tm_min = number( v + 11, 2 );
+		tm.tm_sec = number( v + 13, 2 );
+		utc = (len == 16 && (v[15] == 'Z' || v[15] == 'z'));
+		if (len > 15 && !utc)
+			return( false );
+		*date = false;
+	} else
+		return( false );
+	*t = timegm( &tm );
+	if (utc && local_zone)
+		*t = local_zone->local( *t );
+	return( true );
+}
+
+/*
+ * routine:	parse_duration
+ *
+ * purpose:	parse a DURATION ([+-]P[nW][nD][T[nH][nM][nS]])
+ */
+static bool parse_duration( const char *v, size_t len, long *secs ) {
+	size_t i = 0;
+	int sign = 1;
+	if (i < len && (v[i] == '+' || v[i] == '-'))
+		sign = (v[i++] == '-') ? -1 : 1;
+	if (i >= len || (v[i] != 'P' && v[i] != 'p'))
+		return( false );
+	i++;
+	long total = 0;
+	bool any = false;
+	while( i < len ) {
+		if (v[i] == 'T' || v[i] == 't') {
+			i++;
+			continue;
+		}
+		size_t d = i;
+		long n = 0;
+		while( i < len && isdigit( (unsigned char) v[i] ) )
+			n = 10 * n + (v[i++] - '0');
+		if (i == d || i >= len)
+			return( false );
+		switch( toupper( v[i++] ) ) {
+		case 'W':	n *= 7 * DAY;	break;
+		case 'D':	n *= DAY;	break;
+		case 'H':	n *= 60 * 60;	break;
+		case 'M':	n *= 60;	break;
+		case 'S':			break;
+		default:	return( false );
+		}
+		total += n;
+		any = true;
+	}
+	*secs = sign * total;
+	return( any );
+}
+
+IcsParser::IcsParser( const char *path ) {
+	_path = path;
+	_errstr = 0;
+	_base = 0;
+	_size = 0;
+	_pos = 0;
+	_released = 0;
+	_lineno = 0;
+	_line = 0;
+	_line_size = 0;
+	_summary = 0;
+	_summary_size = 0;
+	_note = 0;
+	_note_size = 0;
+	_rule = 0;
+	_rule_size = 0;
+	_rule_len = 0;
+	_excepts = 0;
+	_num_excepts = 0;
+	_max_excepts = 0;
+	_categories = 0;
+	_num_categories = 0;
+	_skipped = 0;
+
+	int fd = open( path, O_RDONLY );
+	if (fd < 0) {
+		_errstr = "open failed";
+		return;
+	}
+	struct stat st;
+	if (fstat( fd, &st ) != 0) {
+		_errstr = "stat failed";
+		close( fd );
+		return;
+	}
+	if (st.st_size > 0) {
+		void *p = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if (p == MAP_FAILED)
+			_errstr = "mmap failed";
+		else {
+			_base = (const char *) p;
+			_size = st.st_size;
+			madvise( p, _size, MADV_SEQUENTIAL );
+		}
+	}
+	close( fd );
+}
+
+IcsParser::~IcsParser() {
+	if (_base)
+		munmap( (void *) _base, _size );
+	free( _line );
+	free( _summary );
+	free( _note );
+	free( _rule );
+	free( _excepts );
+}
+
+/*
+ * routine:	readLine
+ *
+ * purpose:	find the next content line, and its parts
+ *
+ * returns:	bool (false at the end of the file)
+ *
+ * note:	the parts are views into the mapping (or, if the line
+ *		was folded, into _line), good until the next call.
+ */
+bool IcsParser::readLine( struct ics_line *l ) {
+	const char *end = _base + _size;
+	for( ;; ) {
+		if (_pos >= _size)
+			return( false );
+		const char *p = _base + _pos;
+		const char *nl = (const char *) memchr( p, '\n', end - p );
+		const char *e = nl ? nl : end;
+		_pos = (nl ? nl + 1 : end) - _base;
+		_lineno++;
+		size_t len = e - p;
+		if (len > 0 && p[len-1] == '\r')
+			len--;
+
+		const char *s = p;
+		l->copied = false;
+		if (_pos < _size && (_base[_pos] == ' ' || _base[_pos] == '\t')) {
+			// a folded line: put the pieces back together
+			size_t n = 0;
+			_line = grow( _line, &_line_size, len );
+			memcpy( _line, p, len );
+			n = len;
+			while( _pos < _size && (_base[_pos] == ' ' || _base[_pos] == '\t') ) {
+				p = _base + _pos + 1;
+				nl = (const char *) memchr( p, '\n', end - p );
+				e = nl ? nl : end;
+				_pos = (nl ? nl + 1 : end) - _base;
+				_lineno++;
+				len = e - p;
+				if (len > 0 && p[len-1] == '\r')
+					len--;
+				_line = grow( _line, &_line_size, n + len );
+				memcpy( _line + n, p, len );
+				n += len;
+			}
+			s = _line;
+			len = n;
+			l->copied = true;
+		}
+
+		// NAME, then ;PARAMS (which may quote a ':'), then :VALUE
+		const char *q = s;
+		const char *qe = s + len;
+		while( q < qe && *q != ';' && *q != ':' )
+			q++;
+		l->name = s;
+		l->name_len = q - s;
+		l->params = q;
+		l->params_len = 0;
+		if (q < qe && *q == ';') {
+			l->params = ++q;
+			bool quoted = false;
+			while( q < qe && (quoted || *q != ':') ) {
+				if (*q == '"')
+					quoted = !quoted;
+				q++;
+			}
+			l->params_len = q - l->params;
+		}
+		if (q >= qe)
+			continue;	// (blank, or not a content line)
+		l->value = q + 1;
+		l->value_len = qe - q - 1;
+		return( true );
+	}
+}
+
+// start again from the top of the file
+void IcsParser::rewind() {
+	_pos = 0;
+	_lineno = 0;
+	_released = 0;
+}
+
+// give back the pages we are done with (they would be read again if need be)
+void IcsParser::release() {
+	size_t upto = _pos & ~(ICS_RELEASE - 1);
+	if (upto > _released) {
+		madvise( (void *) (_base + _released), upto - _released, MADV_DONTNEED );
+		_released = upto;
+	}
+}
+
+/*
+ * routine:	text
+ *
+ * purpose:	get a TEXT value as a PalmString: a view of the value
+ *		itself if we can, or else a converted copy in a buffer
+ */
+bool IcsParser::text( const struct ics_line *l, char **buf, size_t *size, PalmString *s ) {
+	const char *v = l->value;
+	size_t len = l->value_len;
+	bool plain = !l->copied;
+	for( size_t i = 0; plain && i < len; i++ )
+		if (v[i] == '\\' || (v[i] & 0x80))
+			plain = false;
+	if (plain) {
+		s->str = len ? v : 0;
+		s->len = len;
+		return( true );
+	}
+	*buf = grow( *buf, size, len + 1 );
+	s->len = unescape( v, len, *buf );
+	s->str = s->len ? *buf : 0;
+	return( true );
+}
+
+/*
+ * routine:	first_category
+ *
+ * purpose:	the first name in a CATEGORIES list, as a Palm category
+ *		(name must have room for ICS_CATEGORY_LEN+1)
+ */
+static void first_category( const char *s, size_t len, char *name ) {
+	const char *e = s;
+	while( e < s + len && *e != ',' )
+		e += (*e == '\\' && e + 1 < s + len) ? 2 : 1;
+	// (no character takes more than 4 bytes)
+	char tmp[4 * ICS_CATEGORY_LEN + 1];
+	size_t n = e - s;
+	if (n > sizeof tmp - 1)
+		n = sizeof tmp - 1;
+	n = unescape( s, n, tmp );
+	if (n > ICS_CATEGORY_LEN)
+		n = ICS_CATEGORY_LEN;
+	memcpy( name, tmp, n );
+	name[n] = 0;
+}
+
+// the index of a category, or -1
+int IcsParser::category( const char *name ) {
+	for( int i = 0; i < _num_categories; i++ )
+		if (_categories[i] && strcmp( _categories[i], name ) == 0)
+			return( i );
+	return( -1 );
+}
+
+/*
+ * routine:	scanCategories
+ *
+ * purpose:	a quick pass over the file, for the category names
+ *		(which have to be in the archive header, ahead of the
+ *		records that use them)
+ */
+void IcsParser::scanCategories( char **names, int *num, int max ) {
+	struct ics_line l;
+	bool in_event = false;
+	bool full = false;		// (complain just once)
+	rewind();
+	_categories = names;
+	while( readLine( &l ) ) {
+		release();
+		if (NAME_IS( &l, "BEGIN" ) && VALUE_IS( &l, "VEVENT" ))
+			in_event = true;
+		else if (NAME_IS( &l, "END" ) && VALUE_IS( &l, "VEVENT" ))
+			in_event = false;
+		else if (in_event && NAME_IS( &l, "CATEGORIES" )) {
+			char name[ICS_CATEGORY_LEN + 1];
+			first_category( l.value, l.value_len, name );
+			_num_categories = *num;
+			if (name[0] == 0 || category( name ) >= 0)
+				continue;
+			if (*num < max)
+				names[(*num)++] = strdup( name );
+			else {
+				if (verbose && !full)
+					fprintf( stderr, "%s: too many categories, %s (and any "
+							"others) will be Unfiled\n", _path, name );
+				full = true;
+			}
+		}
+	}
+	_categories = 0;
+	_num_categories = 0;
+	rewind();
+}
+
+// add the dates of an EXDATE to the exception list
+void IcsParser::exdates( const struct ics_line *l ) {
+	const char *p = l->value;
+	const char *end = p + l->value_len;
+	while( p < end ) {
+		const char *e = (const char *) memchr( p, ',', end - p );
+		if (e == 0)
+			e = end;
+		time_t t;
+		bool date;
+		if (parse_time( p, e - p, &t, &date )) {
+			if (_num_excepts == _max_excepts) {
+				_max_excepts = _max_excepts ? 2 * _max_excepts : 16;
+				_excepts = (unsigned long *) realloc( _excepts,
+						_max_excepts * sizeof (unsigned long) );
+			}
+			// (an exception is a whole day)
+			_excepts[_num_excepts++] = t - (t % DAY);
+		}
+		p = e + 1;
+	}
+}
+
+// the floor of a time in days (for times before 1970, too)
+static long day_of( time_t t ) {
+	return( (t >= 0) ? t / DAY : (t - DAY + 1) / DAY );
+}
+
+/*
+ * is an occurrence in a period (day, week, month or year, counted
+ * from the first) that the record's interval does not skip
+ */
+static bool on_interval( const DatebookRecord &r, time_t t ) {
+	if (r.interval <= 1)
+		return( true );
+
+	long n;
+	struct tm a, b;
+	gmtime_r( &r.start_time, &a );
+	gmtime_r( &t, &b );
+	switch( r.brand ) {
+	case 1:
+		n = day_of( t ) - day_of( r.start_time );
+		break;
+	case 2: {	// (weeks start on wstart)
+		long d0 = day_of( r.start_time );
+		long d1 = day_of( t );
+		d0 -= (a.tm_wday - (long) r.wstart + 7) % 7;
+		d1 -= (b.tm_wday - (long) r.wstart + 7) % 7;
+		n = (d1 - d0) / 7;
+		break;
+	}
+	case 3:
+	case 4:
+		n = (b.tm_year - a.tm_year) * 12 + b.tm_mon - a.tm_mon;
+		break;
+	default:
+		n = b.tm_year - a.tm_year;
+		break;
+	}
+	return( n % (long) r.interval == 0 );
+}
+
+/*
+ * routine:	rule
+ *
+ * purpose:	express an RRULE as a Palm repeat
+ *
+ * returns:	bool (false if the Palm has no way to say it)
+ */
+bool IcsParser::rule( const char *s, size_t len, DatebookRecord &r ) {
+	static const char *days[] = { "SU", "MO", "TU", "WE", "TH", "FR", "SA" };
+	const char *freq = 0;
+	size_t freq_len = 0;
+	long interval = 1;
+	long count = 0;
+	time_t until = 0;
+	bool until_date = false;
+	unsigned char mask = 0;
+	int ordinal = 0;
+	int byday = 0;
+	int mday = 0;
+	int month = 0;
+	int wkst = 0;
+
+	const char *end = s + len;
+	for( const char *p = s; p < end; ) {
+		const char *e = (const char *) memchr( p, ';', end - p );
+		if (e == 0)
+			e = end;
+		const char *eq = (const char *) memchr( p, '=', e - p );
+		if (eq == 0)
+			return( false );
+		const char *v = eq + 1;
+		size_t vlen = e - v;
+		if (is( p, eq - p, "FREQ" )) {
+			freq = v;
+			freq_len = vlen;
+		} else if (is( p, eq - p, "INTERVAL" ))
+			interval = strtol( v, 0, 10 );
+		else if (is( p, eq - p, "COUNT" ))
+			count = strtol( v, 0, 10 );
+		else if (is( p, eq - p, "UNTIL" )) {
+			if (!parse_time( v, vlen, &until, &until_date ))
+				return( false );
+		} else if (is( p, eq - p, "BYDAY" )) {
+			for( const char *d = v; d < e; ) {
+				const char *de = (const char *) memchr( d, ',', e - d );
+				if (de == 0)
+					de = e;
+				if (de - d < 2)
+					return( false );
+				int w;
+				for( w = 0; w < 7; w++ )
+					if (is( de - 2, 2, days[w] ))
+						break;
+				if (w == 7)
+					return( false );
+				if (de - d > 2) {
+					if (ordinal != 0)
+						return( false );	// (only one nth day)
+					ordinal = strtol( d, 0, 10 );
+				}
+				mask |= 1 << w;
+				byday++;
+				d = de + 1;
+			}
+		} else if (is( p, eq - p, "BYMONTHDAY" )) {
+			if (memchr( v, ',', vlen ) || (mday = strtol( v, 0, 10 )) <= 0)
+				return( false );
+		} else if (is( p, eq - p, "BYMONTH" )) {
+			if (memchr( v, ',', vlen ) || (month = strtol( v, 0, 10 )) <= 0)
+				return( false );
+		} else if (is( p, eq - p, "WKST" )) {
+			for( wkst = 0; wkst < 7 && !is( v, vlen, days[wkst] ); wkst++ )
+				;
+			if (wkst == 7)
+				wkst = 0;
+		} else
+			return( false );	// (BYSETPOS, BYWEEKNO, ...)
+		p = e + 1;
+	}
+	if (freq == 0 || interval <= 0 || count < 0)
+		return( false );
+
+	struct tm tm;
+	gmtime_r( &r.start_time, &tm );
+	if (is( freq, freq_len, "DAILY" )) {
+		if (byday || mday || month)
+			return( false );
+		r.brand = 1;
+	} else if (is( freq, freq_len, "WEEKLY" )) {
+		if (ordinal || mday || month)
+			return( false );
+		r.brand = 2;
+		r.day_mask = mask ? mask : (1 << tm.tm_wday);
+	} else if (is( freq, freq_len, "MONTHLY" )) {
+		if (month)
+			return( false );
+		if (byday) {
+			// (the nth, 1-5, such day of the month: week_x is
+			// read as days 7n-6 to 7n, so there is no "last")
+			if (byday != 1 || mday || ordinal < 1 || ordinal > 5)
+				return( false );
+			r.brand = 3;
+			r.day_x = ffs( mask );		// (1 is Sunday)
+			r.week_x = ordinal;
+		} else {
+			r.brand = 4;
+			r.day_num = mday ? mday : tm.tm_mday;
+		}
+	} else if (is( freq, freq_len, "YEARLY" )) {
+		if (byday)
+			return( false );
+		r.brand = 5;
+		r.mon_x = month ? month - 1 : tm.tm_mon;
+		r.day_num = mday ? mday : tm.tm_mday;
+	} else
+		return( false );
+	r.interval = interval;
+	r.wstart = wkst;
+
+	// when it ends (the day after the last occurrence)
+	r.enddate = DBA_NO_END;
+	if (until != 0) {
+		if (until < r.start_time)
+			return( false );
+		time_t e = until_date ? until + DAY : until + 1;
+		if (e < (time_t) DBA_NO_END)
+			r.enddate = e;
+	} else if (count > 0) {
+		// (just as far as the last one, counting only those in
+		// the periods the interval keeps)
+		unsigned short n = r.num_except;
+		r.num_except = 0;	// (COUNT counts the exceptions, too)
+		DatebookInstances instances( r );
+		time_t last = 0, t, end;
+		long found = 0;
+		while( found < count && instances.next( &t, &end ) )
+			if (on_interval( r, t )) {
+				last = t;
+				found++;
+			}
+		r.num_except = n;
+		if (found == count)
+			r.enddate = last - (last % DAY) + DAY;
+	}
+	return( true );
+}
+
+/*
+ * routine:	event
+ *
+ * purpose:	turn the rest of a VEVENT (after its BEGIN) into a record
+ *
+ * returns:	bool (false if it could not be made into one)
+ */
+bool IcsParser::event( DatebookRecord &r ) {
+	memset( &r, 0, sizeof r );
+	bool have_start = false, have_end = false, have_duration = false;
+	bool date = false, end_date = false;
+	bool cancelled = false;
+	bool done = false;
+	time_t end = 0;
+	long duration = 0;
+	int depth = 0;			// (inside a VALARM, or some other component)
+	bool alarm = false;
+	_rule_len = 0;
+	_num_excepts = 0;
+
+	struct ics_line l;
+	while( !done && readLine( &l ) ) {
+		if (NAME_IS( &l, "BEGIN" )) {
+			if (depth++ == 0)
+				alarm = VALUE_IS( &l, "VALARM" );
+		} else if (NAME_IS( &l, "END" )) {
+			if (depth == 0)
+				done = true;
+			else if (--depth == 0)
+				alarm = false;
+		} else if (alarm) {
+			long advance;
+			const char *v;
+			size_t vlen;
+			if (NAME_IS( &l, "TRIGGER" ) && !param( &l, "VALUE", &v, &vlen ) &&
+					parse_duration( l.value, l.value_len, &advance ) &&
+					advance <= 0) {
+				advance = -advance;
+				r.alarm_set = true;
+				if (advance > 0 && advance % DAY == 0) {
+					r.alarm_units = advance / DAY;
+					r.alarm_type = 2;
+				} else if (advance > 0 && advance % (60 * 60) == 0) {
+					r.alarm_units = advance / (60 * 60);
+					r.alarm_type = 1;
+				} else {
+					r.alarm_units = advance / 60;
+					r.alarm_type = 0;
+				}
+			}
+		} else if (depth > 0)
+			continue;
+		else if (NAME_IS( &l, "DTSTART" ))
+			have_start = parse_time( l.value, l.value_len, &r.start_time, &date );
+		else if (NAME_IS( &l, "DTEND" ))
+			have_end = parse_time( l.value, l.value_len, &end, &end_date );
+		else if (NAME_IS( &l, "DURATION" ))
+			have_duration = parse_duration( l.value, l.value_len, &duration );
+		else if (NAME_IS( &l, "SUMMARY" ))
+			text( &l, &_summary, &_summary_size, &r.summary );
+		else if (NAME_IS( &l, "DESCRIPTION" ))
+			text( &l, &_note, &_note_size, &r.description );
+		else if (NAME_IS( &l, "CLASS" ))
+			r.pvt = !VALUE_IS( &l, "PUBLIC" );
+		else if (NAME_IS( &l, "STATUS" ))
+			cancelled = VALUE_IS( &l, "CANCELLED" );
+		else if (NAME_IS( &l, "CATEGORIES" )) {
+			char name[ICS_CATEGORY_LEN + 1];
+			first_category( l.value, l.value_len, name );
+			int c = category( name );
+			r.category = (c < 0) ? 0 : c;
+		}
+		else if (NAME_IS( &l, "EXDATE" ))
+			exdates( &l );
+		else if (NAME_IS( &l, "RRULE" )) {
+			// (we need DTSTART to make sense of it)
+			_rule = grow( _rule, &_rule_size, l.value_len + 1 );
+			memcpy( _rule, l.value, l.value_len );
+			_rule[l.value_len] = 0;		// (so strtol stops)
+			_rule_len = l.value_len;
+		}
+	}
+	if (!done || !have_start || cancelled)
+		return( false );
+	if (r.start_time < 0 || r.start_time > 0xffffffffL)
+		return( false );
+
+	if (date) {
+		r.allday = true;
+		r.end_time = r.start_time;
+	} else if (have_end && end > r.start_time)
+		r.end_time = end;
+	else if (have_duration && duration > 0)
+		r.end_time = r.start_time + duration;
+	else
+		r.end_time = r.start_time;
+
+	r.num_except = _num_excepts;
+	r.excepts = _excepts;
+	if (_rule_len > 0 && !rule( _rule, _rule_len, r )) {
+		if (verbose)
+			fprintf( stderr, "%s, line %ld: RRULE:%.*s is not supported, "
+					"only the first occurrence is kept\n",
+					_path, _lineno, (int) _rule_len, _rule );
+		r.brand = 0;
+		r.day_mask = 0;
+		r.day_x = r.week_x = r.day_num = r.mon_x = 0;
+		r.interval = r.enddate = r.wstart = 0;
+	}
+	if (r.brand == 0) {
+		r.num_except = 0;	// (nothing to make exceptions of)
+		r.excepts = 0;
+	}
+	return( true );
+}
+
+/*
+ * routine:	next
+ *
+ * purpose:	find the next VEVENT, and make a record of it
+ *
+ * returns:	bool (false at the end of the file)
+ */
+bool IcsParser::next( DatebookRecord &r ) {
+	// (nothing before here is referred to any more)
+	release();
+
+	struct ics_line l;
+	while( readLine( &l ) ) {
+		if (!NAME_IS( &l, "BEGIN" ) || !VALUE_IS( &l, "VEVENT" ))
+			continue;
+		if (event( r ))
+			return( true );
+		_skipped++;
+		if (verbose)
+			fprintf( stderr, "%s, line %ld: event skipped\n", _path, _lineno );
+	}
+	return( false );
+}
@@ -0,0 +1,87 @@
+/*
+ * module:	icsparse.h
+ *
+ * purpose:	a streaming iCalendar (.ics) parser, that turns each
+ *		VEVENT into a DatebookRecord (for the archive encoder)
+ *
+ * note:	the file is mapped, and a record's strings are views
+ *		straight into the mapping: a value is only copied if it
+ *		was folded across lines, has escapes in it, or has to be
+ *		converted from UTF-8 to the Palm's Latin-1.  What has
+ *		already been parsed is dropped from the mapping as we
+ *		go, so even a multi-GB calendar is parsed in bounded
+ *		memory.
+ *
+ *		Times are taken as device local time: UTC ('Z') times
+ *		are converted to local_zone (if there is one), and TZID
+ *		and floating times are taken as they are.
+ */
+#ifndef _ICSPARSE_H
+#define _ICSPARSE_H
+
+#include <stddef.h>
+#include "dbdecode.h"
+
+struct ics_line;
+
+class IcsParser {
+   public:
+	IcsParser( const char *path );
+	~IcsParser();
+
+	// 0, or why the file could not be opened
+	const char *error()	{ return( _errstr ); }
+
+	// add the categories this file uses (the first of each event's
+	// CATEGORIES) to a list of names, of at most max entries
+	void scanCategories( char **names, int *num, int max );
+
+	// the category list that CATEGORIES are looked up in
+	void setCategories( char * const *names, int num )
+				{ _categories = names; _num_categories = num; }
+
+	// the next event (false at the end of the file): its strings
+	// (which are not NUL terminated) and exceptions are good until
+	// the next call.  Numbering the records is up to the caller.
+	bool next( DatebookRecord & );
+
+	// events we could not make a record of
+	long skipped()		{ return( _skipped ); }
+
+   private:
+	bool readLine( struct ics_line * );
+	void rewind();
+	void release();
+	bool event( DatebookRecord & );
+	bool text( const struct ics_line *, char **buf, size_t *size, PalmString * );
+	bool rule( const char *s, size_t len, DatebookRecord & );
+	void exdates( const struct ics_line * );
+	int category( const char *name );
+
+	const char	*_path;
+	const char	*_errstr;
+	const char	*_base;		// the mapped file
+	size_t		_size;
+	size_t		_pos;		// where the next line starts
+	size_t		_released;	// (what has been dropped)
+	long		_lineno;
+
+	char		*_line;		// an unfolded line
+	size_t		_line_size;
+	char		*_summary;	// copied (unescaped) strings
+	size_t		_summary_size;
+	char		*_note;
+	size_t		_note_size;
+	char		*_rule;		// the event's RRULE (until DTSTART is known)
+	size_t		_rule_size;
+	size_t		_rule_len;
+	unsigned long	*_excepts;
+	int		_num_excepts;
+	int		_max_excepts;
+
+	char * const	*_categories;
+	int		_num_categories;
+	long		_skipped;
+};
+
+#endif
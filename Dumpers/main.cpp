@@ -1,46 +1,393 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <getopt.h>
 #include "palmarchive.h"
+#include "dbformat.h"
+#include "dbarrow.h"
+#include "tzone.h"
+#include "dbshard.h"
+#include "palmload.h"
 
-bool verbose = false;
-bool whiny = false;
+extern bool verbose;	// (defined in libpalm)
+extern bool whiny;
 const char *format = 0;
+int threads = 1;
+const char *cachedir = 0;
+const char *diffbase = 0;
+time_t range_from = 0;		// only instances in [from, to)
+time_t range_to = 0;
+bool conflicts = false;
+bool freebusy = false;
+bool freebusy_daily = false;
+bool merge = false;
+size_t memory_limit = 0;	// sort instances (in this much memory)
+bool stats_report = false;
+const char *text_index = 0;	// build a full-text index
+const char *text_search = 0;	// search one
+const char *serve = 0;		// a socket to serve requests on
+const char *watch = 0;		// a directory to watch for archives
+int shard_by = 0;		// split the output (SHARD_YEAR, ...)
+int shard_pieces = 0;
+const char *encode = 0;		// write an archive (from .ics files)
 
 struct option opts[] = {
 		{"verbose", no_argument, 		0,	'v'},
 		{"whiny", 	no_argument,		0,	'w'},
 		{"format",	required_argument,	0,	'f'},
+		{"threads",	required_argument,	0,	't'},
+		{"cache",	required_argument,	0,	'c'},
+		{"diff",	required_argument,	0,	'd'},
+		{"range",	required_argument,	0,	'r'},
+		{"conflicts",	no_argument,		0,	'C'},
+		{"freebusy",	optional_argument,	0,	'B'},
+		{"merge",	no_argument,		0,	'm'},
+		{"memory-limit", required_argument,	0,	'M'},
+		{"stats-report", no_argument,		0,	'S'},
+		{"text-index",	required_argument,	0,	'I'},
+		{"search",	required_argument,	0,	's'},
+		{"tz",		required_argument,	0,	'z'},
+		{"serve",	required_argument,	0,	'L'},
+		{"watch",	required_argument,	0,	'W'},
+		{"shard",	required_argument,	0,	'P'},
+		{"encode",	required_argument,	0,	'E'},
+		{"batch-rows",	required_argument,	0,	'R'},
+		{"help",	no_argument,		0,	'h'},
 		{0, 0, 0, 0}
 };
 
+/*
+ * routine:	usage
+ *
+ * purpose:	a reminder of the options (on --help, or a bad one)
+ */
+static void usage( FILE *out ) {
+	fprintf( out,
+"usage: palm_datebook_dump [options] archive ...\n"
+"  -f, --format name       summary (the default), vcalendar, ndjson, csv,\n"
+"                          arrow (or ndjson-, csv-, arrow-records: a row per\n"
+"                          record, rather than per instance)\n"
+"  -t, --threads n         decode with n threads\n"
+"  -c, --cache dir         keep decoded archives in dir\n"
+"  -d, --diff old          only what changed since the old archive\n"
+"  -r, --range from,to     only instances in [from, to) (yyyy/mm/dd)\n"
+"  -C, --conflicts         overlapping appointments\n"
+"  -B, --freebusy[=day]    busy time (a VFREEBUSY, or one per day)\n"
+"  -m, --merge             the archives as one calendar, less duplicates\n"
+"  -M, --memory-limit n    instances in time order, sorted within n (e.g. 64m)\n"
+"  -S, --stats-report      statistics over all of the archives\n"
+"  -I, --text-index file   index the words of the archives\n"
+"  -s, --search file       the records (in an index) with all of the words\n"
+"  -z, --tz zone           the zone the device kept (e.g. Europe/Paris):\n"
+"                          times carry its offset (and are no longer\n"
+"                          marked UTC); a vcalendar has its VTIMEZONE\n"
+"                          after the events, as the span is known then\n"
+"  -L, --serve socket      convert archives on request\n"
+"  -W, --watch dir         convert archives as they turn up in dir\n"
+"  -P, --shard how         a calendar per year, category or count:N\n"
+"  -E, --encode archive    write an archive from .ics files\n"
+"  -R, --batch-rows n      rows per Arrow record batch\n"
+"  -v, --verbose           (and -w, --whiny) commentary\n" );
+}
+
 extern int process_datebook( PalmArchive *, const char *format );
+extern int process_cached_datebook( const char *, const char *dir, const char *format );
+extern int process_datebook_diff( const char *oldfile, const char *newfile,
+		const char *dir, const char *format );
+extern int process_datebook_merge( char **files, int n,
+		const char *dir, const char *format );
+extern int process_datebook_stats( char **files, int n );
+extern int process_text_index( char **files, int n, const char *path );
+extern int process_text_search( const char *path, char **words, int n );
+extern int serve_datebooks( const char *path );
+extern int watch_datebooks( const char *dir, const char *format );
+extern int process_datebook_shards( const char *filename, const char *format );
+extern int process_ics_encode( char **files, int n, const char *path );
 extern int process_memos( PalmArchive *);
 extern int process_todos( PalmArchive *);
 extern int process_addrs( PalmArchive *);
 
+/*
+ * routine:	parse_date
+ *
+ * purpose:	parse a yyyy/mm/dd[ hh:mm] (or yyyymmdd[Thhmm]) date
+ *		(which, like everything else in the archive, is in
+ *		device local time, as if it were GMT).
+ */
+static bool parse_date( const char *s, time_t *t ) {
+	struct tm tm;
+	memset( &tm, 0, sizeof tm );
+	int n = sscanf( s, "%d/%d/%d %d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min );
+	if (n < 3)
+		n = sscanf( s, "%4d%2d%2dT%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min );
+	if (n < 3)
+		return( false );
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	*t = timegm( &tm );
+	return( true );
+}
+
+/*
+ * routine:	parse_range
+ *
+ * purpose:	parse a from,to pair of dates
+ */
+bool parse_range( const char *s, time_t *from, time_t *to ) {
+	const char *comma = strchr( s, ',' );
+	if (comma == 0 || !parse_date( s, from ) || !parse_date( comma+1, to ))
+		return( false );
+	return( *to > *from );
+}
+
+/*
+ * routine:	parse_size
+ *
+ * purpose:	parse a size, with an optional k/m/g suffix
+ */
+static bool parse_size( const char *s, size_t *size ) {
+	char *end;
+	unsigned long long n = strtoull( s, &end, 10 );
+	switch( *end ) {
+	case 'g': case 'G':
+		n *= 1024;
+		// fall through
+	case 'm': case 'M':
+		n *= 1024;
+		// fall through
+	case 'k': case 'K':
+		n *= 1024;
+		end++;
+	}
+	if (end == s || *end != 0 || n == 0)
+		return( false );
+	*size = n;
+	return( true );
+}
 
 int main( int argc, char **argv ) {
 	int c;
 	int optx = 0;
-	while ((c = getopt_long(argc, argv, "vwf:", opts, &optx)) != -1) {
+	while ((c = getopt_long(argc, argv, "vwf:t:c:d:r:CB::mM:SI:s:z:L:W:P:E:R:h", opts, &optx)) != -1) {
 		switch(c) {
 		case 'w':
 			whiny = true;
-			// fallsthrough
+			// fall through
 		case 'v':
 			verbose = true;
 			break;
 
 		case 'f':
 			format = optarg;
+			if (!known_format( format )) {
+				fprintf( stderr, "unknown format: %s\n", format );
+				return( 1 );
+			}
+			break;
+
+		case 't':
+			threads = atoi( optarg );
+			break;
+
+		case 'c':
+			cachedir = optarg;
+			break;
+
+		case 'd':
+			diffbase = optarg;
+			break;
+
+		case 'r':
+			if (!parse_range( optarg, &range_from, &range_to )) {
+				fprintf( stderr, "bad range: %s (want yyyy/mm/dd,yyyy/mm/dd)\n",
+						optarg );
+				return( 1 );
+			}
+			break;
+
+		case 'C':
+			conflicts = true;
+			break;
+
+		case 'B':
+			freebusy = true;
+			if (optarg && strcmp( optarg, "day" ) == 0)
+				freebusy_daily = true;
+			else if (optarg) {
+				fprintf( stderr, "bad free/busy: %s (want day)\n", optarg );
+				return( 1 );
+			}
+			break;
+
+		case 'm':
+			merge = true;
+			break;
+
+		case 'M':
+			if (!parse_size( optarg, &memory_limit )) {
+				fprintf( stderr, "bad memory limit: %s (want e.g. 64m)\n",
+						optarg );
+				return( 1 );
+			}
+			break;
+
+		case 'S':
+			stats_report = true;
+			break;
+
+		case 'I':
+			text_index = optarg;
+			break;
+
+		case 's':
+			text_search = optarg;
+			break;
+
+		case 'z':
+			local_zone = TimeZone::load( optarg );
+			if (local_zone == 0) {
+				fprintf( stderr, "unknown time zone: %s\n", optarg );
+				return( 1 );
+			}
+			break;
+
+		case 'L':
+			serve = optarg;
+			break;
+
+		case 'W':
+			watch = optarg;
+			break;
+
+		case 'P':
+			if (strcmp( optarg, "year" ) == 0)
+				shard_by = SHARD_YEAR;
+			else if (strcmp( optarg, "category" ) == 0)
+				shard_by = SHARD_CATEGORY;
+			else if (strncmp( optarg, "count:", 6 ) == 0 &&
+					(shard_pieces = atoi( optarg + 6 )) > 0 &&
+					shard_pieces <= SHARD_MAX_PIECES)
+				shard_by = SHARD_COUNT;
+			else {
+				fprintf( stderr, "bad shard: %s (want year, category or count:N, N <= %d)\n",
+						optarg, SHARD_MAX_PIECES );
+				return( 1 );
+			}
 			break;
+
+		case 'E':
+			encode = optarg;
+			break;
+
+		case 'R':
+			arrow_batch_rows = atol( optarg );
+			if (arrow_batch_rows <= 0) {
+				fprintf( stderr, "bad batch size: %s (want a number of rows)\n",
+						optarg );
+				return( 1 );
+			}
+			break;
+
+		case 'h':
+			usage( stdout );
+			return( 0 );
+
+		default:
+			usage( stderr );
+			return( 1 );
 		}
 	}
+
+	// a long-running server (the requests say what to convert)
+	if (serve)
+		return( serve_datebooks( serve ) );
+
+	// convert whatever turns up in a directory
+	if (watch)
+		return( watch_datebooks( watch, format ) );
+
+	// iCalendar files back into a datebook archive
+	if (encode)
+		return( process_ics_encode( argv + optind, argc - optind, encode ) );
+
+	// full-text indexing (of the archives) and search (for the words)
+	if (text_index)
+		return( process_text_index( argv + optind, argc - optind, text_index ) );
+	if (text_search)
+		return( process_text_search( text_search, argv + optind, argc - optind ) );
+
+	// statistics over the whole batch
+	if (stats_report)
+		return( process_datebook_stats( argv + optind, argc - optind ) );
+
+	// several datebooks into one calendar (of instances: the
+	// records of different datebooks can't be merged as such)
+	if (merge && format_records( format )) {
+		fprintf( stderr, "bad format for --merge: %s (want an instance format)\n",
+				format );
+		return( 1 );
+	}
+	if (merge)
+		return( process_datebook_merge( argv + optind, argc - optind,
+				cachedir, format ) );
+
+	// (one after another, on stdout) only if the format's output
+	// can be put together from pieces: an Arrow file can't
+	if (argc - optind > 1 && shard_by == 0 && !format_streams( format )) {
+		fprintf( stderr, "format %s takes one archive at a time\n",
+				format );
+		return( 1 );
+	}
+
+	// a batch of archives is read ahead, many at a time, while we
+	// decode (unless they are being looked up or named elsewhere)
+	PalmLoader *loader = 0;
+	if (argc - optind > 1 && diffbase == 0 && shard_by == 0 && cachedir == 0)
+		loader = new PalmLoader( argv + optind, argc - optind );
+
 	int ret = 0;
 	for( int i = optind; i < argc; i++ ) {
+		// are we only interested in what has changed
+		if (diffbase != 0) {
+			ret |= process_datebook_diff( diffbase, argv[i], cachedir, format );
+			continue;
+		}
+
+		// several calendars (rather than one)
+		if (shard_by != 0) {
+			ret |= process_datebook_shards( argv[i], format );
+			continue;
+		}
+
+		// see if we already have this archive (decoded) in the cache
+		if (cachedir != 0) {
+			int r = process_cached_datebook( argv[i], cachedir, format );
+			if (r >= 0) {
+				ret = r;
+				continue;
+			}
+		}
+
 		// see if we can open this file as an archive
-		PalmArchive *arc = new PalmArchive( argv[i] );
+		PalmArchive *arc;
+		if (loader) {
+			const unsigned char *image;
+			size_t size;
+			const char *err;
+			loader->next( &image, &size, &err );	// (this is argv[i])
+			if (err != 0) {
+				fprintf( stderr, "Error (%s) initializing %s\n", err, argv[i] );
+				ret |= 1;
+				continue;
+			}
+			if (verbose)
+				fprintf( stderr, "Palm Archive: %s\n", argv[i] );
+			arc = new PalmArchive( image, size );
+		} else
+			arc = new PalmArchive( argv[i] );
 		if (arc->error() != 0) {
 			fprintf( stderr, "Error (%s) initializing %s\n",
 					arc->error(), argv[i] );
@@ -60,6 +407,7 @@ int main( int argc, char **argv ) {
 		}
 		delete arc;
 	}
+	delete loader;
 
 	return( ret );
 }
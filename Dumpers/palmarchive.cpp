@@ -13,27 +13,32 @@
 #include "palmarchive.h"
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // sanity check limits
 static const int MAX_CATEGORIES = 64;
 static const int MAGIC_CAT = 1735289204L;
 
-extern bool verbose;
-extern bool whiny;
+// diagnostic controls, shared by everything that links with libpalm
+bool verbose = false;	// commentary on what we find
+bool whiny = false;		// complaints about what we find
 
 /*
  * method: constructor (for an already open file)
  */
 PalmArchive::PalmArchive( FILE *openfile ) {
-	_file = openfile;
 	init();
+	_file = openfile;
+	if (load())
+		readHeader();
 }
 
 /*
  * method: constructor (with a specified file name)
  */
 PalmArchive::PalmArchive( const char *filename ) {
-
+	init();
 	_file = fopen( filename, "r" );
 	if (_file == NULL) {
 		_errstr = "Unable to open file";
@@ -42,21 +47,92 @@ PalmArchive::PalmArchive( const char *filename ) {
 	if (verbose)
 		fprintf(stderr, "Palm Archive: %s\n", filename);
 
+	if (load())
+		readHeader();
+}
+
+/*
+ * method: constructor (for an archive image already in memory)
+ */
+PalmArchive::PalmArchive( const void *image, size_t size ) {
 	init();
+	_base = (const unsigned char *) image;
+	_size = size;
+	_borrowed = true;
+	_cursor = PalmCursor( _base, _size, 0 );
+	readHeader();
 }
 
 void PalmArchive::init() {
+	_file = 0;
+	_base = 0;
+	_size = 0;
+	_mapped = false;
+	_borrowed = false;
+	_body = 0;
 	_errstr = 0;
 	_filetype = 0;
 	_filename = 0;
 	_header = 0;
+	_num_categories = 0;
 	_categories = 0;
+	_width = 0;
+}
 
-	readHeader();
+/*
+ * routine: load
+ *
+ * purpose:
+ *	to get the entire archive into memory, where it can
+ *	be shared (read-only) by any number of cursors.
+ *
+ * note:
+ *	regular files are simply mapped, anything else
+ *	(e.g. a pipe) is read into a malloc'd buffer.
+ *
+ * returns:
+ *	bool (success/failure)
+ */
+bool PalmArchive::load() {
+	int fd = fileno( _file );
+	struct stat st;
+	if (fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0) {
+		void *p = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if (p != MAP_FAILED) {
+			_base = (const unsigned char *) p;
+			_size = st.st_size;
+			_mapped = true;
+		}
+	}
+
+	if (!_mapped) {
+		size_t max = 64 * 1024;
+		unsigned char *buf = (unsigned char *) malloc( max );
+		size_t n;
+		while( (n = fread( buf + _size, 1, max - _size, _file )) > 0 ) {
+			_size += n;
+			if (_size == max) {
+				max *= 2;
+				buf = (unsigned char *) realloc( buf, max );
+			}
+		}
+		_base = buf;
+	}
+
+	_cursor = PalmCursor( _base, _size, 0 );
+	return( true );
 }
 
 PalmArchive::~PalmArchive() {
 
+	if (_base && !_borrowed) {
+		if (_mapped)
+			munmap( (void *) _base, _size );
+		else
+			free( (void *) _base );
+		_base = 0;
+	}
+
 	if (_file) {
 		fclose( _file );
 		_file = NULL;
@@ -94,7 +170,7 @@ PalmArchive::~PalmArchive() {
  *	pointer to newly allocated string
  *	or zero
  */
-char *PalmArchive::readCstring( ) {
+char *PalmCursor::readCstring( ) {
 	unsigned short len = readUbyte();
 	if (len == 0)
 		return( 0 );
@@ -102,9 +178,9 @@ char *PalmArchive::readCstring( ) {
 		len = readUshort();
 	
 	char *newstr = (char *) malloc( len+1 );
-	int ret;
-	if ((ret = fread( newstr, 1, len, _file )) != len ) {
-		fprintf(stderr,"Tried to read %d bytes, got %d\n", len, ret );
+	if (!readBytes( newstr, len )) {
+		fprintf(stderr,"Tried to read %d bytes, got %ld\n", len,
+				(long) (_size - _pos));
 		_errstr = "Cstring short read";
 		free( newstr );
 		return( 0 );
@@ -114,40 +190,80 @@ char *PalmArchive::readCstring( ) {
 	}
 }
 
+/*
+ * routine: readBytes
+ *
+ * purpose:
+ *	to read a known number of bytes into a caller supplied buffer
+ *	(which lets readers avoid allocating a copy of every string)
+ *
+ * returns:
+ *	bool (success/failure)
+ */
+bool PalmCursor::readBytes( void *buf, unsigned len ) {
+	if (_pos + len > _size) {
+		_errstr = "readBytes short read";
+		return( false );
+	}
+	memcpy( buf, _base + _pos, len );
+	_pos += len;
+	return( true );
+}
+
+/*
+ * routine: skip
+ *
+ * purpose: to move past bytes we have no interest in
+ *
+ * returns:
+ *	bool (success/failure)
+ */
+bool PalmCursor::skip( size_t len ) {
+	if (_pos + len > _size) {
+		_errstr = "skip past end of archive";
+		_pos = _size;
+		return( false );
+	}
+	_pos += len;
+	return( true );
+}
+
 /*
  * routine: readUlong
  *
- * purpose: to read a four-byte unsigned value
+ * purpose: to read a four-byte (little-endian) unsigned value
  *
  * returns:
  *	value (or -1);
  */
-unsigned long PalmArchive::readUlong( ) {
-	unsigned long value = 0;
-
-	if (fread( &value, 4, 1, _file) != 1 ) {
+unsigned long PalmCursor::readUlong( ) {
+	if (_pos + 4 > _size) {
 		_errstr = "readUlong error";
+		_pos = _size;
 		return( -1 );
-	} else
-		return( value );
+	}
+	const unsigned char *p = _base + _pos;
+	_pos += 4;
+	return( p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24) );
 }
 
 /*
  * routine: readUshort
  *
- * purpose: to read a two-byte unsigned value
+ * purpose: to read a two-byte (little-endian) unsigned value
  *
  * returns:
  *	value (or -1);
  */
-unsigned short PalmArchive::readUshort( ) {
-	unsigned short value = 0;
-
-	if (fread( &value, 2, 1, _file) != 1 ) {
+unsigned short PalmCursor::readUshort( ) {
+	if (_pos + 2 > _size) {
 		_errstr = "readUshort error";
+		_pos = _size;
 		return( -1 );
-	} else
-		return( value );
+	}
+	const unsigned char *p = _base + _pos;
+	_pos += 2;
+	return( p[0] | (p[1] << 8) );
 }
 
 /*
@@ -158,14 +274,13 @@ unsigned short PalmArchive::readUshort( ) {
  * returns:
  *	value (or -1);
  */
-unsigned char PalmArchive::readUbyte( ) {
-	unsigned char value = 0;
-
-	if (fread( &value, 1, 1, _file) != 1 ) {
+unsigned char PalmCursor::readUbyte( ) {
+	if (_pos + 1 > _size) {
 		_errstr = "readUbyte error";
+		_pos = _size;
 		return( -1 );
-	} else
-		return( value );
+	}
+	return( _base[_pos++] );
 }
 
 /*
@@ -180,13 +295,13 @@ unsigned char PalmArchive::readUbyte( ) {
 bool PalmArchive::readHeader( ) {
 
 	_filetype = readUlong();
-	if (_errstr)
+	if (error())
 		return( false );
 	if (verbose)
 		fprintf(stderr, "   Type=0x%lx (%s)\n", _filetype, typeName());
 
 	_filename = readCstring();
-	if (_errstr)
+	if (error())
 		return( false );
 	else if (_filename == 0)
 		_filename = strdup("NONE");
@@ -194,7 +309,7 @@ bool PalmArchive::readHeader( ) {
 		fprintf(stderr, "   filename = %s\n", _filename);
 
 	_header = readCstring();
-	if (_errstr)
+	if (error())
 		return( false );
 	else if (_header == 0)
 		_header = strdup("NONE");
@@ -223,7 +338,7 @@ bool PalmArchive::readHeader( ) {
 		}
 	}
 
-	if (_errstr)
+	if (error())
 		return( false );
 
 	/*
@@ -246,10 +361,11 @@ bool PalmArchive::readHeader( ) {
 	}
 	if (whiny)
 		fprintf(stderr, ")\n");
-	if (_errstr)
+	if (error())
 		return( false );
 	
 	// and now we should be positioned at the real records
+	_body = _cursor.offset();
 	return( true );
 }
 
@@ -12,24 +12,86 @@
  *		This object represents the common header,
  *		after which file type specific functions take over
  */
+#ifndef _PALMARCHIVE_H
+#define _PALMARCHIVE_H
+
 #include <stdio.h>
+#include <stddef.h>
 
-class PalmArchive {
+/*
+ * A PalmCursor is a read position within the (immutable) bytes of
+ * an archive.  Cursors are cheap to copy, and since the only thing
+ * a cursor ever changes is itself, any number of them (in any number
+ * of threads) can be reading different parts of one archive at once.
+ */
+class PalmCursor {
 
    public:
-	PalmArchive( FILE *openfile );
-	PalmArchive( const char *filename );
-	~PalmArchive();
-	
+	PalmCursor() {
+		_base = 0;
+		_size = 0;
+		_pos = 0;
+		_errstr = 0;
+	}
+	PalmCursor( const unsigned char *base, size_t size, size_t pos ) {
+		_base = base;
+		_size = size;
+		_pos = pos;
+		_errstr = 0;
+	}
+
 	// basic data read routines
 	unsigned long	 readUlong();
 	unsigned short	 readUshort();
 	unsigned char	 readUbyte();
 	char 		*readCstring();
+	bool		 readBytes( void *buf, unsigned len );
+	bool		 skip( size_t len );
+
+	size_t		 offset()	{ return( _pos ); }
+	const char	*error()	{ return( _errstr ); }
+
+   private:
+	const unsigned char *_base;	// start of the archive bytes
+	size_t		_size;		// length of the archive
+	size_t		_pos;		// our current offset
+	const char	*_errstr;
+};
+
+class PalmArchive {
+
+   public:
+	PalmArchive( FILE *openfile );
+	PalmArchive( const char *filename );
+	// (an archive already in memory, which must outlive us)
+	PalmArchive( const void *image, size_t size );
+	~PalmArchive();
+	
+	// basic data read routines (from the archive's own cursor)
+	unsigned long	 readUlong()	{ return( _cursor.readUlong() ); }
+	unsigned short	 readUshort()	{ return( _cursor.readUshort() ); }
+	unsigned char	 readUbyte()	{ return( _cursor.readUbyte() ); }
+	char 		*readCstring()	{ return( _cursor.readCstring() ); }
+	bool		 readBytes( void *buf, unsigned len ) {
+		return( _cursor.readBytes( buf, len ) );
+	}
 
+	// the archive's own (sequential) cursor
+	PalmCursor	*cursor()	{ return( &_cursor ); }
+	// an independent cursor, at a specified offset
+	PalmCursor	 cursorAt( size_t offset ) {
+		return( PalmCursor( _base, _size, offset ) );
+	}
+	// where the file type specific data begins
+	size_t		 bodyOffset()	{ return( _body ); }
+	// the archive image itself
+	const unsigned char *image()	{ return( _base ); }
+	size_t		 size()		{ return( _size ); }
 
 	// information about this archive
-	const char	*error()	{ return( _errstr ); }
+	const char	*error()	{
+		return( _errstr ? _errstr : _cursor.error() );
+	}
 	unsigned long	 fileType()	{ return( _filetype ); }
 	const char 	*fileName()	{ return( _filename ); }
 	const char	*headerString()	{ return( _header ); }
@@ -39,6 +101,7 @@ class PalmArchive {
 		else
 			return( _categories[i] );
 	}
+	int num_categories()	{ return( _num_categories ); }
 	int fields_per_row()	{ return( _width ); }
 
 	// known archive types
@@ -69,10 +132,17 @@ class PalmArchive {
    private:
 	// read routines for internal types
 	void		 init();
+	bool		 load();
 	bool		 readHeader();
 	char		 *readCategory();
 
 	FILE	*_file;
+	const unsigned char *_base;	// the archive bytes
+	size_t	_size;
+	bool	_mapped;	// _base is mmap'd (vs malloc'd)
+	bool	_borrowed;	// _base belongs to someone else
+	PalmCursor _cursor;
+	size_t	_body;		// offset of type specific data
 	unsigned long _filetype;
 	const char *_errstr;
 	char	*_filename;
@@ -81,3 +151,4 @@ class PalmArchive {
 	char	**_categories;
 	int		_width;
 };
+#endif
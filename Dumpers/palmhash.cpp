@@ -0,0 +1,78 @@
+/*
+ * module:	palmhash.cpp
+ *
+ * purpose:	fast (non-cryptographic) 64-bit hashing
+ *
+ * note:	this consumes eight bytes per step (multiply and
+ *		xor-shift mixing), which is more than fast enough
+ *		to hash an archive in less time than it takes to
+ *		parse it.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "palmhash.h"
+
+static const uint64_t M1 = 0x9e3779b97f4a7c15ULL;
+static const uint64_t M2 = 0xbf58476d1ce4e5b9ULL;
+static const uint64_t M3 = 0x94d049bb133111ebULL;
+
+static inline uint64_t mix( uint64_t h ) {
+	h ^= h >> 30;
+	h *= M2;
+	h ^= h >> 27;
+	h *= M3;
+	h ^= h >> 31;
+	return( h );
+}
+
+uint64_t palm_hash( const void *buf, size_t len, uint64_t seed ) {
+	const unsigned char *p = (const unsigned char *) buf;
+	uint64_t h = seed ^ (len * M1);
+
+	// the bulk of it, a word at a time
+	while( len >= 8 ) {
+		uint64_t k;
+		memcpy( &k, p, 8 );
+		h = (h ^ mix( k )) * M1;
+		p += 8;
+		len -= 8;
+	}
+
+	// and whatever is left over
+	uint64_t k = 0;
+	for( size_t i = 0; i < len; i++ )
+		k |= (uint64_t) p[i] << (8 * i);
+	h = (h ^ mix( k )) * M1;
+
+	return( mix( h ) );
+}
+
+bool palm_hash_file( const char *path, uint64_t *hash ) {
+	int fd = open( path, O_RDONLY );
+	if (fd < 0)
+		return( false );
+
+	struct stat st;
+	if (fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode )) {
+		close( fd );
+		return( false );
+	}
+
+	if (st.st_size == 0) {
+		*hash = palm_hash( "", 0 );
+		close( fd );
+		return( true );
+	}
+
+	void *p = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if (p == MAP_FAILED)
+		return( false );
+	*hash = palm_hash( p, st.st_size );
+	munmap( p, st.st_size );
+	return( true );
+}
@@ -0,0 +1,19 @@
+/*
+ * module:	palmhash.h
+ *
+ * purpose:	fast (non-cryptographic) 64-bit hashing, used to
+ *		recognize archives (and records) we have seen before
+ */
+#ifndef _PALMHASH_H
+#define _PALMHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// hash a buffer (seed lets callers chain hashes of several fields)
+uint64_t palm_hash( const void *buf, size_t len, uint64_t seed = 0 );
+
+// hash the contents of a file (returns false if it cannot be read)
+bool palm_hash_file( const char *path, uint64_t *hash );
+
+#endif
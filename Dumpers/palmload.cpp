@@ -0,0 +1,553 @@
+/*
+ * module:	palmload.cpp
+ *
+ * purpose:	batched reading of archives, on an io_uring or threads
+ *
+ * note:	each file goes through open, read (repeated, with a bigger
+ *		buffer, if it fills the one it has) and close.  On the
+ *		ring, each file in the window has one of these in flight,
+ *		and a single io_uring_enter both submits whatever is ready
+ *		to go and waits for completions, so a small file costs
+ *		one or two system calls (rather than the five it takes to
+ *		open, stat, map, unmap and close it), and is opened and
+ *		read while the ones ahead of it are being decoded.
+ *
+ *		A short read is taken as the end of the file (as it is for
+ *		any regular file), which saves a read per file.
+ *
+ *		Each slot keeps its buffer for the files that follow it,
+ *		so once they have grown to fit, there is no allocation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "palmload.h"
+
+static const size_t LOAD_BUFFER = 64 * 1024;	// (first guess at a file's size)
+static const int LOAD_MAX_THREADS = 8;
+
+// what a slot (the file in it) is waiting for
+static const int SLOT_FREE = 0;
+static const int SLOT_OPEN = 1;
+static const int SLOT_READ = 2;
+static const int SLOT_CLOSE = 3;
+static const int SLOT_DONE = 4;
+
+struct load_slot {
+	int		state;
+	int		file;		// which file it holds
+	int		fd;
+	unsigned char	*buf;
+	size_t		max;
+	size_t		len;
+	const char	*err;
+};
+
+/*
+ * an io_uring: the three regions the kernel shares with us, and
+ * pointers to the parts of them we use
+ */
+struct load_ring {
+	int		fd;
+	void		*sq_map;
+	size_t		sq_len;
+	void		*cq_map;	// (may be the same mapping as the sq)
+	size_t		cq_len;
+	struct io_uring_sqe *sqes;
+	size_t		sqes_len;
+
+	unsigned	*sq_head;
+	unsigned	*sq_tail;
+	unsigned	*sq_mask;
+	unsigned	*sq_array;
+	unsigned	*cq_head;
+	unsigned	*cq_tail;
+	unsigned	*cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned	entries;
+	unsigned	pending;	// queued, but not yet submitted
+	bool		failed;		// (io_uring_enter did, so it is no use)
+};
+
+static int sys_io_uring_setup( unsigned entries, struct io_uring_params *p ) {
+	return( syscall( __NR_io_uring_setup, entries, p ) );
+}
+
+static int sys_io_uring_enter( int fd, unsigned submit, unsigned wait, unsigned flags ) {
+	return( syscall( __NR_io_uring_enter, fd, submit, wait, flags, 0, 0 ) );
+}
+
+static int sys_io_uring_register( int fd, unsigned op, void *arg, unsigned n ) {
+	return( syscall( __NR_io_uring_register, fd, op, arg, n ) );
+}
+
+// (as PalmArchive would put it)
+static const char *open_error = "Unable to open file";
+static const char *read_error = "read failed";
+
+PalmLoader::PalmLoader( char * const *paths, int n, int depth, bool ring ) {
+	_paths = paths;
+	_num = n;
+	_depth = (depth > 0) ? depth : 1;
+	_slots = (struct load_slot *) calloc( _depth, sizeof (struct load_slot) );
+	_issued = 0;
+	_consumed = 0;
+	_ring = 0;
+	_workers = 0;
+	_num_workers = 0;
+	_taken = 0;
+	_released = 0;
+	_stopping = false;
+	pthread_mutex_init( &_lock, 0 );
+	pthread_cond_init( &_ready, 0 );
+	pthread_cond_init( &_room, 0 );
+
+	if (!ring || !ringSetup())
+		threadSetup();
+}
+
+PalmLoader::~PalmLoader() {
+	if (_ring) {
+		// (let whatever is still in flight finish, and close its files)
+		while( _consumed < _issued && !_ring->failed ) {
+			struct load_slot *s = &_slots[_consumed % _depth];
+			while( s->state != SLOT_DONE && !_ring->failed ) {
+				ringSubmit( true );
+				ringReap();
+			}
+			_consumed++;
+		}
+		ringDrop();
+	}
+	if (_workers) {
+		pthread_mutex_lock( &_lock );
+		_stopping = true;
+		pthread_cond_broadcast( &_room );
+		pthread_mutex_unlock( &_lock );
+		for( int t = 0; t < _num_workers; t++ )
+			pthread_join( _workers[t], 0 );
+		free( _workers );
+	}
+	for( int i = 0; i < _depth; i++ )
+		free( _slots[i].buf );
+	free( _slots );
+	pthread_mutex_destroy( &_lock );
+	pthread_cond_destroy( &_ready );
+	pthread_cond_destroy( &_room );
+}
+
+/*
+ * routine:	ringSetup
+ *
+ * purpose:	set up an io_uring, and map its rings
+ *
+ * returns:	bool (false if there is none to be had, or it cannot do
+ *		the opens, reads and closes we need of it)
+ */
+bool PalmLoader::ringSetup() {
+	struct io_uring_params p;
+	memset( &p, 0, sizeof p );
+	int fd = sys_io_uring_setup( _depth, &p );
+	if (fd < 0)
+		return( false );
+
+	// make sure it has the operations we need (5.6 and later)
+	size_t plen = sizeof (struct io_uring_probe) + 256 * sizeof (struct io_uring_probe_op);
+	struct io_uring_probe *probe = (struct io_uring_probe *) calloc( 1, plen );
+	bool ok = sys_io_uring_register( fd, IORING_REGISTER_PROBE, probe, 256 ) == 0;
+	static const int needed[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+	for( int i = 0; ok && i < 3; i++ )
+		ok = needed[i] <= probe->last_op &&
+			(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+	free( probe );
+	if (!ok) {
+		close( fd );
+		return( false );
+	}
+
+	struct load_ring *r = (struct load_ring *) calloc( 1, sizeof (struct load_ring) );
+	r->fd = fd;
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = r->sq_len;
+	}
+	r->sq_map = mmap( 0, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			fd, IORING_OFF_SQ_RING );
+	if (r->sq_map == MAP_FAILED) {
+		close( fd );
+		free( r );
+		return( false );
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_map = r->sq_map;
+	else {
+		r->cq_map = mmap( 0, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				fd, IORING_OFF_CQ_RING );
+		if (r->cq_map == MAP_FAILED) {
+			munmap( r->sq_map, r->sq_len );
+			close( fd );
+			free( r );
+			return( false );
+		}
+	}
+	r->sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *) mmap( 0, r->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+	if (r->sqes == MAP_FAILED) {
+		if (r->cq_map != r->sq_map)
+			munmap( r->cq_map, r->cq_len );
+		munmap( r->sq_map, r->sq_len );
+		close( fd );
+		free( r );
+		return( false );
+	}
+
+	char *sq = (char *) r->sq_map;
+	char *cq = (char *) r->cq_map;
+	r->sq_head = (unsigned *) (sq + p.sq_off.head);
+	r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *) (sq + p.sq_off.array);
+	r->cq_head = (unsigned *) (cq + p.cq_off.head);
+	r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	r->entries = p.sq_entries;
+	r->pending = 0;
+	r->failed = false;
+	_ring = r;
+	return( true );
+}
+
+/*
+ * routine:	ringDrop
+ *
+ * purpose:	give up the ring: any file still in flight on it is
+ *		taken as unreadable
+ *
+ * note:	what the kernel still has of those may yet complete, so
+ *		their buffers are left to it (and the files it opens for
+ *		them, to the ring's teardown)
+ */
+void PalmLoader::ringDrop() {
+	for( int i = _consumed; i < _issued; i++ ) {
+		struct load_slot *s = &_slots[i % _depth];
+		if (s->state == SLOT_DONE)
+			continue;
+		if (s->state == SLOT_READ)
+			close( s->fd );
+		s->fd = -1;
+		s->buf = 0;
+		s->max = 0;
+		s->err = read_error;
+		s->state = SLOT_DONE;
+	}
+	struct load_ring *r = _ring;
+	munmap( r->sqes, r->sqes_len );
+	if (r->cq_map != r->sq_map)
+		munmap( r->cq_map, r->cq_len );
+	munmap( r->sq_map, r->sq_len );
+	close( r->fd );
+	free( r );
+	_ring = 0;
+}
+
+/*
+ * routine:	ringSqe
+ *
+ * purpose:	get the next submission queue entry (cleared), and queue it
+ *
+ * note:	each slot has at most one operation outstanding, so there
+ *		is always room (the ring has at least depth entries).  Once
+ *		the ring has failed, what is queued is never looked at.
+ */
+struct io_uring_sqe *PalmLoader::ringSqe() {
+	struct load_ring *r = _ring;
+	unsigned tail = *r->sq_tail;
+	if (tail - __atomic_load_n( r->sq_head, __ATOMIC_ACQUIRE ) >= r->entries)
+		ringSubmit( false );
+	unsigned i = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[i];
+	memset( sqe, 0, sizeof *sqe );
+	r->sq_array[i] = i;
+	r->pending++;
+	return( sqe );
+}
+
+// (the entry has been filled in: let the kernel see it)
+static void ring_publish( struct load_ring *r ) {
+	__atomic_store_n( r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE );
+}
+
+static void prep_open( struct load_ring *r, struct io_uring_sqe *sqe, int slot,
+		const char *path ) {
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long) path;
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	sqe->user_data = slot;		// (which slot it is for)
+	ring_publish( r );
+}
+
+static void prep_read( struct load_ring *r, struct io_uring_sqe *sqe, int slot,
+		struct load_slot *s ) {
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = s->fd;
+	sqe->addr = (unsigned long) (s->buf + s->len);
+	sqe->len = s->max - s->len;
+	sqe->off = s->len;
+	sqe->user_data = slot;
+	ring_publish( r );
+}
+
+static void prep_close( struct load_ring *r, struct io_uring_sqe *sqe, int slot, int fd ) {
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+	sqe->user_data = slot;
+	ring_publish( r );
+}
+
+// put a file into its slot, and queue its open
+void PalmLoader::ringStart( int i ) {
+	int k = i % _depth;
+	struct load_slot *s = &_slots[k];
+	s->file = i;
+	s->fd = -1;
+	s->len = 0;
+	s->err = 0;
+	s->state = SLOT_OPEN;
+	prep_open( _ring, ringSqe(), k, _paths[i] );
+}
+
+/*
+ * routine:	ringSubmit
+ *
+ * purpose:	hand the kernel what we have queued, and (optionally)
+ *		wait for at least one thing to complete
+ *
+ * note:	if it cannot be done, the ring is marked as failed (for
+ *		next to give it up, once we are out of its callers)
+ */
+void PalmLoader::ringSubmit( bool wait ) {
+	struct load_ring *r = _ring;
+	if (r->failed || (r->pending == 0 && !wait))
+		return;
+	for( ;; ) {
+		int n = sys_io_uring_enter( r->fd, r->pending, wait ? 1 : 0,
+				wait ? IORING_ENTER_GETEVENTS : 0 );
+		if (n >= 0) {
+			r->pending -= n;
+			if (r->pending == 0 || !wait)
+				return;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EBUSY) {
+			ringReap();	// (make room in the completion queue)
+			continue;
+		}
+		perror( "io_uring_enter" );
+		r->failed = true;
+		return;
+	}
+}
+
+/*
+ * routine:	ringReap
+ *
+ * purpose:	take each completion, and move its file along
+ */
+void PalmLoader::ringReap() {
+	struct load_ring *r = _ring;
+	unsigned head = *r->cq_head;
+	unsigned tail = __atomic_load_n( r->cq_tail, __ATOMIC_ACQUIRE );
+	for( ; head != tail; head++ ) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		int k = (int) cqe->user_data;
+		int res = cqe->res;
+		struct load_slot *s = &_slots[k];
+
+		switch( s->state ) {
+		case SLOT_OPEN:
+			if (res < 0) {
+				s->err = open_error;
+				s->state = SLOT_DONE;
+				break;
+			}
+			s->fd = res;
+			if (s->max == 0) {
+				s->max = LOAD_BUFFER;
+				s->buf = (unsigned char *) malloc( s->max );
+			}
+			s->state = SLOT_READ;
+			prep_read( r, ringSqe(), k, s );
+			break;
+
+		case SLOT_READ:
+			if (res < 0)
+				s->err = read_error;
+			else {
+				s->len += res;
+				if (s->len == s->max) {	// (there may be more)
+					s->max *= 2;
+					s->buf = (unsigned char *) realloc( s->buf, s->max );
+					prep_read( r, ringSqe(), k, s );
+					break;
+				}
+			}
+			s->state = SLOT_CLOSE;
+			prep_close( r, ringSqe(), k, s->fd );
+			break;
+
+		case SLOT_CLOSE:
+			s->fd = -1;
+			s->state = SLOT_DONE;
+			break;
+		}
+	}
+	__atomic_store_n( r->cq_head, head, __ATOMIC_RELEASE );
+}
+
+/*
+ * the thread pool (when there is no io_uring): each worker takes the
+ * next file (once its slot is free), and reads it into the slot
+ */
+void *PalmLoader::worker( void *arg ) {
+	PalmLoader *l = (PalmLoader *) arg;
+	pthread_mutex_lock( &l->_lock );
+	for( ;; ) {
+		while( !l->_stopping && l->_taken < l->_num &&
+				l->_taken >= l->_released + l->_depth )
+			pthread_cond_wait( &l->_room, &l->_lock );
+		if (l->_stopping || l->_taken >= l->_num)
+			break;
+		int i = l->_taken++;
+		struct load_slot *s = &l->_slots[i % l->_depth];
+		s->file = i;
+		s->state = SLOT_READ;
+		pthread_mutex_unlock( &l->_lock );
+
+		// (the slot is ours, until it is done)
+		s->len = 0;
+		s->err = 0;
+		int fd = open( l->_paths[i], O_RDONLY | O_CLOEXEC );
+		if (fd < 0)
+			s->err = open_error;
+		else {
+			struct stat st;
+			size_t want = (fstat( fd, &st ) == 0 && st.st_size > 0) ?
+					st.st_size + 1 : LOAD_BUFFER;
+			if (s->max < want) {
+				s->max = want;
+				s->buf = (unsigned char *) realloc( s->buf, s->max );
+			}
+			for( ;; ) {
+				ssize_t n = pread( fd, s->buf + s->len, s->max - s->len, s->len );
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n < 0) {
+					s->err = read_error;
+					break;
+				}
+				s->len += n;
+				if (s->len < s->max)
+					break;
+				s->max *= 2;
+				s->buf = (unsigned char *) realloc( s->buf, s->max );
+			}
+			close( fd );
+		}
+
+		pthread_mutex_lock( &l->_lock );
+		s->state = SLOT_DONE;
+		pthread_cond_broadcast( &l->_ready );
+	}
+	pthread_mutex_unlock( &l->_lock );
+	return( 0 );
+}
+
+void PalmLoader::threadSetup() {
+	_num_workers = (_depth < LOAD_MAX_THREADS) ? _depth : LOAD_MAX_THREADS;
+	if (_num_workers > _num)
+		_num_workers = _num;
+	_workers = (pthread_t *) calloc( _num_workers ? _num_workers : 1, sizeof (pthread_t) );
+	for( int t = 0; t < _num_workers; t++ )
+		pthread_create( &_workers[t], 0, worker, this );
+}
+
+/*
+ * routine:	next
+ *
+ * purpose:	hand back the next file, keeping the window full
+ *
+ * returns:	bool (false when there are no more files)
+ */
+bool PalmLoader::next( const unsigned char **buf, size_t *len, const char **err ) {
+	*buf = 0;
+	*len = 0;
+	*err = 0;
+
+	if (_ring) {
+		// (we are done with the last one, so its slot is free)
+		while( _issued < _num && _issued < _consumed + _depth )
+			ringStart( _issued++ );
+		ringSubmit( false );
+		if (_consumed >= _num)
+			return( false );
+		struct load_slot *s = &_slots[_consumed % _depth];
+		while( s->state != SLOT_DONE && !_ring->failed ) {
+			ringSubmit( true );
+			ringReap();
+			ringSubmit( false );	// (whatever that moved along)
+		}
+		if (!_ring->failed) {
+			s->state = SLOT_FREE;
+			_consumed++;
+			*err = s->err;
+			if (s->err == 0) {
+				*buf = s->buf;
+				*len = s->len;
+			}
+			return( true );
+		}
+
+		// (threads take it from here, after what was in flight)
+		ringDrop();
+		_taken = _issued;
+		_released = _consumed;
+		threadSetup();
+	}
+
+	pthread_mutex_lock( &_lock );
+	if (_released < _consumed) {	// (the last one's slot is free now)
+		_released = _consumed;
+		pthread_cond_broadcast( &_room );
+	}
+	if (_consumed >= _num) {
+		pthread_mutex_unlock( &_lock );
+		return( false );
+	}
+	struct load_slot *s = &_slots[_consumed % _depth];
+	while( s->state != SLOT_DONE || s->file != _consumed )
+		pthread_cond_wait( &_ready, &_lock );
+	_consumed++;
+	pthread_mutex_unlock( &_lock );
+	*err = s->err;
+	if (s->err == 0) {
+		*buf = s->buf;
+		*len = s->len;
+	}
+	return( true );
+}
@@ -0,0 +1,78 @@
+/*
+ * module:	palmload.h
+ *
+ * purpose:	read a batch of (small) archives, many at a time
+ *
+ * note:	with thousands of archives of a few KB each, opening and
+ *		reading them one after another is mostly system call
+ *		overhead and waiting.  A PalmLoader keeps a window of the
+ *		files ahead of the one being decoded in flight at once:
+ *		on an io_uring (set up with the raw system calls, so there
+ *		is no library to depend on), or, if the kernel will not
+ *		give us one, with a few threads doing open/pread/close.
+ *		(Should the ring fail us part way through, the files in
+ *		flight on it are reported as unreadable, and the rest are
+ *		read by the threads.)
+ *
+ *		The files are handed back in order, each as a buffer that
+ *		a PalmArchive( image, size ) can decode in place.
+ */
+#ifndef _PALMLOAD_H
+#define _PALMLOAD_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// how many files are in flight (by default)
+static const int LOAD_DEPTH = 64;
+
+struct load_slot;
+struct load_ring;
+
+class PalmLoader {
+   public:
+	PalmLoader( char * const *paths, int n, int depth = LOAD_DEPTH,
+			bool ring = true );
+	~PalmLoader();
+
+	// the contents of the next file (waiting for it, if need be):
+	// false when there are no more.  If it could not be read, err
+	// says why (and buf is 0).  The buffer is good until the next call.
+	bool next( const unsigned char **buf, size_t *len, const char **err );
+
+	// whether we got an io_uring (rather than threads)
+	bool usingRing()	{ return( _ring != 0 ); }
+
+   private:
+	// io_uring
+	bool ringSetup();
+	void ringStart( int i );
+	void ringReap();
+	void ringSubmit( bool wait );
+	struct io_uring_sqe *ringSqe();
+	void ringDrop();
+
+	// threads
+	void threadSetup();
+	static void *worker( void * );
+
+	char * const	*_paths;
+	int		_num;
+	int		_depth;
+	struct load_slot *_slots;	// (file i is in slot i % depth)
+	int		_issued;	// files started
+	int		_consumed;	// files handed back
+
+	struct load_ring *_ring;
+
+	pthread_t	*_workers;
+	int		_num_workers;
+	int		_taken;		// (the next file for a worker)
+	int		_released;	// files whose slots are free again
+	bool		_stopping;
+	pthread_mutex_t	_lock;
+	pthread_cond_t	_ready;		// a file is done
+	pthread_cond_t	_room;		// a slot is free
+};
+
+#endif
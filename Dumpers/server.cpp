@@ -0,0 +1,333 @@
+/*
+ * module:	server.cpp
+ *
+ * purpose:	a long-running conversion server, on a Unix domain socket
+ *
+ * note:	each connection carries one request: a few header lines,
+ *		a blank line, and (perhaps) the archive itself
+ *
+ *			FORMAT name	as -f
+ *			TZ zone		as --tz
+ *			RANGE from,to	as -r
+ *			PATH file	an archive the server can read, or
+ *			LENGTH n	n bytes of archive (after the blank line)
+ *
+ *		The reply is an OK line followed by the converted output,
+ *		or an ERROR line, and then the connection is closed.
+ *
+ *		A client that sends nothing (or takes nothing) for
+ *		SERVE_TIMEOUT seconds is dropped, so it can't hold on
+ *		to a worker.
+ *
+ *		A pool of worker threads serves the connections, each
+ *		keeping its buffer and string pool from one request to
+ *		the next, and each time zone is loaded just once (and
+ *		then shared, since a TimeZone never changes).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "palmarchive.h"
+#include "dbdecode.h"
+#include "dbformat.h"
+#include "dbtable.h"
+#include "dbindex.h"
+#include "strpool.h"
+#include "tzone.h"
+
+extern bool verbose;	// commentary on what we find
+extern int threads;	// how many requests to serve at once
+extern bool parse_range( const char *s, time_t *from, time_t *to );
+
+static const int SERVE_BACKLOG = 64;		// waiting connections
+static const int SERVE_QUEUE = 256;		// accepted, but not yet served
+static const long SERVE_MAX_ARCHIVE = 256L * 1024 * 1024;
+static const size_t SERVE_POOL_LIMIT = 64 * 1024 * 1024;	// then start afresh
+static const int SERVE_TIMEOUT = 30;		// seconds a client may stall
+
+// accepted connections, waiting for a worker
+struct serve_queue {
+	int		fds[SERVE_QUEUE];
+	int		head;
+	int		count;
+	pthread_mutex_t	lock;
+	pthread_cond_t	ready;		// there is a connection
+	pthread_cond_t	room;		// there is room for another
+};
+
+// what a worker keeps from one request to the next
+struct serve_worker {
+	struct serve_queue *queue;
+	StringPool	*pool;
+	unsigned char	*buf;		// (for archives sent to us)
+	size_t		max;
+};
+
+/*
+ * the time zones that have been asked for (loaded once each)
+ */
+static TimeZone **zones = 0;
+static int num_zones = 0;
+static pthread_mutex_t zone_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static TimeZone *find_zone( const char *name ) {
+	pthread_mutex_lock( &zone_lock );
+	TimeZone *tz = 0;
+	for( int i = 0; i < num_zones && tz == 0; i++ )
+		if (strcmp( zones[i]->name(), name ) == 0)
+			tz = zones[i];
+	if (tz == 0 && (tz = TimeZone::load( name )) != 0) {
+		zones = (TimeZone **) realloc( zones, (num_zones + 1) * sizeof (TimeZone *) );
+		zones[num_zones++] = tz;
+	}
+	pthread_mutex_unlock( &zone_lock );
+	return( tz );
+}
+
+/*
+ * routine:	convert
+ *
+ * purpose:	put out a datebook archive, as one request asked
+ */
+static int convert( struct serve_worker *w, PalmArchive *arc, const char *format,
+		TimeZone *tz, time_t from, time_t to, FILE *out ) {
+
+	DatebookFormatter *f = new_formatter( format, out );
+	f->setZone( tz );
+	int ret;
+	if (to > from) {
+		DatebookTable table( w->pool );
+		table.setFields( f->fields() );
+		ret = decode_datebook( arc, &table );
+		if (ret == 0) {
+			DatebookHeader h;
+			datebook_header( arc, table.rows(), h );
+			f->onHeader( h );
+			for( int i = 0; i < h.num_categories; i++ )
+				f->onCategory( i, arc->category(i) );
+			DatebookIndex index( &table );
+			index.query( from, to, f );
+		}
+	} else
+		ret = decode_datebook( arc, f );
+	f->finish();
+	delete f;
+
+	if (w->pool->bytes() > SERVE_POOL_LIMIT) {
+		delete w->pool;
+		w->pool = new StringPool;
+	}
+	return( ret );
+}
+
+/*
+ * routine:	serve_request
+ *
+ * purpose:	read a request from a connection, and answer it
+ *
+ * returns:	0 (or 1 if it could not be answered)
+ */
+static int serve_request( struct serve_worker *w, FILE *in, FILE *out ) {
+	char format[64] = "";
+	char path[1024] = "";
+	long length = -1;
+	TimeZone *tz = local_zone;
+	time_t from = 0, to = 0;
+	const char *err = 0;
+
+	char *line = 0;
+	size_t cap = 0;
+	ssize_t n;
+	while( (n = getline( &line, &cap, in )) > 0 ) {
+		while( n > 0 && (line[n-1] == '\n' || line[n-1] == '\r') )
+			line[--n] = 0;
+		if (n == 0)
+			break;
+		char *arg = strchr( line, ' ' );
+		if (arg)
+			*arg++ = 0;
+		else
+			arg = line + n;
+
+		if (strcmp( line, "FORMAT" ) == 0) {
+			if (!known_format( arg ))
+				err = "unknown format";
+			snprintf( format, sizeof format, "%s", arg );
+		} else if (strcmp( line, "TZ" ) == 0) {
+			if ((tz = find_zone( arg )) == 0)
+				err = "unknown time zone";
+		} else if (strcmp( line, "RANGE" ) == 0) {
+			if (!parse_range( arg, &from, &to ))
+				err = "bad range";
+		} else if (strcmp( line, "PATH" ) == 0)
+			snprintf( path, sizeof path, "%s", arg );
+		else if (strcmp( line, "LENGTH" ) == 0) {
+			length = strtol( arg, 0, 10 );
+			if (length <= 0 || length > SERVE_MAX_ARCHIVE)
+				err = "bad length";
+		} else if (err == 0)
+			err = "unknown request";
+	}
+	free( line );
+	if (ferror( in ))
+		err = "timed out";	// (or otherwise cut off)
+	if (err == 0 && path[0] == 0 && length < 0)
+		err = "no archive";
+	if (err) {
+		fprintf( out, "ERROR %s\n", err );
+		return( 1 );
+	}
+
+	PalmArchive *arc;
+	if (path[0])
+		arc = new PalmArchive( path );
+	else {
+		if ((size_t) length > w->max) {
+			w->max = length;
+			w->buf = (unsigned char *) realloc( w->buf, w->max );
+		}
+		if (fread( w->buf, 1, length, in ) != (size_t) length) {
+			fprintf( out, "ERROR short archive\n" );
+			return( 1 );
+		}
+		arc = new PalmArchive( w->buf, length );
+	}
+
+	int ret = 1;
+	if (arc->error() != 0)
+		fprintf( out, "ERROR %s\n", arc->error() );
+	else if (arc->fileType() != arc->DBA_SIG)
+		fprintf( out, "ERROR not a datebook\n" );
+	else {
+		fprintf( out, "OK\n" );
+		ret = convert( w, arc, format[0] ? format : 0, tz, from, to, out );
+	}
+	delete arc;
+	return( ret );
+}
+
+static void *serve_worker( void *arg ) {
+	struct serve_worker *w = (struct serve_worker *) arg;
+	struct serve_queue *q = w->queue;
+	for( ;; ) {
+		pthread_mutex_lock( &q->lock );
+		while( q->count == 0 )
+			pthread_cond_wait( &q->ready, &q->lock );
+		int fd = q->fds[q->head];
+		q->head = (q->head + 1) % SERVE_QUEUE;
+		q->count--;
+		pthread_cond_signal( &q->room );
+		pthread_mutex_unlock( &q->lock );
+
+		// separate streams for the two directions
+		FILE *in = fdopen( fd, "r" );
+		int wfd = dup( fd );
+		FILE *out = (wfd >= 0) ? fdopen( wfd, "w" ) : 0;
+		if (in == 0 || out == 0) {
+			if (in)
+				fclose( in );
+			else
+				close( fd );
+			if (out)
+				fclose( out );
+			else if (wfd >= 0)
+				close( wfd );
+			continue;
+		}
+		serve_request( w, in, out );
+		fclose( out );
+		fclose( in );
+	}
+	return( 0 );
+}
+
+/*
+ * routine:	serve_datebooks
+ *
+ * purpose:	accept conversion requests on a Unix domain socket
+ *		(until something goes wrong)
+ *
+ * returns:	1 (it only returns on failure)
+ */
+int serve_datebooks( const char *path ) {
+	struct sockaddr_un addr;
+	if (strlen( path ) >= sizeof addr.sun_path) {
+		fprintf( stderr, "socket name too long: %s\n", path );
+		return( 1 );
+	}
+	memset( &addr, 0, sizeof addr );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+
+	int s = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if (s < 0) {
+		perror( "socket" );
+		return( 1 );
+	}
+	unlink( path );
+	if (bind( s, (struct sockaddr *) &addr, sizeof addr ) != 0 ||
+			listen( s, SERVE_BACKLOG ) != 0) {
+		perror( path );
+		close( s );
+		return( 1 );
+	}
+
+	// a client that goes away should not take us with it
+	signal( SIGPIPE, SIG_IGN );
+
+	int nthreads = threads;
+	if (nthreads <= 1)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+	if (nthreads < 1)
+		nthreads = 1;
+
+	struct serve_queue q;
+	q.head = 0;
+	q.count = 0;
+	pthread_mutex_init( &q.lock, 0 );
+	pthread_cond_init( &q.ready, 0 );
+	pthread_cond_init( &q.room, 0 );
+	struct serve_worker *workers = (struct serve_worker *)
+			calloc( nthreads, sizeof (struct serve_worker) );
+	for( int t = 0; t < nthreads; t++ ) {
+		pthread_t tid;
+		workers[t].queue = &q;
+		workers[t].pool = new StringPool;
+		pthread_create( &tid, 0, serve_worker, &workers[t] );
+		pthread_detach( tid );
+	}
+	if (verbose)
+		fprintf( stderr, "serving %s (%d threads)\n", path, nthreads );
+
+	for( ;; ) {
+		int fd = accept( s, 0, 0 );
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror( "accept" );
+			break;
+		}
+		struct timeval tv;
+		tv.tv_sec = SERVE_TIMEOUT;
+		tv.tv_usec = 0;
+		setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv );
+		setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv );
+		pthread_mutex_lock( &q.lock );
+		while( q.count == SERVE_QUEUE )
+			pthread_cond_wait( &q.room, &q.lock );
+		q.fds[(q.head + q.count) % SERVE_QUEUE] = fd;
+		q.count++;
+		pthread_cond_signal( &q.ready );
+		pthread_mutex_unlock( &q.lock );
+	}
+	close( s );
+	return( 1 );
+}
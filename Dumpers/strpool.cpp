@@ -0,0 +1,118 @@
+/*
+ * module:	strpool.cpp
+ *
+ * purpose:	a pool of interned (hash-consed) strings
+ *
+ * note:	each string is stored as its 32-bit length, the
+ *		characters, and a NUL (and padded to keep the next
+ *		length aligned).  The hash table holds the full hash
+ *		of each string, so a probe only compares characters
+ *		when the hashes match.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "strpool.h"
+#include "palmhash.h"
+
+static const size_t POOL_CHUNK = 64 * 1024;	// string storage chunk
+static const size_t POOL_SLOTS = 256;		// initial hash table size
+
+StringPool::StringPool() {
+	_mask = POOL_SLOTS - 1;
+	_slots = (struct slot *) calloc( POOL_SLOTS, sizeof (struct slot) );
+	_count = 0;
+	_lookups = 0;
+	_bytes = 0;
+	_chunks = 0;
+	_num_chunks = 0;
+	_max_chunks = 0;
+	_chunk = 0;
+	_chunk_used = 0;
+}
+
+StringPool::~StringPool() {
+	for( int i = 0; i < _num_chunks; i++ )
+		free( _chunks[i] );
+	free( _chunks );
+	free( _slots );
+}
+
+/*
+ * routine:	alloc
+ *
+ * purpose:	space for a stored string (from the current chunk,
+ *		or a new one; a very long string gets its own)
+ */
+char *StringPool::alloc( size_t len ) {
+	len = (len + 3) & ~(size_t) 3;
+	_bytes += len;
+
+	bool own = (len > POOL_CHUNK / 4);
+	if (own || _chunk == 0 || _chunk_used + len > POOL_CHUNK) {
+		if (_num_chunks == _max_chunks) {
+			_max_chunks = _max_chunks ? 2 * _max_chunks : 16;
+			_chunks = (char **) realloc( _chunks, _max_chunks * sizeof (char *) );
+		}
+		char *c = (char *) malloc( own ? len : POOL_CHUNK );
+		_chunks[_num_chunks++] = c;
+		if (own)
+			return( c );
+		_chunk = c;
+		_chunk_used = 0;
+	}
+	char *p = _chunk + _chunk_used;
+	_chunk_used += len;
+	return( p );
+}
+
+void StringPool::rehash() {
+	size_t n = 2 * (_mask + 1);
+	struct slot *slots = (struct slot *) calloc( n, sizeof (struct slot) );
+	for( size_t i = 0; i <= _mask; i++ ) {
+		if (_slots[i].str == 0)
+			continue;
+		size_t j = _slots[i].hash & (n - 1);
+		while( slots[j].str != 0 )
+			j = (j + 1) & (n - 1);
+		slots[j] = _slots[i];
+	}
+	free( _slots );
+	_slots = slots;
+	_mask = n - 1;
+}
+
+/*
+ * routine:	intern
+ *
+ * purpose:	find (or add) a string in the pool
+ *
+ * returns:	the pool's (NUL terminated) copy
+ */
+const char *StringPool::intern( const char *s, unsigned len ) {
+	if (s == 0)
+		return( 0 );
+	_lookups++;
+
+	uint64_t h = palm_hash( s, len );
+	size_t i = h & _mask;
+	while( _slots[i].str != 0 ) {
+		if (_slots[i].hash == h && length( _slots[i].str ) == len &&
+				memcmp( _slots[i].str, s, len ) == 0)
+			return( _slots[i].str );
+		i = (i + 1) & _mask;
+	}
+
+	// a new one
+	char *p = alloc( sizeof (uint32_t) + len + 1 ) + sizeof (uint32_t);
+	((uint32_t *) p)[-1] = len;
+	memcpy( p, s, len );
+	p[len] = 0;
+	_slots[i].hash = h;
+	_slots[i].str = p;
+
+	// keep the table at most half full
+	if (++_count * 2 > (long) _mask)
+		rehash();
+	return( p );
+}
@@ -0,0 +1,62 @@
+/*
+ * module:	strpool.h
+ *
+ * purpose:	a pool of interned (hash-consed) strings
+ *
+ * note:	each distinct string is kept just once, so the same
+ *		summary in a thousand records costs one copy, and two
+ *		interned strings (from the same pool) are equal if and
+ *		only if their pointers are.
+ *
+ *		The strings live in large chunks that are never moved
+ *		or freed until the pool is, so the pointers are good
+ *		for the life of the pool.
+ */
+#ifndef _STRPOOL_H
+#define _STRPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class StringPool {
+   public:
+	StringPool();
+	~StringPool();
+
+	// the pool's copy of a string (0 for 0)
+	const char *intern( const char *s, unsigned len );
+	const char *intern( const char *s ) {
+		return( s ? intern( s, strlen( s ) ) : 0 );
+	}
+
+	// the length of an interned string
+	static unsigned length( const char *s ) {
+		return( s ? ((const uint32_t *) s)[-1] : 0 );
+	}
+
+	long strings()		{ return( _count ); }	// distinct strings
+	long lookups()		{ return( _lookups ); }	// intern calls
+	size_t bytes()		{ return( _bytes ); }	// space used
+
+   private:
+	void rehash();
+	char *alloc( size_t len );
+
+	struct slot {
+		uint64_t	hash;
+		const char	*str;
+	}		*_slots;	// open addressed (linear probe)
+	size_t		_mask;		// (number of slots - 1)
+	long		_count;
+	long		_lookups;
+	size_t		_bytes;
+
+	char		**_chunks;	// string storage
+	int		_num_chunks;
+	int		_max_chunks;
+	char		*_chunk;	// the one being filled
+	size_t		_chunk_used;
+};
+
+#endif
@@ -0,0 +1,483 @@
+/*
+ * module:	tzone.cpp
+ *
+ * purpose:	time zones, from zoneinfo files
+ *
+ * note:	the file format is RFC 8536 (TZif).  We use the 64-bit
+ *		data of version 2+ files, and ignore leap seconds (the
+ *		"right/" zones) since the Palm never knew about them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "tzone.h"
+
+extern bool verbose;
+
+TimeZone *local_zone = 0;
+
+static const long DAY = 24 * 60 * 60;
+static const int LAST_YEAR = 2040;	// (the end of Palm time)
+
+static uint32_t be32( const unsigned char *p ) {
+	return( ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] );
+}
+
+static int64_t be64( const unsigned char *p ) {
+	return( (int64_t) (((uint64_t) be32( p ) << 32) | be32( p + 4 )) );
+}
+
+TimeZone::TimeZone() {
+	_name = 0;
+	_types = 0;
+	_num_types = 0;
+	_at = 0;
+	_wall = 0;
+	_to = 0;
+	_num_trans = 0;
+	_max_trans = 0;
+}
+
+TimeZone::~TimeZone() {
+	free( _name );
+	free( _types );
+	free( _at );
+	free( _wall );
+	free( _to );
+}
+
+/*
+ * routine:	load
+ *
+ * purpose:	read a zone file, and build its transition tables
+ *
+ * returns:	a new TimeZone, or 0
+ */
+TimeZone *TimeZone::load( const char *name ) {
+	char path[1024];
+	if (name[0] == '/' || name[0] == '.')
+		snprintf( path, sizeof path, "%s", name );
+	else {
+		const char *dir = getenv( "TZDIR" );
+		snprintf( path, sizeof path, "%s/%s",
+				dir ? dir : "/usr/share/zoneinfo", name );
+	}
+
+	FILE *f = fopen( path, "r" );
+	if (f == 0)
+		return( 0 );
+	size_t max = 64 * 1024;
+	unsigned char *buf = (unsigned char *) malloc( max );
+	size_t len = 0;
+	size_t n;
+	while( (n = fread( buf + len, 1, max - len, f )) > 0 ) {
+		len += n;
+		if (len == max) {
+			max *= 2;
+			buf = (unsigned char *) realloc( buf, max );
+		}
+	}
+	fclose( f );
+
+	TimeZone *z = new TimeZone;
+	bool ok = z->parse( buf, len );
+	free( buf );
+	if (!ok) {
+		delete z;
+		return( 0 );
+	}
+
+	// the wall clock time at which each transition takes effect:
+	// a time skipped (or repeated) by it is taken with the earlier
+	// offset, as RFC 5545 says it should be
+	z->_wall = (int64_t *) malloc( (z->_num_trans + 1) * sizeof (int64_t) );
+	for( long i = 0; i < z->_num_trans; i++ ) {
+		long before = z->offsetBefore( i );
+		long after = z->_types[z->_to[i]].offset;
+		z->_wall[i] = z->_at[i] + ((before > after) ? before : after);
+	}
+	z->_name = strdup( name );
+	return( z );
+}
+
+/*
+ * routine:	parse
+ *
+ * purpose:	take the types and transitions from a TZif file
+ *		(and then extend them with its footer rule)
+ */
+bool TimeZone::parse( const unsigned char *p, size_t len ) {
+	const size_t HDR = 44;
+	if (len < HDR || memcmp( p, "TZif", 4 ) != 0)
+		return( false );
+
+	// with version 2+ files, skip over the 32-bit data
+	int tsize = 4;
+	const unsigned char *end = p + len;
+	if (p[4] >= '2') {
+		size_t v1 = be32( p+32 ) * 5 + be32( p+36 ) * 6 + be32( p+40 ) +
+			be32( p+28 ) * 8 + be32( p+24 ) + be32( p+20 );
+		if (HDR + v1 + HDR > len || memcmp( p + HDR + v1, "TZif", 4 ) != 0)
+			return( false );
+		p += HDR + v1;
+		tsize = 8;
+	}
+
+	uint32_t isutcnt = be32( p+20 );
+	uint32_t isstdcnt = be32( p+24 );
+	uint32_t leapcnt = be32( p+28 );
+	uint32_t timecnt = be32( p+32 );
+	uint32_t typecnt = be32( p+36 );
+	uint32_t charcnt = be32( p+40 );
+	const unsigned char *times = p + HDR;
+	const unsigned char *idx = times + timecnt * tsize;
+	const unsigned char *info = idx + timecnt;
+	const char *chars = (const char *) (info + typecnt * 6);
+	const unsigned char *footer = (const unsigned char *) chars + charcnt +
+			leapcnt * (tsize + 4) + isstdcnt + isutcnt;
+	if (typecnt == 0 || typecnt > 255 || footer > end)
+		return( false );
+
+	_types = (TimeZoneType *) calloc( typecnt, sizeof (TimeZoneType) );
+	for( uint32_t i = 0; i < typecnt; i++ ) {
+		const unsigned char *t = info + i * 6;
+		_types[i].offset = (int32_t) be32( t );
+		_types[i].isdst = t[4] != 0;
+		if (t[5] < charcnt)
+			snprintf( _types[i].abbr, sizeof _types[i].abbr, "%.*s",
+					(int) (charcnt - t[5]), chars + t[5] );
+	}
+	_num_types = typecnt;
+
+	for( uint32_t i = 0; i < timecnt; i++ ) {
+		int64_t at = (tsize == 8) ? be64( times + i * 8 ) :
+				(int32_t) be32( times + i * 4 );
+		if (idx[i] >= typecnt)
+			return( false );
+		addTransition( at, idx[i] );
+	}
+
+	// the footer rule (between newlines) covers what follows
+	if (tsize == 8 && footer < end && *footer == '\n') {
+		const unsigned char *nl = (const unsigned char *)
+				memchr( footer + 1, '\n', end - footer - 1 );
+		if (nl != 0 && nl > footer + 1) {
+			char rule[256];
+			snprintf( rule, sizeof rule, "%.*s",
+					(int) (nl - footer - 1), footer + 1 );
+			if (!extend( rule ) && verbose)
+				fprintf( stderr, "ignoring zone rule %s\n", rule );
+		}
+	}
+	return( true );
+}
+
+void TimeZone::addTransition( int64_t at, int type ) {
+	if (_num_trans == _max_trans) {
+		_max_trans = _max_trans ? 2 * _max_trans : 256;
+		_at = (int64_t *) realloc( _at, _max_trans * sizeof (int64_t) );
+		_to = (uint8_t *) realloc( _to, _max_trans * sizeof (uint8_t) );
+	}
+	_at[_num_trans] = at;
+	_to[_num_trans++] = type;
+}
+
+int TimeZone::findType( long offset, bool isdst, const char *abbr ) {
+	for( int i = 0; i < _num_types; i++ )
+		if (_types[i].offset == offset && _types[i].isdst == isdst &&
+				strcmp( _types[i].abbr, abbr ) == 0)
+			return( i );
+	if (_num_types == 255)
+		return( -1 );
+	_types = (TimeZoneType *) realloc( _types, (_num_types + 1) * sizeof (TimeZoneType) );
+	TimeZoneType *t = &_types[_num_types];
+	t->offset = offset;
+	t->isdst = isdst;
+	snprintf( t->abbr, sizeof t->abbr, "%s", abbr );
+	return( _num_types++ );
+}
+
+/*
+ * the pieces of a POSIX TZ string, e.g. EST5EDT,M3.2.0,M11.1.0
+ */
+static const char *posix_name( const char *s, char *name, size_t len ) {
+	const char *start = s;
+	if (*s == '<') {
+		start = ++s;
+		while( *s && *s != '>' )
+			s++;
+		if (*s != '>')
+			return( 0 );
+		snprintf( name, len, "%.*s", (int) (s - start), start );
+		return( s + 1 );
+	}
+	while( isalpha( (unsigned char) *s ) )
+		s++;
+	if (s - start < 3)
+		return( 0 );
+	snprintf( name, len, "%.*s", (int) (s - start), start );
+	return( s );
+}
+
+// [+-]hh[:mm[:ss]], in seconds
+static const char *posix_time( const char *s, long *t ) {
+	int sign = 1;
+	if (*s == '+' || *s == '-')
+		sign = (*s++ == '-') ? -1 : 1;
+	if (!isdigit( (unsigned char) *s ))
+		return( 0 );
+	long h = strtol( s, (char **) &s, 10 );
+	long m = 0, sec = 0;
+	if (*s == ':') {
+		m = strtol( s + 1, (char **) &s, 10 );
+		if (*s == ':')
+			sec = strtol( s + 1, (char **) &s, 10 );
+	}
+	*t = sign * (h * 3600 + m * 60 + sec);
+	return( s );
+}
+
+struct posix_rule {
+	char	kind;		// 'M'onth.week.day, 'J'ulian, or 'D'ay of year
+	int	month;
+	int	week;
+	int	day;
+	long	time;		// (local) time of day
+};
+
+static const char *posix_date( const char *s, struct posix_rule *r ) {
+	if (*s == 'M') {
+		r->kind = 'M';
+		if (sscanf( s + 1, "%d.%d.%d", &r->month, &r->week, &r->day ) != 3 ||
+				r->month < 1 || r->month > 12 ||
+				r->week < 1 || r->week > 5 || r->day < 0 || r->day > 6)
+			return( 0 );
+		s++;
+		while( isdigit( (unsigned char) *s ) || *s == '.' )
+			s++;
+	} else {
+		r->kind = 'D';
+		if (*s == 'J') {
+			r->kind = 'J';
+			s++;
+		}
+		if (!isdigit( (unsigned char) *s ))
+			return( 0 );
+		r->day = strtol( s, (char **) &s, 10 );
+	}
+	r->time = 2 * 3600;
+	if (*s == '/')
+		s = posix_time( s + 1, &r->time );
+	return( s );
+}
+
+static bool leap_year( int y ) {
+	return( (y % 4 == 0 && y % 100 != 0) || y % 400 == 0 );
+}
+
+// the local time (as if it were GMT) a rule takes effect in a year
+static int64_t posix_when( int year, const struct posix_rule *r ) {
+	struct tm tm;
+	memset( &tm, 0, sizeof tm );
+	tm.tm_year = year - 1900;
+	tm.tm_mday = 1;
+	int64_t jan1 = timegm( &tm );
+
+	int64_t day;
+	if (r->kind == 'J')	// 1..365, never counting February 29
+		day = r->day - 1 + ((leap_year( year ) && r->day >= 60) ? 1 : 0);
+	else if (r->kind == 'D')
+		day = r->day;
+	else {
+		tm.tm_mon = r->month - 1;
+		int64_t first = timegm( &tm );
+		int wday = (int) ((first / DAY + 4) % 7);	// (1970/1/1 was a Thursday)
+		static const int mdays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		int days = mdays[r->month - 1] + ((r->month == 2 && leap_year( year )) ? 1 : 0);
+		int mday = 1 + (r->day - wday + 7) % 7 + 7 * (r->week - 1);
+		while( mday > days )	// (week 5 is the last one)
+			mday -= 7;
+		return( first + (mday - 1) * DAY + r->time );
+	}
+	return( jan1 + day * DAY + r->time );
+}
+
+/*
+ * routine:	extend
+ *
+ * purpose:	add the transitions of a POSIX TZ rule, from the last
+ *		one in the file through the end of Palm time
+ *
+ * returns:	whether the rule made sense
+ */
+bool TimeZone::extend( const char *rule ) {
+	char std[16], dst[16];
+	long stdoff, dstoff;
+	const char *s = posix_name( rule, std, sizeof std );
+	if (s == 0 || (s = posix_time( s, &stdoff )) == 0)
+		return( false );
+	stdoff = -stdoff;	// (POSIX offsets are west of UTC)
+	if (*s == 0)
+		return( true );	// no daylight time, so nothing more to add
+
+	if ((s = posix_name( s, dst, sizeof dst )) == 0)
+		return( false );
+	dstoff = stdoff + 3600;
+	if (*s != ',' && *s != 0) {
+		if ((s = posix_time( s, &dstoff )) == 0)
+			return( false );
+		dstoff = -dstoff;
+	}
+	struct posix_rule start, end;
+	if (*s == 0) {	// the (old) US default
+		posix_date( "M3.2.0", &start );
+		posix_date( "M11.1.0", &end );
+	} else if (*s != ',' || (s = posix_date( s + 1, &start )) == 0 ||
+			*s != ',' || (s = posix_date( s + 1, &end )) == 0 || *s != 0)
+		return( false );
+
+	int stdtype = findType( stdoff, false, std );
+	int dsttype = findType( dstoff, true, dst );
+	if (stdtype < 0 || dsttype < 0)
+		return( false );
+
+	// each year's two transitions, in order (the southern
+	// hemisphere ends daylight time before starting it)
+	int64_t last = _num_trans ? _at[_num_trans-1] : INT64_MIN;
+	int first_year = 1970;
+	if (_num_trans) {
+		time_t t = (time_t) last;
+		struct tm tm;
+		gmtime_r( &t, &tm );
+		first_year = tm.tm_year + 1900;
+	}
+	for( int y = first_year; y <= LAST_YEAR; y++ ) {
+		int64_t on = posix_when( y, &start ) - stdoff;
+		int64_t off = posix_when( y, &end ) - dstoff;
+		if (on < off) {
+			if (on > last)
+				addTransition( on, dsttype );
+			if (off > last)
+				addTransition( off, stdtype );
+		} else {
+			if (off > last)
+				addTransition( off, stdtype );
+			if (on > last)
+				addTransition( on, dsttype );
+		}
+	}
+	return( true );
+}
+
+// the last transition at or before a time (-1 if none)
+long TimeZone::transitionAt( time_t utc ) {
+	long lo = 0, hi = _num_trans;
+	while( lo < hi ) {
+		long mid = (lo + hi) / 2;
+		if (_at[mid] <= utc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return( lo - 1 );
+}
+
+/*
+ * routine:	utc
+ *
+ * purpose:	convert a (device) local time to UTC
+ */
+time_t TimeZone::utc( time_t local ) {
+	long lo = 0, hi = _num_trans;
+	while( lo < hi ) {
+		long mid = (lo + hi) / 2;
+		if (_wall[mid] <= local)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return( local - _types[(lo > 0) ? _to[lo-1] : 0].offset );
+}
+
+/*
+ * the pieces of a VTIMEZONE
+ */
+static void print_local( FILE *out, time_t t ) {
+	struct tm tm;
+	gmtime_r( &t, &tm );
+	fprintf( out, "%04d%02d%02dT%02d%02d%02d",
+		tm.tm_year+1900, tm.tm_mon + 1, tm.tm_mday,
+		tm.tm_hour, tm.tm_min, tm.tm_sec );
+}
+
+static void print_offset( FILE *out, const char *what, long off ) {
+	char sign = (off < 0) ? '-' : '+';
+	if (off < 0)
+		off = -off;
+	fprintf( out, "%s:%c%02ld%02ld", what, sign, off / 3600, (off / 60) % 60 );
+	if (off % 60)
+		fprintf( out, "%02ld", off % 60 );
+	fprintf( out, "\n" );
+}
+
+/*
+ * routine:	vtimezone
+ *
+ * purpose:	describe the zone over a range of local times
+ *
+ * note:	the transitions in the range (and the one in effect at
+ *		its start) are grouped by their offsets and name, each
+ *		group a STANDARD or DAYLIGHT with an RDATE per further
+ *		transition, so a zone that has followed a rule for
+ *		years takes two sub-components however long the range.
+ */
+void TimeZone::vtimezone( FILE *out, time_t from, time_t to ) {
+	fprintf( out, "BEGIN:VTIMEZONE\n" );
+	fprintf( out, "TZID:%s\n", _name );
+
+	long lo = transitionAt( utc( from ) );
+	long hi = transitionAt( utc( to ) );
+	if (lo < 0) {	// (before the first transition)
+		const TimeZoneType *t = &_types[0];
+		fprintf( out, "BEGIN:%s\n", t->isdst ? "DAYLIGHT" : "STANDARD" );
+		fprintf( out, "DTSTART:19700101T000000\n" );
+		print_offset( out, "TZOFFSETFROM", t->offset );
+		print_offset( out, "TZOFFSETTO", t->offset );
+		if (t->abbr[0])
+			fprintf( out, "TZNAME:%s\n", t->abbr );
+		fprintf( out, "END:%s\n", t->isdst ? "DAYLIGHT" : "STANDARD" );
+		lo = 0;
+	}
+
+	for( long i = lo; i <= hi; i++ ) {
+		// has this group already been put out
+		long before = offsetBefore( i );
+		long j;
+		for( j = lo; j < i; j++ )
+			if (_to[j] == _to[i] && offsetBefore( j ) == before)
+				break;
+		if (j < i)
+			continue;
+
+		// (a transition's DTSTART is in the time it replaces)
+		const TimeZoneType *t = &_types[_to[i]];
+		fprintf( out, "BEGIN:%s\n", t->isdst ? "DAYLIGHT" : "STANDARD" );
+		fprintf( out, "DTSTART:" );
+		print_local( out, _at[i] + before );
+		fprintf( out, "\n" );
+		for( j = i + 1; j <= hi; j++ )
+			if (_to[j] == _to[i] && offsetBefore( j ) == before) {
+				fprintf( out, "RDATE:" );
+				print_local( out, _at[j] + before );
+				fprintf( out, "\n" );
+			}
+		print_offset( out, "TZOFFSETFROM", before );
+		print_offset( out, "TZOFFSETTO", t->offset );
+		if (t->abbr[0])
+			fprintf( out, "TZNAME:%s\n", t->abbr );
+		fprintf( out, "END:%s\n", t->isdst ? "DAYLIGHT" : "STANDARD" );
+	}
+	fprintf( out, "END:VTIMEZONE\n" );
+}
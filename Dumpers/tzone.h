@@ -0,0 +1,76 @@
+/*
+ * module:	tzone.h
+ *
+ * purpose:	conversion between device local time and UTC,
+ *		from a zoneinfo (TZif) file
+ *
+ * note:	the archive's times are wall clock times in whatever
+ *		zone the Palm was set to, which everything else treats
+ *		as if it were GMT (gmtime_r, timegm).  A TimeZone reads
+ *		its zone file once, and extends the transitions (with
+ *		the file's POSIX TZ rule) to the end of Palm time, so
+ *		a conversion is just a binary search of that table,
+ *		rather than a mktime/localtime call per instance.
+ */
+#ifndef _TZONE_H
+#define _TZONE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// a kind of local time (e.g. EST or EDT)
+struct TimeZoneType {
+	int32_t	offset;		// seconds east of UTC
+	bool	isdst;
+	char	abbr[16];
+};
+
+class TimeZone {
+   public:
+	// read a zone: a name (under $TZDIR or /usr/share/zoneinfo)
+	// or a path (0 if it is not a usable zone file)
+	static TimeZone *load( const char *name );
+	~TimeZone();
+
+	const char *name()	{ return( _name ); }
+
+	// the offset from UTC in effect at a UTC time
+	long offset( time_t utc )	{ return( _types[typeAt( utc )].offset ); }
+
+	// local wall clock time to UTC (and back)
+	time_t utc( time_t local );
+	time_t local( time_t utc )	{ return( utc + offset( utc ) ); }
+
+	// a VTIMEZONE for the local times in [from, to]
+	void vtimezone( FILE *out, time_t from, time_t to );
+
+   private:
+	TimeZone();
+	bool parse( const unsigned char *p, size_t len );
+	bool extend( const char *rule );
+	int findType( long offset, bool isdst, const char *abbr );
+	void addTransition( int64_t at, int type );
+	long transitionAt( time_t utc );
+	int typeAt( time_t utc ) {
+		long i = transitionAt( utc );
+		return( (i < 0) ? 0 : _to[i] );
+	}
+	long offsetBefore( long i ) {
+		return( _types[(i > 0) ? _to[i-1] : 0].offset );
+	}
+
+	char		*_name;
+	TimeZoneType	*_types;	// (type 0 is in effect before the first transition)
+	int		_num_types;
+	int64_t		*_at;		// transition times (UTC)
+	int64_t		*_wall;		// ... as local times (see utc)
+	uint8_t		*_to;		// the type after each transition
+	long		_num_trans;
+	long		_max_trans;
+};
+
+// the zone the archives' times are in (0: take them as UTC)
+extern TimeZone *local_zone;
+
+#endif
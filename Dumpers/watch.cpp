@@ -0,0 +1,358 @@
+/*
+ * module:	watch.cpp
+ *
+ * purpose:	watch a drop directory, converting each datebook
+ *		archive that appears (or changes) in it
+ *
+ * note:	inotify tells us when a .dba file has been written (and
+ *		closed) or moved into the directory, so we never poll or
+ *		rescan it (except once at the start, and if the kernel's
+ *		event queue overflows).
+ *
+ *		Events are coalesced per file: a file is queued at most
+ *		once, and one that changes while it is being converted
+ *		is simply converted again afterwards.  A fixed pool of
+ *		workers takes files from the queue, and only reconverts
+ *		one whose contents hash differently than last time.
+ *		That hash (and the format) is kept beside the archive
+ *		(.foo.dba.hash), so a restart does not convert it all
+ *		over again.
+ *		The output (e.g. foo.ics, next to foo.dba) is written to
+ *		a temporary name and renamed, so it is never seen half
+ *		written.
+ *
+ *		Archives are read (into each worker's buffer) rather than
+ *		mapped, since an upload may truncate and rewrite one while
+ *		we are looking at it, and a mapping would fault.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "palmarchive.h"
+#include "dbdecode.h"
+#include "dbformat.h"
+#include "palmhash.h"
+
+extern bool verbose;	// commentary on what we find
+extern int threads;	// how many files to convert at once
+
+static const int WATCH_BUCKETS = 1024;	// (file table hash chains)
+static const int WATCH_MAX_THREADS = 8;
+
+// what we know about each archive in the directory
+struct watch_file {
+	char		*name;
+	uint64_t	hash;		// of the contents we last converted
+	bool		hashed;
+	bool		queued;		// waiting for a worker
+	bool		running;	// being converted
+	bool		again;		// changed while it was being converted
+	struct watch_file *next;	// (hash chain)
+	struct watch_file *qnext;	// (work queue)
+};
+
+struct watch_state {
+	const char	*dir;
+	const char	*format;
+	struct watch_file *files[WATCH_BUCKETS];
+	struct watch_file *head;	// the work queue
+	struct watch_file *tail;
+	pthread_mutex_t	lock;
+	pthread_cond_t	ready;
+};
+
+// is this the name of an archive
+static bool is_archive( const char *name ) {
+	size_t len = strlen( name );
+	return( len > 4 && name[0] != '.' && strcasecmp( name + len - 4, ".dba" ) == 0 );
+}
+
+/*
+ * routine:	enqueue
+ *
+ * purpose:	note that an archive has (or may have) changed
+ *
+ * note:	called with the lock held
+ */
+static void enqueue( struct watch_state *w, const char *name ) {
+	unsigned b = palm_hash( name, strlen( name ) ) % WATCH_BUCKETS;
+	struct watch_file *f;
+	for( f = w->files[b]; f != 0; f = f->next )
+		if (strcmp( f->name, name ) == 0)
+			break;
+	if (f == 0) {
+		f = (struct watch_file *) calloc( 1, sizeof (struct watch_file) );
+		f->name = strdup( name );
+		f->next = w->files[b];
+		w->files[b] = f;
+	}
+
+	if (f->running) {
+		f->again = true;
+		return;
+	}
+	if (f->queued)
+		return;
+	f->queued = true;
+	f->qnext = 0;
+	if (w->tail)
+		w->tail->qnext = f;
+	else
+		w->head = f;
+	w->tail = f;
+	pthread_cond_signal( &w->ready );
+}
+
+// a worker's buffer, kept from one archive to the next
+struct watch_buffer {
+	unsigned char	*buf;
+	size_t		len;
+	size_t		max;
+};
+
+static bool read_file( const char *path, struct watch_buffer *b ) {
+	FILE *f = fopen( path, "r" );
+	if (f == 0)
+		return( false );
+	b->len = 0;
+	for( ;; ) {
+		if (b->len == b->max) {
+			b->max = b->max ? 2 * b->max : 64 * 1024;
+			b->buf = (unsigned char *) realloc( b->buf, b->max );
+		}
+		size_t n = fread( b->buf + b->len, 1, b->max - b->len, f );
+		if (n == 0)
+			break;
+		b->len += n;
+	}
+	fclose( f );
+	return( true );
+}
+
+// the hash (for this format) of what the output was made from
+static bool load_hash( const char *path, const char *format, uint64_t *hash ) {
+	format = format_name( format );
+	FILE *f = fopen( path, "r" );
+	if (f == 0)
+		return( false );
+	unsigned long long h;
+	char name[32];
+	bool ok = (fscanf( f, "%llx %31s", &h, name ) == 2 &&
+			strcmp( name, format ) == 0);
+	fclose( f );
+	*hash = h;
+	return( ok );
+}
+
+static void save_hash( const char *path, const char *tmp, const char *format, uint64_t hash ) {
+	FILE *f = fopen( tmp, "w" );
+	if (f == 0) {
+		perror( tmp );
+		return;
+	}
+	fprintf( f, "%016llx %s\n", (unsigned long long) hash, format_name( format ) );
+	if (fclose( f ) != 0 || rename( tmp, path ) != 0) {
+		perror( path );
+		unlink( tmp );
+	}
+}
+
+/*
+ * routine:	convert
+ *
+ * purpose:	convert an archive (if it has changed), atomically
+ *		replacing its output file
+ *
+ * returns:	0 (or 1 on failure)
+ */
+static int convert( struct watch_state *w, struct watch_file *f, struct watch_buffer *b ) {
+	char path[PATH_MAX];
+	snprintf( path, sizeof path, "%s/%s", w->dir, f->name );
+	if (!read_file( path, b )) {
+		perror( path );
+		return( 1 );
+	}
+
+	char out[PATH_MAX], tmp[PATH_MAX], saved[PATH_MAX];
+	snprintf( out, sizeof out, "%s/%.*s%s", w->dir, (int) (strlen( f->name ) - 4),
+			f->name, format_extension( w->format ) );
+	snprintf( tmp, sizeof tmp, "%s/.%s.tmp", w->dir, f->name );
+	snprintf( saved, sizeof saved, "%s/.%s.hash", w->dir, f->name );
+
+	// has it really changed (since we, or an earlier run, converted it)
+	uint64_t hash = palm_hash( b->buf, b->len );
+	if (!f->hashed && access( out, F_OK ) == 0)
+		f->hashed = load_hash( saved, w->format, &f->hash );
+	if (f->hashed && hash == f->hash) {
+		if (verbose)
+			fprintf( stderr, "%s is unchanged\n", path );
+		return( 0 );
+	}
+	PalmArchive arc( b->buf, b->len );
+	if (arc.error() != 0) {
+		fprintf( stderr, "Error (%s) initializing %s\n", arc.error(), path );
+		return( 1 );
+	}
+	if (arc.fileType() != arc.DBA_SIG) {
+		fprintf( stderr, "%s is not a datebook\n", path );
+		return( 1 );
+	}
+
+	FILE *o = fopen( tmp, "w" );
+	if (o == 0) {
+		perror( tmp );
+		return( 1 );
+	}
+	DatebookFormatter *fmt = new_formatter( w->format, o );
+	int ret = decode_datebook( &arc, fmt );
+	fmt->finish();
+	delete fmt;
+	if (fclose( o ) != 0)
+		ret = 1;
+	if (ret != 0 || rename( tmp, out ) != 0) {
+		fprintf( stderr, "Error converting %s\n", path );
+		unlink( tmp );
+		return( 1 );
+	}
+
+	f->hash = hash;
+	f->hashed = true;
+	save_hash( saved, tmp, w->format, hash );
+	if (verbose)
+		fprintf( stderr, "%s -> %s\n", path, out );
+	return( 0 );
+}
+
+static void *watch_worker( void *arg ) {
+	struct watch_state *w = (struct watch_state *) arg;
+	struct watch_buffer b = { 0, 0, 0 };
+	pthread_mutex_lock( &w->lock );
+	for( ;; ) {
+		while( w->head == 0 )
+			pthread_cond_wait( &w->ready, &w->lock );
+		struct watch_file *f = w->head;
+		w->head = f->qnext;
+		if (w->head == 0)
+			w->tail = 0;
+		f->queued = false;
+		f->running = true;
+		f->again = false;
+
+		// (the entry is ours, while it is running)
+		pthread_mutex_unlock( &w->lock );
+		convert( w, f, &b );
+		pthread_mutex_lock( &w->lock );
+
+		f->running = false;
+		if (f->again)
+			enqueue( w, f->name );
+	}
+	return( 0 );
+}
+
+// queue up every archive in the directory
+static void scan( struct watch_state *w ) {
+	DIR *d = opendir( w->dir );
+	if (d == 0)
+		return;
+	struct dirent *e;
+	pthread_mutex_lock( &w->lock );
+	while( (e = readdir( d )) != 0 )
+		if (is_archive( e->d_name ))
+			enqueue( w, e->d_name );
+	pthread_mutex_unlock( &w->lock );
+	closedir( d );
+}
+
+/*
+ * routine:	watch_datebooks
+ *
+ * purpose:	convert the archives in a directory, now and whenever
+ *		they change (until something goes wrong)
+ *
+ * returns:	1 (it only returns on failure)
+ */
+int watch_datebooks( const char *dir, const char *format ) {
+	int fd = inotify_init1( IN_CLOEXEC );
+	if (fd < 0) {
+		perror( "inotify" );
+		return( 1 );
+	}
+	// (a finished write, or a file moved in, but nothing half-written)
+	if (inotify_add_watch( fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+			IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR ) < 0) {
+		perror( dir );
+		close( fd );
+		return( 1 );
+	}
+
+	struct watch_state *w = (struct watch_state *) calloc( 1, sizeof (struct watch_state) );
+	w->dir = dir;
+	w->format = format;
+	pthread_mutex_init( &w->lock, 0 );
+	pthread_cond_init( &w->ready, 0 );
+
+	int nthreads = threads;
+	if (nthreads <= 1)
+		nthreads = sysconf( _SC_NPROCESSORS_ONLN );
+	if (nthreads > WATCH_MAX_THREADS)
+		nthreads = WATCH_MAX_THREADS;
+	if (nthreads < 1)
+		nthreads = 1;
+	for( int t = 0; t < nthreads; t++ ) {
+		pthread_t tid;
+		pthread_create( &tid, 0, watch_worker, w );
+		pthread_detach( tid );
+	}
+	if (verbose)
+		fprintf( stderr, "watching %s (%d threads)\n", dir, nthreads );
+
+	// what is already there (the watch is in place, so nothing is missed)
+	scan( w );
+
+	char buf[64 * 1024] __attribute__ ((aligned( __alignof__( struct inotify_event ) )));
+	for( ;; ) {
+		ssize_t n = read( fd, buf, sizeof buf );
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror( "inotify read" );
+			break;
+		}
+
+		bool gone = false;
+		bool overflow = false;
+		pthread_mutex_lock( &w->lock );
+		for( char *p = buf; p < buf + n; ) {
+			const struct inotify_event *e = (const struct inotify_event *) p;
+			p += sizeof (struct inotify_event) + e->len;
+			if (e->mask & IN_Q_OVERFLOW)
+				overflow = true;
+			else if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+				gone = true;
+			else if (e->len > 0 && is_archive( e->name ))
+				enqueue( w, e->name );
+		}
+		pthread_mutex_unlock( &w->lock );
+
+		if (gone) {
+			fprintf( stderr, "%s has gone away\n", dir );
+			break;
+		}
+		if (overflow) {	// (we have lost track, so look at everything)
+			if (verbose)
+				fprintf( stderr, "inotify overflow, rescanning %s\n", dir );
+			scan( w );
+		}
+	}
+	close( fd );
+	return( 1 );
+}